@@ -0,0 +1,908 @@
+
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef ENABLE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#endif
+
+#define BBCDEBUG_LEVEL 1
+#include "AsyncFileIO.h"
+#include "SystemParameters.h"
+
+BBC_AUDIOTOOLBOX_START
+
+const uint_t AsyncFileIO::DefaultThreads = 2;
+
+AsyncFileIO          *AsyncFileIO::instance = NULL;
+AsyncFileIO::BACKEND AsyncFileIO::backend   = AsyncFileIO::BACKEND_AUTO;
+bool                 AsyncFileIO::backendselected = false;
+
+/*--------------------------------------------------------------------------------*/
+/** Thread pool backend: worker threads perform blocking positioned writes
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadAsyncFileIO : public AsyncFileIO
+{
+public:
+  ThreadAsyncFileIO(uint_t nthreads);
+  virtual ~ThreadAsyncFileIO();
+
+  virtual BACKEND GetType() const {return BACKEND_THREADS;}
+
+  virtual bool Write(REQUEST *req);
+  virtual void Wake() {wake.Signal();}
+
+protected:
+  virtual void ProcessCompletions(uint_t timeout) {wake.TimedWait(timeout);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Worker thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__WorkerStart(Thread& thread, void *arg)
+  {
+    ThreadAsyncFileIO& service = *(ThreadAsyncFileIO *)arg;
+    return service.Worker(thread);
+  }
+  void *Worker(Thread& thread);
+
+protected:
+  std::vector<Thread *>   workers;
+  ThreadLockObject        requestlock;
+  std::deque<REQUEST *>   requests;
+  ThreadBoolSignalObject  work;
+  ThreadBoolSignalObject  wake;
+};
+
+#ifdef ENABLE_IO_URING
+/*--------------------------------------------------------------------------------*/
+/** io_uring backend: one submission ring for all files, completions reaped by the service thread
+ *
+ * The ring is driven directly through the system calls (liburing is not required)
+ */
+/*--------------------------------------------------------------------------------*/
+class IOUringAsyncFileIO : public AsyncFileIO
+{
+public:
+  IOUringAsyncFileIO(uint_t entries);
+  virtual ~IOUringAsyncFileIO();
+
+  bool IsValid() const {return (ringfd >= 0);}
+
+  virtual BACKEND GetType() const {return BACKEND_IOURING;}
+
+  virtual bool Write(REQUEST *req);
+  virtual void Wake();
+
+protected:
+  virtual void ProcessCompletions(uint_t timeout);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add request to submission ring
+   *
+   * @return false if the ring is full or too many requests are outstanding
+   *
+   * @note sqlock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Queue(REQUEST *req);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Submit everything in the submission ring to the kernel
+   *
+   * @return number of entries left in the ring (e.g. on EAGAIN) which must be submitted later
+   *
+   * @note sqlock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint32_t Submit();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of entries in the submission ring not yet consumed by the kernel
+   *
+   * @note sqlock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint32_t GetUnsubmittedCount() const {return *sqtail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE);}
+
+  // ms between attempts to submit entries the kernel could not accept
+  enum {SubmitRetryInterval = 1};
+
+  /*--------------------------------------------------------------------------------*/
+  /** Unmap rings and close descriptors
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Close();
+
+  /*--------------------------------------------------------------------------------*/
+  /** A short write whose remainder has been resubmitted
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    REQUEST  *req;                       ///< original request
+    REQUEST  remainder;                  ///< part of the original request being written
+    uint64_t written;                    ///< bytes of the original request already written
+  } PARTIAL;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Handle completion of a request, resubmitting the rest of a short write
+   *
+   * @note only called by the service thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ProcessCompletion(REQUEST *req, sint64_t result);
+
+protected:
+  int                   ringfd;
+  int                   eventfd;         ///< signalled by kernel on completion and by Wake()
+  uint8_t               *sqring;
+  size_t                sqringsize;
+  uint8_t               *cqring;
+  size_t                cqringsize;
+  struct io_uring_sqe   *sqes;
+  size_t                sqessize;
+  uint32_t              *sqhead, *sqtail, *sqmask, *sqarray;
+  uint32_t              sqentries;
+  uint32_t              *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe   *cqes;
+  uint32_t              cqentries;
+  ThreadLockObject      sqlock;          ///< protects submission ring, pending and outstanding
+  std::deque<REQUEST *> pending;         ///< requests waiting for space in the rings
+  uint_t                outstanding;     ///< number of requests submitted but not yet reaped
+  std::map<REQUEST *, PARTIAL *> partials; ///< resubmitted short writes by remainder (service thread only)
+};
+#endif
+
+/*--------------------------------------------------------------------------------*/
+/** Base
+ */
+/*--------------------------------------------------------------------------------*/
+AsyncFileIO::AsyncFileIO() : clientlock("AsyncFileIO clients"),
+                             servicenow(false)
+{
+}
+
+AsyncFileIO::~AsyncFileIO()
+{
+}
+
+ThreadLockObject& AsyncFileIO::GetInstanceLock()
+{
+  static ThreadLockObject _lock("AsyncFileIO instance");
+  return _lock;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return the shared service, creating it if necessary
+ */
+/*--------------------------------------------------------------------------------*/
+AsyncFileIO& AsyncFileIO::Get()
+{
+  ThreadLock lock(GetInstanceLock());
+
+  if (!instance)
+  {
+    std::string str;
+
+    // parameter only used if the backend has not been explicitly selected
+    if (!backendselected && SystemParameters::Get().Get("asyncfilebackend", str))
+    {
+      if      (str == "auto")    backend = BACKEND_AUTO;
+      else if (str == "iouring") backend = BACKEND_IOURING;
+      else if (str == "threads") backend = BACKEND_THREADS;
+      else BBCERROR("Unknown asynchronous file backend '%s'", str.c_str());
+    }
+
+#ifdef ENABLE_IO_URING
+    if (backend != BACKEND_THREADS)
+    {
+      IOUringAsyncFileIO *service = new IOUringAsyncFileIO(256);
+
+      if (service->IsValid()) instance = service;
+      else
+      {
+        if (backend == BACKEND_IOURING) BBCERROR("io_uring not available, using threads for asynchronous file writing");
+        delete service;
+      }
+    }
+#endif
+    if (!instance) instance = new ThreadAsyncFileIO(GetThreadCount());
+
+    instance->StartService();
+  }
+
+  return *instance;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Select backend
+ *
+ * @return true if backend has been selected, false if clients are still registered
+ *
+ * @note the backend is actually created on the next call to Get()
+ */
+/*--------------------------------------------------------------------------------*/
+bool AsyncFileIO::SetBackend(BACKEND backend)
+{
+  ThreadLock lock(GetInstanceLock());
+  bool success = false;
+
+  if (instance)
+  {
+    bool unused;
+
+    // the service can only be replaced when it is not being used
+    {
+      ThreadLock lock2(instance->clientlock);
+      unused = instance->clients.empty();
+    }
+
+    if (unused)
+    {
+      delete instance;
+      instance = NULL;
+    }
+  }
+
+  if (!instance)
+  {
+    AsyncFileIO::backend = backend;
+    backendselected      = true;
+    success = true;
+  }
+  else BBCERROR("Cannot change asynchronous file backend whilst files are using it");
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether the io_uring backend is available
+ */
+/*--------------------------------------------------------------------------------*/
+bool AsyncFileIO::IsIOUringAvailable()
+{
+#ifdef ENABLE_IO_URING
+  static int available = -1;
+  ThreadLock lock(GetInstanceLock());
+
+  if (available < 0)
+  {
+    IOUringAsyncFileIO service(4);
+    available = service.IsValid() ? 1 : 0;
+  }
+
+  return (available != 0);
+#else
+  return false;
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether the service is supported on this platform at all
+ */
+/*--------------------------------------------------------------------------------*/
+bool AsyncFileIO::IsAvailable()
+{
+#ifdef TARGET_OS_UNIXBSD
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return number of worker threads to use for BACKEND_THREADS
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t AsyncFileIO::GetThreadCount()
+{
+  uint_t n = DefaultThreads;
+  SystemParameters::Get().Get("asyncfilethreads", n);
+  return std::max(n, 1U);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Register/unregister a client for servicing
+ */
+/*--------------------------------------------------------------------------------*/
+void AsyncFileIO::Register(Client *client)
+{
+  {
+    ThreadLock lock(clientlock);
+    clients.push_back(client);
+  }
+
+  // the new client may need servicing sooner than the others
+  servicenow.store(true);
+  Wake();
+}
+
+void AsyncFileIO::Unregister(Client *client)
+{
+  // taking the lock also waits for any call to the client to finish
+  ThreadLock lock(clientlock);
+  clients.remove(client);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start/stop service thread
+ */
+/*--------------------------------------------------------------------------------*/
+bool AsyncFileIO::StartService()
+{
+  bool success = thread.Start(&__ServiceStart, (void *)this);
+  if (!success) BBCERROR("Failed to start asynchronous file service thread");
+  return success;
+}
+
+void AsyncFileIO::StopService()
+{
+  if (thread.IsRunning())
+  {
+    thread.Stop(false);
+    Wake();
+    thread.Stop();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Pass result of request back to its client
+ */
+/*--------------------------------------------------------------------------------*/
+void AsyncFileIO::Complete(REQUEST *req, sint64_t result)
+{
+  ThreadLock lock(clientlock);
+  req->client->WriteComplete(req, result);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Remove and return the request to service next from a list of waiting requests
+ *
+ * @note requests are taken from the client with the most data queued, in the order
+ * they were submitted
+ */
+/*--------------------------------------------------------------------------------*/
+AsyncFileIO::REQUEST *AsyncFileIO::TakeNextRequest(std::deque<REQUEST *>& requests)
+{
+  std::deque<REQUEST *>::iterator it, next = requests.end();
+  uint64_t maxbytes = 0;
+  REQUEST  *req = NULL;
+
+  for (it = requests.begin(); it != requests.end(); ++it)
+  {
+    uint64_t bytes = (*it)->client->GetQueuedBytes();
+
+    // strictly greater so that the earliest request wins ties
+    if ((next == requests.end()) || (bytes > maxbytes))
+    {
+      next     = it;
+      maxbytes = bytes;
+    }
+  }
+
+  if (next != requests.end())
+  {
+    req = *next;
+    requests.erase(next);
+  }
+
+  return req;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Perform a blocking positioned write
+ *
+ * @return number of bytes written or -errno
+ */
+/*--------------------------------------------------------------------------------*/
+sint64_t AsyncFileIO::WriteNow(const REQUEST *req)
+{
+#ifdef TARGET_OS_UNIXBSD
+  sint64_t total = 0;
+  off_t    offset = req->offset;
+  uint_t   i;
+
+  for (i = 0; i < req->n; i++)
+  {
+    const uint8_t *p    = (const uint8_t *)req->iov[i].data;
+    size_t        bytes = req->iov[i].size;
+
+    while (bytes)
+    {
+      ssize_t res;
+
+      if ((res = pwrite(req->fd, p, bytes, offset)) < 0)
+      {
+        if (errno == EINTR) continue;
+        return total ? total : -(sint64_t)errno;
+      }
+      if (!res) return total;
+
+      p      += res;
+      bytes  -= res;
+      offset += res;
+      total  += res;
+    }
+  }
+
+  return total;
+#else
+  UNUSED_PARAMETER(req);
+  return -(sint64_t)ENOSYS;
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Build a request for the part of a partially performed write that has not been written
+ *
+ * @param req request
+ * @param written number of bytes of the request already written
+ * @param remainder request to fill in
+ *
+ * @return true if any of the request remains to be written
+ */
+/*--------------------------------------------------------------------------------*/
+bool AsyncFileIO::GetRemainder(const REQUEST *req, uint64_t written, REQUEST& remainder)
+{
+  uint64_t skip = written;
+  uint_t   i;
+
+  remainder.client = req->client;
+  remainder.fd     = req->fd;
+  remainder.offset = req->offset + (off_t)written;
+  remainder.n      = 0;
+  for (i = 0; i < req->n; i++)
+  {
+    if (skip >= req->iov[i].size) skip -= req->iov[i].size;
+    else
+    {
+      remainder.iov[remainder.n].data = (void *)((const uint8_t *)req->iov[i].data + skip);
+      remainder.iov[remainder.n].size = req->iov[i].size - (size_t)skip;
+      remainder.n++;
+      skip = 0;
+    }
+  }
+
+  return (remainder.n > 0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Service all clients
+ *
+ * @return time in ms until clients need servicing again
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t AsyncFileIO::ServiceClients()
+{
+  // time to wait when no client needs servicing
+  static const uint_t idletimeout = 1000;
+  ThreadLock lock(clientlock);
+  std::list<Client *>::iterator it;
+  uint_t timeout = idletimeout;
+
+  for (it = clients.begin(); it != clients.end(); ++it)
+  {
+    uint_t t;
+    if ((t = (*it)->Service()) > 0) timeout = std::min(timeout, t);
+  }
+
+  return timeout;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Service thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *AsyncFileIO::Run()
+{
+  ulong_t next    = GetTickCount();
+  uint_t  timeout = 0;
+
+  while (!thread.StopRequested())
+  {
+    ulong_t now;
+
+    ProcessCompletions(timeout);
+
+    // service clients when required (not every time completions are reaped)
+    now = GetTickCount();
+    if (servicenow.exchange(false) || ((sint64_t)(now - next) >= 0))
+    {
+      timeout = ServiceClients();
+      next    = now + timeout;
+    }
+    else timeout = (uint_t)(next - now);
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Thread pool backend
+ */
+/*--------------------------------------------------------------------------------*/
+ThreadAsyncFileIO::ThreadAsyncFileIO(uint_t nthreads) : AsyncFileIO(),
+                                                        work(false),
+                                                        wake(false)
+{
+  uint_t i;
+
+  for (i = 0; i < std::max(nthreads, 1U); i++)
+  {
+    Thread *thread = new Thread();
+
+    if (thread->Start(&__WorkerStart, (void *)this)) workers.push_back(thread);
+    else
+    {
+      BBCERROR("Failed to start asynchronous file worker thread");
+      delete thread;
+    }
+  }
+
+  BBCDEBUG2(("Started %s threads for asynchronous file writing", StringFrom(workers.size()).c_str()));
+}
+
+ThreadAsyncFileIO::~ThreadAsyncFileIO()
+{
+  uint_t i;
+
+  StopService();
+
+  for (i = 0; i < workers.size(); i++) workers[i]->Stop(false);
+  for (i = 0; i < workers.size(); i++)
+  {
+    work.Broadcast();
+    workers[i]->Stop();
+    delete workers[i];
+  }
+}
+
+bool ThreadAsyncFileIO::Write(REQUEST *req)
+{
+  // without workers the write has to be done now
+  if (workers.empty()) Complete(req, WriteNow(req));
+  else
+  {
+    {
+      ThreadLock lock(requestlock);
+      requests.push_back(req);
+    }
+    work.Signal();
+  }
+
+  return true;
+}
+
+void *ThreadAsyncFileIO::Worker(Thread& thread)
+{
+  while (!thread.StopRequested())
+  {
+    REQUEST *req = NULL;
+    bool    more = false;
+
+    {
+      ThreadLock lock(requestlock);
+      if ((req = TakeNextRequest(requests)) != NULL) more = !requests.empty();
+    }
+
+    if (req)
+    {
+      // pass on any remaining work to another worker
+      if (more) work.Signal();
+
+      Complete(req, WriteNow(req));
+    }
+    else work.TimedWait(100);
+  }
+
+  return NULL;
+}
+
+#ifdef ENABLE_IO_URING
+// requests are passed to the kernel as an array of struct iovec
+static_assert((sizeof(EnhancedFile::IOVEC) == sizeof(struct iovec)) &&
+              (offsetof(EnhancedFile::IOVEC, data) == offsetof(struct iovec, iov_base)) &&
+              (offsetof(EnhancedFile::IOVEC, size) == offsetof(struct iovec, iov_len)), "IOVEC must match struct iovec");
+
+/*--------------------------------------------------------------------------------*/
+/** io_uring backend
+ */
+/*--------------------------------------------------------------------------------*/
+IOUringAsyncFileIO::IOUringAsyncFileIO(uint_t entries) : AsyncFileIO(),
+                                                         ringfd(-1),
+                                                         eventfd(-1),
+                                                         sqring(NULL),
+                                                         sqringsize(0),
+                                                         cqring(NULL),
+                                                         cqringsize(0),
+                                                         sqes(NULL),
+                                                         sqessize(0),
+                                                         outstanding(0)
+{
+  struct io_uring_params params;
+  bool success = false;
+
+  memset(&params, 0, sizeof(params));
+
+  if ((ringfd = (int)syscall(__NR_io_uring_setup, entries, &params)) >= 0)
+  {
+    void *p;
+
+    sqringsize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqringsize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqessize   = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // newer kernels map both rings with a single mmap()
+    if (params.features & IORING_FEAT_SINGLE_MMAP) sqringsize = cqringsize = std::max(sqringsize, cqringsize);
+
+    if ((p = mmap(NULL, sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING)) != MAP_FAILED)
+    {
+      sqring = (uint8_t *)p;
+
+      if (params.features & IORING_FEAT_SINGLE_MMAP) cqring = sqring;
+      else if ((p = mmap(NULL, cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING)) != MAP_FAILED) cqring = (uint8_t *)p;
+
+      if (cqring && ((p = mmap(NULL, sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES)) != MAP_FAILED))
+      {
+        sqes      = (struct io_uring_sqe *)p;
+        sqhead    = (uint32_t *)(sqring + params.sq_off.head);
+        sqtail    = (uint32_t *)(sqring + params.sq_off.tail);
+        sqmask    = (uint32_t *)(sqring + params.sq_off.ring_mask);
+        sqarray   = (uint32_t *)(sqring + params.sq_off.array);
+        sqentries = params.sq_entries;
+        cqhead    = (uint32_t *)(cqring + params.cq_off.head);
+        cqtail    = (uint32_t *)(cqring + params.cq_off.tail);
+        cqmask    = (uint32_t *)(cqring + params.cq_off.ring_mask);
+        cqes      = (struct io_uring_cqe *)(cqring + params.cq_off.cqes);
+        cqentries = params.cq_entries;
+
+        // completions are signalled through an eventfd so that the service thread can also be woken by Wake()
+        if ((eventfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0)
+        {
+          if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_EVENTFD, &eventfd, 1) == 0)
+          {
+            BBCDEBUG2(("Created io_uring with %u entries for asynchronous file writing", sqentries));
+            success = true;
+          }
+          else BBCDEBUG1(("Failed to register eventfd with io_uring (%s)", strerror(errno)));
+        }
+        else BBCDEBUG1(("Failed to create eventfd (%s)", strerror(errno)));
+      }
+      else BBCDEBUG1(("Failed to map io_uring (%s)", strerror(errno)));
+    }
+    else BBCDEBUG1(("Failed to map io_uring (%s)", strerror(errno)));
+  }
+  else BBCDEBUG1(("io_uring not available (%s)", strerror(errno)));
+
+  if (!success) Close();
+}
+
+IOUringAsyncFileIO::~IOUringAsyncFileIO()
+{
+  std::map<REQUEST *, PARTIAL *>::iterator it;
+
+  StopService();
+  Close();
+
+  for (it = partials.begin(); it != partials.end(); ++it) delete it->second;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Unmap rings and close descriptors
+ */
+/*--------------------------------------------------------------------------------*/
+void IOUringAsyncFileIO::Close()
+{
+  if (sqes) munmap(sqes, sqessize);
+  if (cqring && (cqring != sqring)) munmap(cqring, cqringsize);
+  if (sqring) munmap(sqring, sqringsize);
+  if (eventfd >= 0) close(eventfd);
+  if (ringfd >= 0) close(ringfd);
+  sqes    = NULL;
+  cqring  = sqring = NULL;
+  eventfd = ringfd = -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add request to submission ring
+ *
+ * @return false if the ring is full or too many requests are outstanding
+ *
+ * @note sqlock MUST be held
+ */
+/*--------------------------------------------------------------------------------*/
+bool IOUringAsyncFileIO::Queue(REQUEST *req)
+{
+  uint32_t tail = *sqtail;
+
+  // the completion ring must never overflow
+  if ((outstanding >= cqentries) || ((tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE)) >= sqentries)) return false;
+
+  uint32_t            index = tail & *sqmask;
+  struct io_uring_sqe *sqe  = &sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = IORING_OP_WRITEV;
+  sqe->fd        = req->fd;
+  sqe->off       = (uint64_t)req->offset;
+  sqe->addr      = (uint64_t)(uintptr_t)req->iov;
+  sqe->len       = req->n;
+  sqe->user_data = (uint64_t)(uintptr_t)req;
+
+  sqarray[index] = index;
+  // make the entry visible to the kernel
+  __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+  outstanding++;
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Submit everything in the submission ring to the kernel
+ *
+ * @note sqlock MUST be held
+ */
+/*--------------------------------------------------------------------------------*/
+uint32_t IOUringAsyncFileIO::Submit()
+{
+  uint32_t n;
+
+  // entries left in the ring (e.g. on EAGAIN) are retried by ProcessCompletions()
+  if (((n = GetUnsubmittedCount()) > 0) &&
+      (syscall(__NR_io_uring_enter, ringfd, n, 0, 0, NULL, 0) < 0) &&
+      (errno != EAGAIN) && (errno != EBUSY) && (errno != EINTR))
+  {
+    BBCERROR("Failed to submit %u io_uring requests (%s)", n, strerror(errno));
+  }
+
+  return GetUnsubmittedCount();
+}
+
+bool IOUringAsyncFileIO::Write(REQUEST *req)
+{
+  ThreadLock lock(sqlock);
+
+  // requests are queued in order so only add to the ring if nothing is waiting already
+  if (!pending.empty() || !Queue(req)) pending.push_back(req);
+  else Submit();
+
+  return true;
+}
+
+void IOUringAsyncFileIO::Wake()
+{
+  uint64_t val = 1;
+  if (::write(eventfd, &val, sizeof(val)) < 0) BBCERROR("Failed to wake asynchronous file service (%s)", strerror(errno));
+}
+
+void IOUringAsyncFileIO::ProcessCompletions(uint_t timeout)
+{
+  std::vector<std::pair<REQUEST *, sint64_t> > completed;
+  uint32_t head = *cqhead, tail;
+  bool     unsubmitted;
+
+  {
+    ThreadLock lock(sqlock);
+    // entries the kernel refused (e.g. EAGAIN) will not generate completions or be
+    // submitted by Write() so they must be retried here
+    unsubmitted = (GetUnsubmittedCount() > 0);
+  }
+
+  // only wait if there is nothing to reap
+  if (head == __atomic_load_n(cqtail, __ATOMIC_ACQUIRE))
+  {
+    struct pollfd pfd;
+
+    pfd.fd      = eventfd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    poll(&pfd, 1, unsubmitted ? std::min((int)timeout, (int)SubmitRetryInterval) : (int)timeout);
+  }
+
+  // reset eventfd before reaping so that later completions will wake the thread
+  uint64_t val;
+  if (::read(eventfd, &val, sizeof(val)) < 0)
+  {
+    // nothing to reset
+  }
+
+  // reap all available completions in one batch
+  tail = __atomic_load_n(cqtail, __ATOMIC_ACQUIRE);
+  completed.reserve(tail - head);
+  for (; head != tail; head++)
+  {
+    const struct io_uring_cqe& cqe = cqes[head & *cqmask];
+    completed.push_back(std::make_pair((REQUEST *)(uintptr_t)cqe.user_data, (sint64_t)cqe.res));
+  }
+  __atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+
+  if (!completed.empty() || unsubmitted)
+  {
+    ThreadLock lock(sqlock);
+
+    outstanding -= (uint_t)completed.size();
+
+    // move requests waiting for space into the ring
+    while (!pending.empty())
+    {
+      REQUEST *req = TakeNextRequest(pending);
+
+      if (!Queue(req))
+      {
+        pending.push_front(req);
+        break;
+      }
+    }
+    Submit();
+  }
+
+  std::vector<std::pair<REQUEST *, sint64_t> >::iterator it;
+  for (it = completed.begin(); it != completed.end(); ++it) ProcessCompletion(it->first, it->second);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Handle completion of a request, resubmitting the rest of a short write
+ *
+ * @note only called by the service thread
+ */
+/*--------------------------------------------------------------------------------*/
+void IOUringAsyncFileIO::ProcessCompletion(REQUEST *req, sint64_t result)
+{
+  std::map<REQUEST *, PARTIAL *>::iterator it;
+  PARTIAL *partial = NULL;
+
+  // completion of the remainder of a short write
+  if (!partials.empty() && ((it = partials.find(req)) != partials.end()))
+  {
+    partial = it->second;
+    partials.erase(it);
+
+    req = partial->req;
+
+    // an error after some data has been written is reported as a short write (like WriteNow())
+    if (result >= 0) result += (sint64_t)partial->written;
+    else             result  = (sint64_t)partial->written;
+  }
+
+  // the kernel may write less than requested (like pwritev()) so write the rest without
+  // blocking this thread, unless no progress has been made
+  if ((result > 0) && (!partial || (result > (sint64_t)partial->written)))
+  {
+    if (!partial) partial = new PARTIAL;
+
+    if (GetRemainder(req, (uint64_t)result, partial->remainder))
+    {
+      BBCDEBUG2(("Resubmitting remainder of short write (%s bytes written) at %s", StringFrom(result).c_str(), StringFrom((uint64_t)partial->remainder.offset).c_str()));
+
+      partial->req     = req;
+      partial->written = (uint64_t)result;
+      partials[&partial->remainder] = partial;
+      Write(&partial->remainder);
+      return;
+    }
+  }
+
+  delete partial;
+  Complete(req, result);
+}
+#endif
+
+BBC_AUDIOTOOLBOX_END
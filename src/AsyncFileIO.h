@@ -0,0 +1,278 @@
+#ifndef __ASYNC_FILE_IO__
+#define __ASYNC_FILE_IO__
+
+#include <list>
+#include <deque>
+
+#include "EnhancedFile.h"
+#include "Thread.h"
+#include "ThreadLock.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Shared asynchronous file writing service
+ *
+ * A single service performs positioned writes for any number of open files without
+ * needing a thread per file.  Each write is described by a REQUEST which is passed back
+ * to the Client that submitted it once the write has completed
+ *
+ * Backends:
+ *  BACKEND_IOURING: Linux io_uring - one submission ring shared by all files with
+ *                   completions reaped in batches by a single service thread (only
+ *                   available when built with ENABLE_IO_URING and supported by the kernel)
+ *  BACKEND_THREADS: a small pool of worker threads performing blocking positioned writes
+ *  BACKEND_AUTO:    io_uring if available, otherwise threads
+ *
+ * The backend can be selected at runtime using SetBackend() whilst no clients are registered
+ * or by the following SystemParameters (read when the service is created):
+ *  asyncfilebackend: 'auto', 'iouring' or 'threads'
+ *  asyncfilethreads: number of worker threads for BACKEND_THREADS
+ *
+ * When there are more requests than the service can handle at once, the request from the
+ * client with the most data queued (see Client::GetQueuedBytes()) is serviced first so
+ * that a busy file cannot starve the others
+ *
+ * Notes:
+ *  1. a REQUEST (and the buffers it refers to) MUST remain valid until its completion has
+ *     been called
+ *  2. requests are NOT ordered: a client which needs ordering (e.g. for overlapping writes)
+ *     must wait for a completion before submitting the next request
+ *  3. completions and Client::Service() are called from the service threads with the
+ *     client list locked so they must be quick and MUST NOT block
+ *  4. positioned writes bypass stdio and, for files opened for append, are not positioned
+ *     so this is not suitable for files opened for append
+ */
+/*--------------------------------------------------------------------------------*/
+class AsyncFileIO
+{
+public:
+  class Client;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Maximum number of buffers per request
+   */
+  /*--------------------------------------------------------------------------------*/
+  enum {MaxBuffers = 16};
+
+  /*--------------------------------------------------------------------------------*/
+  /** A single positioned (gathering) write
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    Client              *client;          ///< client to call on completion
+    int                 fd;               ///< file descriptor to write to
+    off_t               offset;           ///< file offset to write at
+    EnhancedFile::IOVEC iov[MaxBuffers];  ///< buffers to write
+    uint_t              n;                ///< number of buffers in iov
+  } REQUEST;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Interface for users of the service
+   */
+  /*--------------------------------------------------------------------------------*/
+  class Client
+  {
+  public:
+    virtual ~Client() {}
+
+    /*--------------------------------------------------------------------------------*/
+    /** Called when a write has completed
+     *
+     * @param req request that has completed
+     * @param result number of bytes written or -errno on error
+     */
+    /*--------------------------------------------------------------------------------*/
+    virtual void   WriteComplete(REQUEST *req, sint64_t result) = 0;
+
+    /*--------------------------------------------------------------------------------*/
+    /** Called periodically by the service thread for housekeeping (e.g. latency handling)
+     *
+     * @return time in ms until the client next needs servicing (0 if it doesn't)
+     */
+    /*--------------------------------------------------------------------------------*/
+    virtual uint_t Service() {return 0;}
+
+    /*--------------------------------------------------------------------------------*/
+    /** Return number of bytes the client has waiting to be written
+     *
+     * @note called from the service threads whilst the client has a request outstanding
+     */
+    /*--------------------------------------------------------------------------------*/
+    virtual uint64_t GetQueuedBytes() const {return 0;}
+  };
+
+  typedef enum
+  {
+    BACKEND_AUTO = 0,
+    BACKEND_IOURING,
+    BACKEND_THREADS,
+  } BACKEND;
+
+  virtual ~AsyncFileIO();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return the shared service, creating it if necessary
+   */
+  /*--------------------------------------------------------------------------------*/
+  static AsyncFileIO& Get();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Select backend
+   *
+   * @return true if backend has been selected, false if clients are still registered
+   *
+   * @note the backend is actually created on the next call to Get()
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool SetBackend(BACKEND backend);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the io_uring backend is available
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool IsIOUringAvailable();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the service is supported on this platform at all
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool IsAvailable();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return backend in use (never BACKEND_AUTO)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual BACKEND GetType() const = 0;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of worker threads to use for BACKEND_THREADS
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint_t GetThreadCount();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Register/unregister a client for servicing
+   *
+   * @note Register() causes all clients to be serviced straight away
+   *
+   * @note a client MUST NOT be unregistered whilst any of its requests are outstanding,
+   * once Unregister() returns, no more calls will be made to the client
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Register(Client *client);
+  void Unregister(Client *client);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Submit a write
+   *
+   * @return true if request submitted (the completion will be called)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool Write(REQUEST *req) = 0;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wake service thread (to service clients early)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void Wake() = 0;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Perform a blocking positioned write (without using the service)
+   *
+   * @return number of bytes written or -errno
+   */
+  /*--------------------------------------------------------------------------------*/
+  static sint64_t WriteNow(const REQUEST *req);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Build a request for the part of a partially performed write that has not been written
+   *
+   * @param req request
+   * @param written number of bytes of the request already written
+   * @param remainder request to fill in
+   *
+   * @return true if any of the request remains to be written
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool GetRemainder(const REQUEST *req, uint64_t written, REQUEST& remainder);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Default number of worker threads for BACKEND_THREADS
+   */
+  /*--------------------------------------------------------------------------------*/
+  static const uint_t DefaultThreads;
+
+protected:
+  AsyncFileIO();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start/stop service thread
+   *
+   * @note derived classes MUST call StopService() in their destructors
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool StartService();
+  void StopService();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait (up to timeout ms) for and process any completions
+   *
+   * @note must return early if Wake() is called
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void ProcessCompletions(uint_t timeout) = 0;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Pass result of request back to its client
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Complete(REQUEST *req, sint64_t result);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Remove and return the request to service next from a list of waiting requests
+   *
+   * @note requests are taken from the client with the most data queued, in the order
+   * they were submitted
+   */
+  /*--------------------------------------------------------------------------------*/
+  static REQUEST *TakeNextRequest(std::deque<REQUEST *>& requests);
+
+
+  /*--------------------------------------------------------------------------------*/
+  /** Service all clients
+   *
+   * @return time in ms until clients need servicing again
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ServiceClients();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Service thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__ServiceStart(Thread& thread, void *arg)
+  {
+    UNUSED_PARAMETER(thread);
+    AsyncFileIO& service = *(AsyncFileIO *)arg;
+    return service.Run();
+  }
+  void *Run();
+
+  static ThreadLockObject& GetInstanceLock();
+
+protected:
+  Thread             thread;
+  ThreadLockObject   clientlock;    ///< protects clients and is held whilst calling clients
+  std::list<Client*> clients;
+  std::atomic<bool>  servicenow;    ///< true to service clients without waiting for the timeout
+
+  static AsyncFileIO *instance;
+  static BACKEND     backend;
+  static bool        backendselected;  ///< true if SetBackend() has been called
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
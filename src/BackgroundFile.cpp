@@ -7,111 +7,1153 @@
 #include "OSCompiler.h"
 
 #ifdef TARGET_OS_UNIXBSD
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
-#ifdef TARGET_OS_WINDOWS
-#include "Windows_uSleep.h"
+#define BBCDEBUG_LEVEL 2
+#include "BackgroundFile.h"
+
+BBC_AUDIOTOOLBOX_START
+
+const size_t BackgroundFile::DefaultBlockSize = 65536;
+const uint_t BackgroundFile::DefaultBlocks    = 16;
+const uint_t BackgroundFile::DefaultMaxBlocks = 1024;
+const uint_t BackgroundFile::DefaultMaxWriteLatency = 100;
+const uint_t BackgroundFile::MaxBlocksPerWrite = 16;
+const size_t BackgroundFile::DirectIOAlignment = 4096;
+const uint_t BackgroundFile::DefaultReadAheadBlocks = 8;
+const off_t  BackgroundFile::DefaultPreallocationExtent = 64 << 20;
+
+/*--------------------------------------------------------------------------------*/
+/** Raise atomic maximum to value (safe against concurrent updates)
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename T>
+static void UpdateMaximum(std::atomic<T>& maximum, T value)
+{
+  T current = maximum.load();
+  while ((value > current) && !maximum.compare_exchange_weak(current, value)) ;
+}
+
+BackgroundFile::BackgroundFile() : EnhancedFile(),
+                                   enablebackground(false),
+                                   blocksize(DefaultBlockSize),
+                                   alignment(1),
+                                   nblocks(DefaultBlocks),
+                                   maxblocks(DefaultMaxBlocks),
+                                   poolpolicy(POOL_GROW),
+                                   maxlatency(DefaultMaxWriteLatency),
+                                   current(NULL),
+                                   tracking(false),
+                                   position(0),
+                                   diskposition(0),
+                                   queue(0, true),
+                                   freeblocks(0, true),
+                                   enableasync(true),
+                                   asyncio(NULL),
+                                   asyncbusy(false),
+                                   writecomplete(false),
+                                   queuedbytes(0),
+                                   enabledirect(false),
+                                   directfd(-1),
+                                   preallocsize(0),
+                                   preallocextent(0),
+                                   preallocating(false),
+                                   enablereadahead(false),
+                                   reading(false),
+                                   readblocksize(DefaultBlockSize),
+                                   readnblocks(DefaultReadAheadBlocks),
+                                   readqueue(0, true),
+                                   readfree(0, true),
+                                   readcurrent(NULL),
+                                   readoffset(0),
+                                   readposition(0),
+                                   asyncsubmittime(0),
+                                   highwater(0),
+                                   highwaterhandler(NULL),
+                                   highwatercontext(NULL),
+                                   abovehighwater(false),
+                                   highwaterrises(0),
+                                   highwaterfalls(0),
+                                   notifiedrises(0),
+                                   notifiedfalls(0)
+{
+  ResetReadAheadStats();
+  ResetWriteStats();
+}
+
+BackgroundFile::BackgroundFile(const char *filename, const char *mode) : EnhancedFile(),
+                                                                         enablebackground(false),
+                                                                         blocksize(DefaultBlockSize),
+                                                                         alignment(1),
+                                                                         nblocks(DefaultBlocks),
+                                                                         maxblocks(DefaultMaxBlocks),
+                                                                         poolpolicy(POOL_GROW),
+                                                                         maxlatency(DefaultMaxWriteLatency),
+                                                                         current(NULL),
+                                                                         tracking(false),
+                                                                         position(0),
+                                                                         diskposition(0),
+                                                                         queue(0, true),
+                                                                         freeblocks(0, true),
+                                                                         enableasync(true),
+                                                                         asyncio(NULL),
+                                                                         asyncbusy(false),
+                                                                         writecomplete(false),
+                                                                         queuedbytes(0),
+                                                                         enabledirect(false),
+                                                                         directfd(-1),
+                                                                         preallocsize(0),
+                                                                         preallocextent(0),
+                                                                         preallocating(false),
+                                                                         enablereadahead(false),
+                                                                         reading(false),
+                                                                         readblocksize(DefaultBlockSize),
+                                                                         readnblocks(DefaultReadAheadBlocks),
+                                                                         readqueue(0, true),
+                                                                         readfree(0, true),
+                                                                         readcurrent(NULL),
+                                                                         readoffset(0),
+                                                                         readposition(0),
+                                                                         asyncsubmittime(0),
+                                                                         highwater(0),
+                                                                         highwaterhandler(NULL),
+                                                                         highwatercontext(NULL),
+                                                                         abovehighwater(false),
+                                                                         highwaterrises(0),
+                                                                         highwaterfalls(0),
+                                                                         notifiedrises(0),
+                                                                         notifiedfalls(0)
+{
+  ResetReadAheadStats();
+  ResetWriteStats();
+  fopen(filename, mode);
+}
+
+BackgroundFile::BackgroundFile(const BackgroundFile& obj) : EnhancedFile(),
+                                                            enablebackground(false),
+                                                            blocksize(DefaultBlockSize),
+                                                            alignment(1),
+                                                            nblocks(DefaultBlocks),
+                                                            maxblocks(DefaultMaxBlocks),
+                                                            poolpolicy(POOL_GROW),
+                                                            maxlatency(DefaultMaxWriteLatency),
+                                                            current(NULL),
+                                                            tracking(false),
+                                                            position(0),
+                                                            diskposition(0),
+                                                            queue(0, true),
+                                                            freeblocks(0, true),
+                                                            enableasync(true),
+                                                            asyncio(NULL),
+                                                            asyncbusy(false),
+                                                            writecomplete(false),
+                                                            queuedbytes(0),
+                                                            enabledirect(false),
+                                                            directfd(-1),
+                                                            preallocsize(0),
+                                                            preallocextent(0),
+                                                            preallocating(false),
+                                                            enablereadahead(false),
+                                                            reading(false),
+                                                            readblocksize(DefaultBlockSize),
+                                                            readnblocks(DefaultReadAheadBlocks),
+                                                            readqueue(0, true),
+                                                            readfree(0, true),
+                                                            readcurrent(NULL),
+                                                            readoffset(0),
+                                                            readposition(0),
+                                                            asyncsubmittime(0),
+                                                            highwater(0),
+                                                            highwaterhandler(NULL),
+                                                            highwatercontext(NULL),
+                                                            abovehighwater(false),
+                                                            highwaterrises(0),
+                                                            highwaterfalls(0),
+                                                            notifiedrises(0),
+                                                            notifiedfalls(0)
+{
+  ResetReadAheadStats();
+  ResetWriteStats();
+  operator = (obj);
+}
+
+BackgroundFile::~BackgroundFile()
+{
+  fclose();
+  FreePool();
+  FreeReadAheadBlocks();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Duplicate file by assignment
+ *
+ * @note this will open the same file again (background writing state is NOT copied)
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundFile& BackgroundFile::operator = (const BackgroundFile& obj)
+{
+  if (&obj != this)
+  {
+    // make sure this object's queued blocks are written before the file is closed
+    StopReadAhead();
+    FlushToDisk();
+
+    // copy pool configuration (but not the pool itself)
+    SetBlockPool(obj.blocksize, obj.nblocks, obj.poolpolicy, obj.maxblocks);
+    maxlatency   = obj.maxlatency;
+    enableasync  = obj.enableasync;
+    enabledirect = obj.enabledirect;
+    SetPreallocation(obj.preallocsize, obj.preallocextent);
+    SetReadAhead(obj.readnblocks, obj.readblocksize);
+    enablereadahead = obj.enablereadahead;
+
+    EnhancedFile::operator = (obj);
+  }
+
+  return *this;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable background writing behaviour
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::EnableBackground(bool enable)
+{
+  enablebackground = enable;
+
+  // if background writing becomes disabled, flush buffers to disk and kill thread
+  if (!enablebackground) FlushToDisk();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Use the shared asynchronous file service instead of a thread for this file
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::EnableAsyncIO(bool enable)
+{
+  // switch over with nothing queued
+  FlushToDisk();
+  enableasync = enable;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write aligned blocks using direct I/O (O_DIRECT), bypassing the page cache
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::EnableDirectIO(bool enable)
+{
+  // blocks need to be re-allocated with the correct alignment
+  FlushToDisk();
+  FreePool();
+  enabledirect = enable;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reserve disk space ahead of writing to reduce fragmentation
+ *
+ * @param size number of bytes to reserve when writing starts (e.g. expected length of recording)
+ * @param extent size to grow reservation by when writing approaches the end of it (0 to not grow)
+ *
+ * @note if the file is open, the initial size is reserved immediately
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::SetPreallocation(off_t size, off_t extent)
+{
+  // the reservation may be being extended by the writing thread
+  FlushToDisk();
+
+  preallocsize   = std::max(size, (off_t)0);
+  preallocextent = std::max(extent, (off_t)0);
+
+  if (isopen() && preallocsize) reserve(preallocsize);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable reading ahead of fread() in a background thread
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::EnableReadAhead(bool enable)
+{
+  enablereadahead = enable;
+  if (!enablereadahead) StopReadAhead();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set read ahead depth
+ *
+ * @param nblocks number of blocks to read ahead
+ * @param blocksize size of each block in bytes
+ *
+ * @note this will stop any read ahead in progress
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::SetReadAhead(uint_t nblocks, size_t blocksize)
+{
+  StopReadAhead();
+  FreeReadAheadBlocks();
+
+  readnblocks   = std::max(nblocks, 1U);
+  readblocksize = std::max(blocksize, (size_t)1);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return/reset read ahead statistics
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::ResetReadAheadStats()
+{
+  memset(&readstats, 0, sizeof(readstats));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return background writing statistics
+ *
+ * @note the statistics can be read from any thread
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundFile::WRITE_STATS BackgroundFile::GetWriteStats() const
+{
+  WRITE_STATS stats;
+  uint64_t    elapsed = GetNanosecondTicks() - writestats.start.load();
+
+  stats.queuedbytes     = queuedbytes.load();
+  stats.queuedblocks    = queue.ReadBuffersAvailable();
+  stats.highwaterbytes  = writestats.highwaterbytes.load();
+  stats.highwaterblocks = writestats.highwaterblocks.load();
+  stats.highwaterevents = writestats.highwaterevents.load();
+  stats.byteswritten    = writestats.byteswritten.load();
+  stats.writes          = writestats.writes.load();
+  stats.writetime       = writestats.writetime.load();
+  stats.maxwritetime    = writestats.maxwritetime.load();
+  stats.throughput      = elapsed ? (double)stats.byteswritten * 1.0e9 / (double)elapsed : 0.0;
+  stats.flushes         = writestats.flushes.load();
+  stats.flushtime       = writestats.flushtime.load();
+  stats.maxflushtime    = writestats.maxflushtime.load();
+
+  return stats;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset background writing statistics
+ *
+ * @note the high-water marks restart from what is queued now
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::ResetWriteStats()
+{
+  writestats.highwaterbytes  = queuedbytes.load();
+  writestats.highwaterblocks = queue.ReadBuffersAvailable();
+  writestats.highwaterevents = 0;
+  writestats.byteswritten    = 0;
+  writestats.writes          = 0;
+  writestats.writetime       = 0;
+  writestats.maxwritetime    = 0;
+  writestats.flushes         = 0;
+  writestats.flushtime       = 0;
+  writestats.maxflushtime    = 0;
+  writestats.start           = GetNanosecondTicks();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set high-water callback so that the writer can react before the queue (and memory use) grows too far
+ *
+ * @param threshold number of queued bytes to call the handler at (0 to disable)
+ * @param handler function to call
+ * @param context context pointer for handler
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::SetHighWaterHandler(uint64_t threshold, HIGHWATERHANDLER handler, void *context)
+{
+  // let any pending crossings be reported to the old handler first
+  WaitForWrites();
+
+  ThreadLock lock(currentlock);
+  highwater        = threshold;
+  highwaterhandler = handler;
+  highwatercontext = context;
+  abovehighwater   = false;
+  notifiedrises    = highwaterrises;
+  notifiedfalls    = highwaterfalls;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Configure the block pool
+ *
+ * @param blocksize size of each block in bytes
+ * @param nblocks number of blocks to preallocate
+ * @param policy what to do when all blocks are queued
+ * @param maxblocks maximum number of blocks (for POOL_GROW policy, 0 means nblocks)
+ *
+ * @note this will flush any queued blocks to disk
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::SetBlockPool(size_t blocksize, uint_t nblocks, POOL_POLICY policy, uint_t maxblocks)
+{
+  FlushToDisk();
+  FreePool();
+
+  this->blocksize = std::max(blocksize, (size_t)1);
+  this->nblocks   = std::max(nblocks, 1U);
+  this->maxblocks = std::max(maxblocks, this->nblocks);
+  poolpolicy      = policy;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether it will be 'quick' to close the file now - indicating the close will be quick
+ *
+ * @note this essentially returns whether there is more than one block queued to write
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundFile::ReadyToClose() const
+{
+  ThreadLock lock(currentlock);
+  // return true in the case of none or only one block queued to write (including the partially filled block)
+  return (isopen() && ((queue.ReadBuffersAvailable() + (current && current->size ? 1 : 0)) < 2));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Allocate the block pool (if it hasn't already been)
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundFile::AllocatePool()
+{
+  if (blocks.empty())
+  {
+    uint_t i;
+
+    // direct I/O needs block data and sizes aligned
+    if (enabledirect)
+    {
+      alignment = DirectIOAlignment;
+      blocksize = ((blocksize + alignment - 1) / alignment) * alignment;
+    }
+    else alignment = 1;
+
+    // the rings must be able to hold every block that could ever be allocated
+    queue.Resize(maxblocks);
+    freeblocks.Resize(maxblocks);
+
+    for (i = 0; i < nblocks; i++)
+    {
+      BLOCK *block;
+
+      if ((block = AllocateBlock()) != NULL)
+      {
+        *freeblocks.GetWriteBuffer() = block;
+        freeblocks.IncrementWrite();
+      }
+      else break;
+    }
+
+    BBCDEBUG2(("Allocated %s blocks of %s bytes for background writing", StringFrom(blocks.size()).c_str(), StringFrom(blocksize).c_str()));
+  }
+
+  return !blocks.empty();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Free the block pool
+ *
+ * @note background thread MUST NOT be running
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::FreePool()
+{
+  uint_t i;
+
+  for (i = 0; i < blocks.size(); i++) free(blocks[i]);
+  blocks.clear();
+
+  current = NULL;
+  queue.Reset();
+  freeblocks.Reset();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Allocate a single block
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundFile::BLOCK *BackgroundFile::AllocateBlock()
+{
+  BLOCK *block = NULL;
+
+  if (blocks.size() < maxblocks)
+  {
+    // allocate header and (aligned) data in one allocation
+    if ((block = (BLOCK *)malloc(sizeof(*block) + blocksize + alignment - 1)) != NULL)
+    {
+      uintptr_t data = (uintptr_t)(block + 1);
+
+      block->size = 0;
+      block->data = (uint8_t *)(((data + alignment - 1) / alignment) * alignment);
+      blocks.push_back(block);
+    }
+    else BBCERROR("Failed to allocate block of %s bytes for background writing", StringFrom(blocksize).c_str());
+  }
+
+  return block;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Get an empty block from the pool, using the pool policy if none are free
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundFile::BLOCK *BackgroundFile::GetFreeBlock()
+{
+  BLOCK *block = NULL;
+
+  while (!block)
+  {
+    BLOCK **p;
+
+    if ((p = freeblocks.GetReadBuffer()) != NULL)
+    {
+      block = *p;
+      freeblocks.IncrementRead();
+    }
+    else if ((poolpolicy != POOL_GROW) || ((block = AllocateBlock()) == NULL))
+    {
+      // every block is queued for writing, wait for the background thread to write one
+      // (or, if there is no background thread, write one now)
+      BBCDEBUG3(("Waiting for free block for background writing"));
+      if (asyncio)
+      {
+        SubmitBlocks();
+        freeblocks.WaitForRead(100);
+      }
+      else if (thread.IsRunning()) freeblocks.WaitForRead(100);
+      else                         WriteBlocks();
+    }
+  }
+
+  block->size = 0;
+
+  return block;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Queue the current block for writing (if it contains any data)
+ *
+ * @note currentlock MUST be held
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::CommitBlock()
+{
+  if (current && current->size)
+  {
+    uint64_t queued = (queuedbytes += current->size);
+
+    // queue can hold every block so there will always be space
+    *queue.GetWriteBuffer() = current;
+    queue.IncrementWrite();
+    current = NULL;
+
+    UpdateMaximum(writestats.highwaterbytes, queued);
+    UpdateMaximum(writestats.highwaterblocks, queue.ReadBuffersAvailable());
+
+    if (highwater && (queued >= highwater) && !abovehighwater.exchange(true))
+    {
+      BBCDEBUG2(("Queue for '%s' has risen above high-water (%s bytes queued)", filename.c_str(), StringFrom(queued).c_str()));
+      writestats.highwaterevents++;
+
+      // the handler is called later by the calling thread, see NotifyHighWater()
+      highwaterrises++;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Queue the current block for writing if it is older than the maximum write latency
+ *
+ * @return time in ms until the current block would need to be written
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t BackgroundFile::CommitExpiredBlock()
+{
+  ThreadLock lock(currentlock);
+  uint_t timeout = maxlatency;
+
+  if (current && current->size)
+  {
+    ulong_t age = GetTickCount() - current->time;
+
+    if (age >= maxlatency)
+    {
+      BBCDEBUG3(("Queuing partially filled block of %s bytes after %sms", StringFrom(current->size).c_str(), StringFrom(age).c_str()));
+      CommitBlock();
+    }
+    else timeout = (uint_t)(maxlatency - age);
+  }
+
+  return timeout;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Gather the first queued block and any contiguous blocks following it
+ *
+ * @param iov array to receive buffers
+ * @param n maximum number of blocks
+ * @param offset variable to receive the file offset of the first block
+ * @param direct variable to receive whether the blocks can be written using direct I/O
+ *
+ * @return number of blocks gathered
+ *
+ * @note only the thread that writes blocks may call this
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t BackgroundFile::GatherBlocks(IOVEC *iov, uint_t n, off_t& offset, bool& direct) const
+{
+  size_t bytes = 0;
+  uint_t i;
+
+  offset = (*queue.GetReadBuffer())->offset;
+  direct = IsDirectBlock(*queue.GetReadBuffer());
+  n      = std::min(queue.ReadBuffersAvailable(), n);
+
+  // gather blocks that follow on from each other in the file and can be written the same way
+  for (i = 0; i < n; i++)
+  {
+    const BLOCK *block = *queue.GetReadBuffer(i);
+    if ((block->offset != (offset + (off_t)bytes)) || (IsDirectBlock(block) != direct)) break;
+
+    iov[i].data = block->data;
+    iov[i].size = block->size;
+    bytes += block->size;
+  }
+
+  return i;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether block can be written using direct I/O
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundFile::IsDirectBlock(const BLOCK *block) const
+{
+  return ((directfd >= 0) && !(block->offset % (off_t)DirectIOAlignment) && !(block->size % DirectIOAlignment));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Remove written blocks from the queue and return them to the pool
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::ReleaseBlocks(uint_t n)
+{
+  uint_t i;
+
+  uint64_t queued = 0;
+
+  // remove each block from the queue *before* it can be re-used
+  for (i = 0; i < n; i++)
+  {
+    BLOCK *block = *queue.GetReadBuffer();
+    queued = (queuedbytes -= block->size);
+    queue.IncrementRead();
+
+    *freeblocks.GetWriteBuffer() = block;
+    freeblocks.IncrementWrite();
+  }
+
+  // re-arm the high-water callback once the queue has drained to (at most) half of the threshold
+  if (abovehighwater && (queued <= (highwater / 2)) && abovehighwater.exchange(false))
+  {
+    BBCDEBUG2(("Queue for '%s' has fallen below high-water (%s bytes queued)", filename.c_str(), StringFrom(queued).c_str()));
+    highwaterfalls++;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Call the high-water handler for any crossings of the threshold since the last call
+ *
+ * @note only the calling thread may call this and currentlock MUST NOT be held
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::NotifyHighWater()
+{
+  // crossings always alternate (rise, fall, rise...) so reporting them alternately keeps them in order
+  while (highwaterhandler)
+  {
+    // after a rise has been reported, the next must be a fall
+    bool above = (notifiedfalls == notifiedrises);
+
+    if (above)
+    {
+      if (notifiedrises == highwaterrises) break;
+      notifiedrises++;
+    }
+    else
+    {
+      if (notifiedfalls == highwaterfalls) break;
+      notifiedfalls++;
+    }
+
+    (*highwaterhandler)(*this, above, queuedbytes, highwatercontext);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Update statistics after a write of queued blocks
+ *
+ * @param bytes number of bytes written
+ * @param duration time taken in ns
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::UpdateWriteStats(size_t bytes, uint64_t duration)
+{
+  writestats.byteswritten += bytes;
+  writestats.writes++;
+  writestats.writetime    += duration;
+  UpdateMaximum(writestats.maxwritetime, duration);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write the first queued block (and any contiguous blocks following it) to disk and return them to the pool
+ *
+ * @note contiguous blocks are written using a single writev()
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::WriteBlocks()
+{
+  IOVEC  iov[MaxBlocksPerWrite];
+  off_t  offset;
+  size_t bytes = 0;
+  bool   direct;
+  uint_t i, n = GatherBlocks(iov, MaxBlocksPerWrite, offset, direct);
+
+  for (i = 0; i < n; i++) bytes += iov[i].size;
+
+  if (direct)
+  {
+    AsyncFileIO::REQUEST req;
+
+    ExtendReservation(offset + bytes);
+    sint64_t res;
+
+    // direct writes are positioned and do not affect the stdio position
+    req.client = NULL;
+    req.fd     = directfd;
+    req.offset = offset;
+    req.n      = n;
+    memcpy(req.iov, iov, n * sizeof(*iov));
+
+    uint64_t start = GetNanosecondTicks();
+    if ((res = AsyncFileIO::WriteNow(&req)) < (sint64_t)bytes) BBCERROR("Failed to write %s bytes to file using direct I/O: %s", StringFrom(bytes).c_str(), (res < 0) ? strerror((int)-res) : "short write");
+    UpdateWriteStats(bytes, GetNanosecondTicks() - start);
+
+    ReleaseBlocks(n);
+    writecomplete.Signal();
+    return;
+  }
+
+  ExtendReservation(offset + bytes);
+
+  uint64_t start = GetNanosecondTicks();
+
+  // only seek if the blocks are not contiguous with the previous ones
+  if ((offset != diskposition) && (EnhancedFile::fseek(offset, SEEK_SET) != 0))
+  {
+    BBCERROR("Failed to seek to %s in background: %s", StringFrom(offset).c_str(), strerror(errno));
+  }
+
+  size_t res = EnhancedFile::writev(iov, n);
+  if (res < bytes) BBCERROR("Failed to write %s bytes to file in background: %s", StringFrom(bytes).c_str(), strerror(errno));
+
+  diskposition = offset + res;
+  UpdateWriteStats(bytes, GetNanosecondTicks() - start);
+
+  ReleaseBlocks(n);
+  writecomplete.Signal();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start using the shared asynchronous file service (if enabled and possible)
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::StartAsyncIO()
+{
+  // positioned writes ignore the position in append mode
+  if (enableasync && !asyncio && fp && AsyncFileIO::IsAvailable() && (mode.find('a') == std::string::npos))
+  {
+    // positioned writes bypass stdio so anything it has buffered must be written first
+    EnhancedFile::fflush();
+
+    asyncio = &AsyncFileIO::Get();
+    asyncio->Register(this);
+
+    // the stdio position will not follow the writes so force a seek when flushing
+    diskposition = -1;
+
+    BBCDEBUG2(("Using asynchronous file service for '%s'", filename.c_str()));
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Grow disk space reservation if a write up to end would get too close to the end of it
+ *
+ * @note only the thread that writes blocks (or, with the asynchronous file service, the
+ * thread calling fwrite()) may call this
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::ExtendReservation(off_t end)
+{
+  // grow by a whole extent whilst there is still half an extent left so that the
+  // filesystem can allocate large contiguous regions
+  if (preallocating && preallocextent && ((end + (preallocextent / 2)) > getreserved()))
+  {
+    // at least a whole extent beyond end, rounded up to a multiple of the extent
+    off_t size = ((end + 2 * preallocextent - 1) / preallocextent) * preallocextent;
+
+    // stop trying if reserving is not possible
+    if (!reserve(size)) preallocating = false;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open file for direct I/O (if enabled and possible)
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::StartDirectIO()
+{
+#if defined(TARGET_OS_UNIXBSD) && defined(O_DIRECT)
+  // direct writes are positioned so cannot be used in append mode
+  if (enabledirect && (directfd < 0) && fp && (mode.find('a') == std::string::npos))
+  {
+    // buffered and direct writes must not be reordered
+    EnhancedFile::fflush();
+
+    if ((directfd = open(filename.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC)) >= 0)
+    {
+      BBCDEBUG2(("Using direct I/O for '%s'", filename.c_str()));
+    }
+    else BBCDEBUG1(("Direct I/O not available for '%s' (%s), using buffered writes", filename.c_str(), strerror(errno)));
+  }
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Close direct I/O file descriptor
+ *
+ * @note nothing may be queued
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::StopDirectIO()
+{
+#ifdef TARGET_OS_UNIXBSD
+  if (directfd >= 0)
+  {
+    close(directfd);
+    directfd = -1;
+  }
 #endif
+}
 
-#define BBCDEBUG_LEVEL 2
-#include "BackgroundFile.h"
+/*--------------------------------------------------------------------------------*/
+/** Submit queued blocks to the asynchronous file service if no write is outstanding
+ *
+ * @note can be called from any thread
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::SubmitBlocks()
+{
+  // pairs with the release of asyncbusy in WriteComplete(): either this sees asyncbusy
+  // clear or the completion sees the newly queued blocks
+  std::atomic_thread_fence(std::memory_order_seq_cst);
 
-BBC_AUDIOTOOLBOX_START
+  // only one write is outstanding at a time so that overlapping writes stay in order
+  if (queue.ReadBuffersAvailable() && !asyncbusy.exchange(true))
+  {
+    bool direct;
 
-BackgroundFile::BackgroundFile() : EnhancedFile(),
-                                   enablebackground(false),
-                                   first(NULL),
-                                   last(NULL)
-{
+    asyncrequest.client = this;
+    asyncrequest.n      = GatherBlocks(asyncrequest.iov, std::min(MaxBlocksPerWrite, (uint_t)AsyncFileIO::MaxBuffers), asyncrequest.offset, direct);
+    asyncrequest.fd     = direct ? directfd : fileno(fp);
+
+    asyncsubmittime = GetNanosecondTicks();
+    if (!asyncio->Write(&asyncrequest))
+    {
+      BBCERROR("Failed to submit asynchronous write for '%s'", filename.c_str());
+      asyncbusy.store(false);
+    }
+  }
 }
 
-BackgroundFile::BackgroundFile(const char *filename, const char *mode) : EnhancedFile(),
-                                                                         enablebackground(false),
-                                                                         first(NULL),
-                                                                         last(NULL)
+/*--------------------------------------------------------------------------------*/
+/** Asynchronous write has completed (called by the service)
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::WriteComplete(AsyncFileIO::REQUEST *req, sint64_t result)
 {
-  fopen(filename, mode);
+  size_t bytes = 0;
+  uint_t i;
+
+  for (i = 0; i < req->n; i++) bytes += req->iov[i].size;
+  if (result < (sint64_t)bytes) BBCERROR("Failed to write %s bytes to file asynchronously: %s", StringFrom(bytes).c_str(), (result < 0) ? strerror((int)-result) : "short write");
+  UpdateWriteStats(bytes, GetNanosecondTicks() - asyncsubmittime);
+
+  ReleaseBlocks(req->n);
+
+  asyncbusy.store(false);
+  writecomplete.Signal();
+
+  // write anything queued whilst this write was outstanding
+  SubmitBlocks();
 }
 
-BackgroundFile::BackgroundFile(const BackgroundFile& obj) : EnhancedFile(),
-                                                            enablebackground(false),
-                                                            first(NULL),
-                                                            last(NULL)
+/*--------------------------------------------------------------------------------*/
+/** Periodic servicing by the asynchronous file service (handles write latency)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t BackgroundFile::Service()
 {
-  operator = (obj);
+  uint_t timeout = 0;
+
+  if (maxlatency)
+  {
+    timeout = CommitExpiredBlock();
+    SubmitBlocks();
+  }
+
+  return timeout;
 }
 
-BackgroundFile::~BackgroundFile()
+/*--------------------------------------------------------------------------------*/
+/** Queue any partially filled block and wait until every queued block has been written,
+ * without stopping background writing
+ *
+ * @note the data is passed to the OS but is not necessarily on the disk (see fsync())
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundFile::WaitForWrites()
 {
-  fclose();
+  // queue partially filled block
+  {
+    ThreadLock lock(currentlock);
+    CommitBlock();
+  }
+
+  if (asyncio) SubmitBlocks();
+
+  while (asyncbusy.load() || queue.ReadBuffersAvailable())
+  {
+    if (asyncio)
+    {
+      writecomplete.TimedWait(100);
+      SubmitBlocks();
+    }
+    else if (thread.IsRunning()) writecomplete.TimedWait(100);
+    else                         WriteBlocks();
+  }
+
+  NotifyHighWater();
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Enable background writing behaviour
+/** Flush any queued blocks to disk and shutdown thread
  */
 /*--------------------------------------------------------------------------------*/
-void BackgroundFile::EnableBackground(bool enable)
+void BackgroundFile::FlushToDisk()
 {
-  enablebackground = enable;
+  uint64_t start   = GetNanosecondTicks();
+  bool     flushed = false;
 
-  // if background writing becomes disabled, flush buffers to disk and kill thread
-  if (!enablebackground) FlushToDisk();
+  if (asyncio)
+  {
+    BBCDEBUG2(("Waiting for asynchronous writes to complete"));
+
+    WaitForWrites();
+
+    // this also waits for the last completion to return
+    asyncio->Unregister(this);
+    asyncio = NULL;
+    flushed = true;
+  }
+
+  // queue partially filled block
+  {
+    ThreadLock lock(currentlock);
+    CommitBlock();
+  }
+
+  if (thread.IsRunning() || queue.ReadBuffersAvailable())
+  {
+    BBCDEBUG2(("Flushing queued blocks to disk"));
+
+    // tell thread to quit, wake it up and wait for it to finish
+    thread.Stop(false);
+    queue.InterruptWaitForRead();
+    thread.Stop();
+
+    // write remaining blocks
+    while (queue.ReadBuffersAvailable())
+    {
+      WriteBlocks();
+    }
+
+    BBCDEBUG2(("Flushed all queued blocks to disk"));
+    flushed = true;
+  }
+
+  StopDirectIO();
+
+  if (tracking)
+  {
+    // leave the file at the logical position for normal file operations
+    if ((position != diskposition) && (EnhancedFile::fseek(position, SEEK_SET) != 0))
+    {
+      BBCERROR("Failed to seek to %s after flushing: %s", StringFrom(position).c_str(), strerror(errno));
+    }
+    tracking = false;
+  }
+
+  // only count flushes that had something to do
+  if (flushed)
+  {
+    uint64_t duration = GetNanosecondTicks() - start;
+
+    writestats.flushes++;
+    writestats.flushtime += duration;
+    UpdateMaximum(writestats.maxflushtime, duration);
+  }
+
+  NotifyHighWater();
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Return whether it will be 'quick' to close the file now - indicating the close will be quick
+/** Start reading ahead from the current file position (if enabled and not already started)
  *
- * @note this essentially returns whether there is more than one block queued to write
+ * @return true if read ahead is running
  */
 /*--------------------------------------------------------------------------------*/
-bool BackgroundFile::ReadyToClose() const
+bool BackgroundFile::StartReadAhead()
 {
-  // return true in the case of none or only one block queued to write
-  // there appears to be a race condition here (first *could* become NULL between the two checks below)
-  // BUT first only becomes NULL when the file closes so as long as ReadyToClose() is called by
-  // the SAME thread as that will close the file (highly likely) this will never be an issue 
-  return (isopen() && !(first && first->next));
+  // mapped files are already in memory
+  if (!reading && enablereadahead && fp && !ismapped())
+  {
+    uint_t i;
+
+    if (readblocks.empty())
+    {
+      // the rings must be able to hold every block
+      readqueue.Resize(readnblocks);
+      readfree.Resize(readnblocks);
+
+      for (i = 0; i < readnblocks; i++)
+      {
+        BLOCK *block;
+
+        // allocate header and data in one allocation
+        if ((block = (BLOCK *)malloc(sizeof(*block) + readblocksize)) != NULL)
+        {
+          block->data = (uint8_t *)(block + 1);
+          readblocks.push_back(block);
+        }
+        else
+        {
+          BBCERROR("Failed to allocate block of %s bytes for read ahead", StringFrom(readblocksize).c_str());
+          break;
+        }
+      }
+    }
+
+    // pass all blocks to the read ahead thread
+    readqueue.Reset();
+    readfree.Reset();
+    for (i = 0; i < readblocks.size(); i++)
+    {
+      *readfree.GetWriteBuffer() = readblocks[i];
+      readfree.IncrementWrite();
+    }
+
+    readcurrent  = NULL;
+    readposition = EnhancedFile::ftell();
+
+    if (!readblocks.empty() && readthread.Start(&__ReadAheadStart, (void *)this))
+    {
+      BBCDEBUG3(("Started read ahead at %s", StringFrom(readposition).c_str()));
+      readstats.restarts++;
+      reading = true;
+    }
+    else BBCERROR("Failed to start read ahead thread");
+  }
+
+  return reading;
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Write the first block to disk
+/** Stop reading ahead, discard any blocks read and leave the file at the logical position
  */
 /*--------------------------------------------------------------------------------*/
-void BackgroundFile::WriteBlock()
+void BackgroundFile::StopReadAhead()
 {
-  BLOCK *block = (BLOCK *)first;
+  if (reading)
+  {
+    // tell thread to quit, wake it up and wait for it to finish
+    readthread.Stop(false);
+    readfree.InterruptWaitForRead();
+    readthread.Stop();
 
-  size_t res = EnhancedFile::fwrite(block->data, block->size, block->count);
-  if (res == 0) BBCERROR("Failed to write %s * %s bytes to file in background: %s", StringFrom(block->size).c_str(), StringFrom(block->count).c_str(), strerror(ferror()));
+    readcurrent = NULL;
+    reading     = false;
 
-  first = first->next;
-  free(block);
+    // this also clears any end of file indication from reading ahead
+    if (EnhancedFile::fseek(readposition, SEEK_SET) != 0)
+    {
+      BBCERROR("Failed to seek to %s after reading ahead: %s", StringFrom(readposition).c_str(), strerror(errno));
+    }
+  }
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Flush any queued blocks to disk and shutdown thread
+/** Free read ahead blocks
+ *
+ * @note read ahead MUST NOT be running
  */
 /*--------------------------------------------------------------------------------*/
-void BackgroundFile::FlushToDisk()
+void BackgroundFile::FreeReadAheadBlocks()
 {
-  if (thread.IsRunning() || first)
-  {
-    BBCDEBUG2(("Flushing queued blocks to disk"));
+  uint_t i;
 
-    // tell thread to quit
-    thread.Stop();
+  for (i = 0; i < readblocks.size(); i++) free(readblocks[i]);
+  readblocks.clear();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read ahead thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *BackgroundFile::ReadAheadRun()
+{
+  bool eof = false;
 
-    // write remaining (including last) blocks
-    while (first)
+  // the file is owned by this thread whilst reading ahead
+  while (!eof && !readthread.StopRequested())
+  {
+    BLOCK **p;
+
+    if ((p = readfree.GetReadBuffer()) != NULL)
     {
-      WriteBlock();
-    }
+      BLOCK *block = *p;
 
-    first = last = NULL;
+      readfree.IncrementRead();
 
-    BBCDEBUG2(("Flushed all queued blocks to disk"));
+      // an empty block marks the end of the file (or an error)
+      block->size = EnhancedFile::fread(block->data, 1, readblocksize);
+      if (!block->size)
+      {
+        if (EnhancedFile::ferror()) BBCERROR("Failed to read ahead: %s", strerror(errno));
+        eof = true;
+      }
+
+      *readqueue.GetWriteBuffer() = block;
+      readqueue.IncrementWrite();
+    }
+    // sleep until a block is consumed or the thread is stopped
+    else readfree.WaitForRead(1000);
   }
+
+  return NULL;
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -120,24 +1162,37 @@ void BackgroundFile::FlushToDisk()
 /*--------------------------------------------------------------------------------*/
 void *BackgroundFile::Run()
 {
+  // wait time when no maximum latency is set (thread is woken when blocks are queued or when stopping)
+  static const uint_t idletimeout = 1000;
+
   while (!thread.StopRequested())
   {
-    // ONLY write block if there is a next block to become first
-    // (the last block will be handled by FlushToDisk())
-    while (first && first->next)
+    uint_t timeout = idletimeout;
+
+    // write all queued blocks and pass them on to the OS
+    if (queue.ReadBuffersAvailable())
     {
-      WriteBlock();
+      while (queue.ReadBuffersAvailable())
+      {
+        WriteBlocks();
+      }
+
+      EnhancedFile::fflush();
     }
 
-    // thread yielding sleep
-    usleep(10000);
+    // queue partially filled block if it has been waiting too long
+    if (maxlatency) timeout = CommitExpiredBlock();
+
+    // sleep until a block is queued or the partially filled block expires
+    if (timeout) queue.WaitForRead(timeout);
   }
-  
+
   return NULL;
 }
 
 void BackgroundFile::fclose()
 {
+  StopReadAhead();
   FlushToDisk();
   EnhancedFile::fclose();
 }
@@ -146,64 +1201,239 @@ size_t BackgroundFile::fread(void *ptr, size_t size, size_t count)
 {
   // must make sure that all queued blocks are flushed to disk before reading
   FlushToDisk();
-  return EnhancedFile::fread(ptr, size, count);
+
+  if (!StartReadAhead()) return EnhancedFile::fread(ptr, size, count);
+
+  uint8_t *p    = (uint8_t *)ptr;
+  size_t  bytes = size * count, n = 0;
+  bool    waited = false;
+
+  while (n < bytes)
+  {
+    if (!readcurrent)
+    {
+      BLOCK **block;
+
+      if ((block = readqueue.GetReadBuffer()) == NULL)
+      {
+        // read ahead has not kept up
+        waited = true;
+        readqueue.WaitForRead(100);
+        continue;
+      }
+
+      readcurrent = *block;
+      readqueue.IncrementRead();
+      readoffset  = 0;
+    }
+
+    // an empty block marks the end of the file (and stays current)
+    if (!readcurrent->size) break;
+
+    size_t m = std::min(bytes - n, readcurrent->size - readoffset);
+    memcpy(p + n, readcurrent->data + readoffset, m);
+    n            += m;
+    readoffset   += m;
+    readposition += m;
+
+    // pass consumed block back to the read ahead thread
+    if (readoffset == readcurrent->size)
+    {
+      *readfree.GetWriteBuffer() = readcurrent;
+      readfree.IncrementWrite();
+      readcurrent = NULL;
+    }
+  }
+
+  if (waited) readstats.misses++;
+  else        readstats.hits++;
+  readstats.bytes += n;
+
+  return size ? n / size : 0;
 }
 
 size_t BackgroundFile::fwrite(const void *ptr, size_t size, size_t count)
 {
   size_t res = 0;
 
+  StopReadAhead();
+
   // if file is open and background writing is enabled
-  if (isopen() && enablebackground)
+  if (isopen() && enablebackground && AllocatePool())
   {
-    // create a block and queue it
-    BLOCK *block;
+    const uint8_t *p = (const uint8_t *)ptr;
+    size_t bytes = size * count;
 
-    if ((block = (BLOCK *)calloc(1, sizeof(*block) + (size * count))) != NULL)
+    // start tracking the file position (the pipeline is empty so the file position is valid)
+    if (!tracking)
     {
-      // set block up with correct size and count
-      block->size  = size;
-      block->count = count;
+      position = diskposition = EnhancedFile::ftell();
+      tracking = true;
+
+      // reserve initial space
+      preallocating = ((preallocsize > 0) || (preallocextent > 0));
+      if (preallocsize && !reserve(preallocsize)) preallocating = false;
 
-      // copy data
-      memcpy(block->data, ptr, size * count);
+      StartDirectIO();
+      StartAsyncIO();
+    }
 
-      // queue block
-      if (last) last->next = block;
-      last = block;
-      if (!first) first = block;
+    while (bytes)
+    {
+      BLOCK *block = NULL;
+      bool  needblock;
 
-      // if the thread is not running, start it
-      if (!thread.IsRunning())
+      // get a block to copy data into *without* holding the lock since the background
+      // thread needs the lock to queue the partially filled block
       {
-        if (thread.Start(&__ThreadStart, (void *)this))
-        {
-          BBCDEBUG2(("Created thread for background file writing"));
-        }
-        else
-		{
-          BBCERROR("Failed to create thread (%s)", strerror(errno));
-		}
+        ThreadLock lock(currentlock);
+        needblock = !current;
+      }
+      if (needblock) block = GetFreeBlock();
+
+      ThreadLock lock(currentlock);
+
+      // a block can only hold contiguous data so queue it if the file position has been moved
+      if (current && ((current->offset + (off_t)current->size) != position)) CommitBlock();
+
+      if (!current)
+      {
+        // the background thread may have queued the current block since it was checked
+        if (!block) continue;
+
+        current = block;
+        current->offset   = position;
+        current->capacity = blocksize;
+        current->time     = GetTickCount();
+
+        // end the block on an aligned boundary so that the following blocks are aligned
+        if (directfd >= 0) current->capacity -= (size_t)(position % (off_t)DirectIOAlignment);
       }
 
-      // indicate all data has been written
-      res = count;
+      // copy as much data as will fit into block
+      size_t n = std::min(bytes, current->capacity - current->size);
+      memcpy(current->data + current->size, p, n);
+      current->size += n;
+      position      += n;
+      p             += n;
+      bytes         -= n;
+
+      // if the block is full, queue it
+      if (current->size == current->capacity) CommitBlock();
+    }
+
+    if (asyncio)
+    {
+      // the reservation is grown here, ahead of every queued block, since submission can
+      // happen on the service's thread which must not block
+      ExtendReservation(position);
+      SubmitBlocks();
+    }
+    // if the thread is not running, start it (even for a partially filled block so that it is written within the maximum latency)
+    else if (!thread.IsRunning())
+    {
+      if (thread.Start(&__ThreadStart, (void *)this))
+      {
+        BBCDEBUG2(("Created thread for background file writing"));
+      }
+      else
+      {
+        BBCERROR("Failed to create thread (%s)", strerror(errno));
+      }
     }
+
+    NotifyHighWater();
+
+    // indicate all data has been written
+    res = count;
   }
   else res = EnhancedFile::fwrite(ptr, size, count);
 
   return res;
 }
 
-off_t BackgroundFile::ftell()
+size_t BackgroundFile::writev(const IOVEC *iov, uint_t n)
 {
-  // must make sure that all queued blocks are flushed to disk before performing any normal file operations
+  size_t res = 0;
+
+  StopReadAhead();
+
+  if (isopen() && enablebackground)
+  {
+    uint_t i;
+
+    for (i = 0; i < n; i++) res += fwrite(iov[i].data, 1, iov[i].size);
+  }
+  else res = EnhancedFile::writev(iov, n);
+
+  return res;
+}
+
+size_t BackgroundFile::readv(const IOVEC *iov, uint_t n)
+{
+  size_t res = 0;
+
+  if (enablereadahead)
+  {
+    uint_t i;
+
+    // read each buffer from the read ahead blocks
+    for (i = 0; i < n; i++)
+    {
+      size_t bytes = fread(iov[i].data, 1, iov[i].size);
+      res += bytes;
+      if (bytes < iov[i].size) break;
+    }
+  }
+  else
+  {
+    // must make sure that all queued blocks are flushed to disk before reading
+    FlushToDisk();
+    res = EnhancedFile::readv(iov, n);
+  }
+
+  return res;
+}
+
+int BackgroundFile::readline(char *line, uint_t maxlen)
+{
+  // lines are read directly from the file
+  StopReadAhead();
   FlushToDisk();
-  return EnhancedFile::ftell();
+  return EnhancedFile::readline(line, maxlen);
+}
+
+off_t BackgroundFile::ftell() const
+{
+  return reading ? readposition : tracking ? position : EnhancedFile::ftell();
+}
+
+off_t BackgroundFile::ftell()
+{
+  return reading ? readposition : tracking ? position : EnhancedFile::ftell();
 }
 
 int BackgroundFile::fseek(off_t offset, int origin)
 {
+  // read ahead restarts at the new position on the next read
+  StopReadAhead();
+
+  // the end of the file is not known without flushing queued blocks to disk
+  if (tracking && (origin != SEEK_END))
+  {
+    if (origin == SEEK_CUR) offset += position;
+
+    if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    // the next write will start a new block at this position
+    position = offset;
+    return 0;
+  }
+
   // must make sure that all queued blocks are flushed to disk before performing any normal file operations
   FlushToDisk();
   return EnhancedFile::fseek(offset, origin);
@@ -211,32 +1441,60 @@ int BackgroundFile::fseek(off_t offset, int origin)
 
 int BackgroundFile::fflush()
 {
+  StopReadAhead();
   // must make sure that all queued blocks are flushed to disk before performing any normal file operations
   FlushToDisk();
   return EnhancedFile::fflush();
 }
 
-void BackgroundFile::rewind()
+/*--------------------------------------------------------------------------------*/
+/** Write all queued blocks and wait until the file's data is on the disk
+ *
+ * @note background writing continues afterwards
+ */
+/*--------------------------------------------------------------------------------*/
+int BackgroundFile::fsync()
 {
-  // must make sure that all queued blocks are flushed to disk before performing any normal file operations
+  StopReadAhead();
+  WaitForWrites();
+  return EnhancedFile::fsync();
+}
+
+bool BackgroundFile::truncate(off_t size)
+{
+  StopReadAhead();
+  // must make sure that all queued blocks are flushed to disk before changing the length of the file
   FlushToDisk();
-  return EnhancedFile::rewind();
+  return EnhancedFile::truncate(size);
+}
+
+void BackgroundFile::rewind()
+{
+  StopReadAhead();
+  if (tracking) position = 0;
+  else          EnhancedFile::rewind();
 }
 
 int BackgroundFile::fprintf(const char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
-  int res = vfprintf(fmt, ap);  // use this class's function to flush queued blocks to disk
+  int res = vfprintf(fmt, ap);  // use this class's function to queue the text
   va_end(ap);
   return res;
 }
 
 int BackgroundFile::vfprintf(const char *fmt, va_list ap)
 {
-  // must make sure that all queued blocks are flushed to disk before performing any normal file operations
-  FlushToDisk();
-  return EnhancedFile::vfprintf(fmt, ap);  
+  if (isopen() && enablebackground)
+  {
+    // format text and queue it like any other write
+    std::string str;
+    VPrintf(str, fmt, ap);
+    return (int)fwrite(str.c_str(), 1, str.length());
+  }
+
+  return EnhancedFile::vfprintf(fmt, ap);
 }
 
 BBC_AUDIOTOOLBOX_END
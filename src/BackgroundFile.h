@@ -3,11 +3,8 @@
 
 #include "EnhancedFile.h"
 #include "Thread.h"
-
-#ifdef COMPILER_MSVC
-#pragma warning( push )
-#pragma warning( disable : 4200 )
-#endif
+#include "WaitableLockFreeBuffer.h"
+#include "AsyncFileIO.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -18,23 +15,221 @@ BBC_AUDIOTOOLBOX_START
  * By default this class operates exactly as EnhancedFile until EnableBackground() is
  * called
  *
+ * Writes are copied into a pool of fixed-size, reusable blocks: small writes are
+ * coalesced into the current block and full blocks are passed to the background
+ * thread through a lock-free ring which returns them to the pool once written.  No
+ * memory is allocated per write.  If the pool is exhausted, the pool policy decides
+ * whether more blocks are allocated or the caller waits for a block to be written
+ *
+ * The background thread sleeps until a block is queued.  A partially filled block is
+ * queued by the background thread once it is older than the maximum write latency so
+ * that data reaches the disk promptly even if the caller stops writing
+ *
+ * Whilst background writing, the logical file position is tracked by this class so
+ * ftell(), fseek() (except from SEEK_END), rewind() and fprintf() do not wait for queued
+ * blocks to be written.  Each block records the file offset it must be written at so
+ * writes after a seek (e.g. patching a header) are queued like any other write
+ *
+ * Where it is available, blocks are written by the shared AsyncFileIO service (io_uring
+ * or a small pool of threads shared by all files) instead of a thread per file so that
+ * many files can be written at once without many threads.  Each file has at most one
+ * write outstanding so writes to each file are made in order.  EnableAsyncIO(false)
+ * reverts to a dedicated thread for the file
+ *
+ * With EnableDirectIO(), blocks are aligned in memory and, where possible, in the file so
+ * that they can be written using direct I/O (O_DIRECT), bypassing the page cache for long
+ * recordings.  Blocks which are not a multiple of the alignment in size or position (e.g.
+ * the tail of the file, partial blocks written because of the maximum write latency or
+ * header patches) are written through the page cache as normal
+ *
+ * With SetPreallocation(), disk space is reserved ahead of the writes (see
+ * EnhancedFile::reserve()) and the reservation is grown in large extents by the thread
+ * writing blocks (or, with the asynchronous file service, by fwrite() so that the service
+ * never blocks) so that long recordings are not fragmented as they grow.  Any space
+ * reserved beyond the end of the file is released when the file is closed
+ *
+ * With EnableReadAhead(), fread() is the mirror of background writing: a background thread
+ * reads blocks ahead of the read position into a ring of blocks and fread() copies data
+ * out of them.  Seeking (or any other operation) stops the read ahead and it is restarted
+ * at the new position by the next fread().  Read ahead and background writing are not
+ * active at the same time: reading flushes queued writes and writing stops read ahead
+ *
  * This class is thread safe as long as ONLY a single thread performs the high-level
  * file operations
  */
 /*--------------------------------------------------------------------------------*/
-class BackgroundFile : public EnhancedFile {
+class BackgroundFile : public EnhancedFile, protected AsyncFileIO::Client {
 public:
   BackgroundFile();
   BackgroundFile(const char *filename, const char *mode = "rb");
   BackgroundFile(const BackgroundFile& obj);
   virtual ~BackgroundFile();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Duplicate file by assignment
+   *
+   * @note this will open the same file again (background writing state is NOT copied)
+   */
+  /*--------------------------------------------------------------------------------*/
+  BackgroundFile& operator = (const BackgroundFile& obj);
+
   /*--------------------------------------------------------------------------------*/
   /** Enable background writing behaviour
    */
   /*--------------------------------------------------------------------------------*/
   virtual void   EnableBackground(bool enable = true);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Use the shared asynchronous file service instead of a thread for this file (default)
+   *
+   * @note the service is only used if it is available on this platform and the file is
+   * not opened for append
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   EnableAsyncIO(bool enable = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write aligned blocks using direct I/O (O_DIRECT), bypassing the page cache
+   *
+   * @note this will flush any queued blocks to disk and re-allocate the block pool with
+   * the block size rounded up to a multiple of DirectIOAlignment
+   *
+   * @note direct I/O is only used if it is supported by the platform and filesystem and
+   * the file is not opened for append
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   EnableDirectIO(bool enable = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reserve disk space ahead of writing to reduce fragmentation
+   *
+   * @param size number of bytes to reserve when writing starts (e.g. expected length of recording)
+   * @param extent size to grow reservation by when writing approaches the end of it (0 to not grow)
+   *
+   * @note if the file is open, the initial size is reserved immediately
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   SetPreallocation(off_t size, off_t extent = DefaultPreallocationExtent);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable reading ahead of fread() in a background thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   EnableReadAhead(bool enable = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set read ahead depth
+   *
+   * @param nblocks number of blocks to read ahead
+   * @param blocksize size of each block in bytes
+   *
+   * @note this will stop any read ahead in progress
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   SetReadAhead(uint_t nblocks, size_t blocksize = DefaultBlockSize);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read ahead statistics
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    uint64_t hits;              ///< fread() calls satisfied entirely from read ahead blocks
+    uint64_t misses;            ///< fread() calls that had to wait for the read ahead thread
+    uint64_t bytes;             ///< bytes returned from read ahead blocks
+    uint64_t restarts;          ///< number of times read ahead was (re)started
+  } READAHEAD_STATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return/reset read ahead statistics
+   */
+  /*--------------------------------------------------------------------------------*/
+  const READAHEAD_STATS& GetReadAheadStats() const {return readstats;}
+  void           ResetReadAheadStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Background writing statistics
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    uint64_t queuedbytes;       ///< bytes queued for writing now (excluding the partially filled block)
+    uint_t   queuedblocks;      ///< blocks queued for writing now
+    uint64_t highwaterbytes;    ///< most bytes that have been queued at once
+    uint_t   highwaterblocks;   ///< most blocks that have been queued at once
+    uint64_t highwaterevents;   ///< number of times the queue has risen above the high-water threshold
+    uint64_t byteswritten;      ///< bytes written from queued blocks
+    uint64_t writes;            ///< number of writes (each of one or more contiguous blocks)
+    uint64_t writetime;         ///< total time spent writing in ns
+    uint64_t maxwritetime;      ///< longest write in ns
+    double   throughput;        ///< bytes written per second since the statistics were reset
+    uint64_t flushes;           ///< number of times queued blocks have been flushed by FlushToDisk()
+    uint64_t flushtime;         ///< total time spent in FlushToDisk() in ns
+    uint64_t maxflushtime;      ///< longest FlushToDisk() in ns
+  } WRITE_STATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return/reset background writing statistics
+   *
+   * @note the statistics can be read from any thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  WRITE_STATS    GetWriteStats() const;
+  void           ResetWriteStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Callback for when the number of bytes queued for writing rises above the high-water
+   * threshold (above = true) and when it falls back to half of it (above = false)
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef void (*HIGHWATERHANDLER)(BackgroundFile& file, bool above, uint64_t queuedbytes, void *context);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set high-water callback so that the writer can react before the queue (and memory use) grows too far
+   *
+   * @param threshold number of queued bytes to call the handler at (0 to disable)
+   * @param handler function to call
+   * @param context context pointer for handler
+   *
+   * @note crossings are recorded by whichever thread queues or writes the block that crosses
+   * the threshold but the handler is only ever called by the calling thread, without any lock
+   * held, at the end of the next fwrite(), WaitForWrites() or flush (queuedbytes is the number
+   * of bytes queued at that point).  The handler MUST NOT call any file operations of this object
+   */
+  /*--------------------------------------------------------------------------------*/
+  void           SetHighWaterHandler(uint64_t threshold, HIGHWATERHANDLER handler, void *context = NULL);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Policy when all blocks in the pool are queued for writing
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef enum
+  {
+    POOL_WAIT = 0,            ///< wait for the background thread to write a block
+    POOL_GROW,                ///< allocate another block (up to the maximum) and then wait
+  } POOL_POLICY;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Configure the block pool
+   *
+   * @param blocksize size of each block in bytes
+   * @param nblocks number of blocks to preallocate
+   * @param policy what to do when all blocks are queued
+   * @param maxblocks maximum number of blocks (for POOL_GROW policy, 0 means nblocks)
+   *
+   * @note this will flush any queued blocks to disk
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   SetBlockPool(size_t blocksize, uint_t nblocks, POOL_POLICY policy = POOL_GROW, uint_t maxblocks = 0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set maximum time data can stay in a partially filled block before being written
+   *
+   * @param latency maximum latency in ms (0 to only write full blocks)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   SetMaxWriteLatency(uint_t latency) {maxlatency = latency;}
+
   /*--------------------------------------------------------------------------------*/
   /** Return whether it will be 'quick' to close the file now - indicating the close will be quick
    *
@@ -53,27 +248,259 @@ public:
 
   virtual size_t fread(void *ptr, size_t size, size_t count);
   virtual size_t fwrite(const void *ptr, size_t size, size_t count);
+  virtual off_t  ftell() const;
   virtual off_t  ftell();
   virtual int    fseek(off_t offset, int origin);
   virtual int    fflush();
   virtual void   rewind();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Write all queued blocks and wait until the file's data is on the disk
+   *
+   * @note background writing continues afterwards
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual int    fsync();
+  virtual bool   truncate(off_t size);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Queue any partially filled block and wait until every queued block has been written,
+   * without stopping background writing
+   *
+   * @note the data is passed to the OS but is not necessarily on the disk (see fsync())
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   WaitForWrites();
+
   virtual int    fprintf(const char *fmt, ...) PRINTF_FORMAT2;
   virtual int    vfprintf(const char *fmt, va_list ap);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Queue a list of buffers for writing
+   *
+   * @note the buffers are copied into the block pool so they can be re-used as soon as
+   * this returns (the background thread writes contiguous blocks using a single writev())
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual size_t writev(const IOVEC *iov, uint_t n);
+  virtual size_t readv(const IOVEC *iov, uint_t n);
+
+  virtual int    readline(char *line, uint_t maxlen);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Default block pool configuration
+   */
+  /*--------------------------------------------------------------------------------*/
+  static const size_t DefaultBlockSize;
+  static const uint_t DefaultBlocks;
+  static const uint_t DefaultMaxBlocks;
+  static const uint_t DefaultMaxWriteLatency;
+  static const uint_t MaxBlocksPerWrite;
+  static const size_t DirectIOAlignment;
+  static const uint_t DefaultReadAheadBlocks;
+  static const off_t  DefaultPreallocationExtent;
+
 protected:
+  typedef struct
+  {
+    off_t   offset;             ///< file offset to write data at
+    size_t  size;               ///< number of bytes used
+    size_t  capacity;           ///< number of bytes block can hold
+    ulong_t time;               ///< tick count when first byte was written
+    uint8_t *data;
+  } BLOCK;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Allocate the block pool (if it hasn't already been)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool   AllocatePool();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Free the block pool
+   *
+   * @note background thread MUST NOT be running
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   FreePool();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Allocate a single block
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual BLOCK *AllocateBlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Get an empty block from the pool, using the pool policy if none are free
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual BLOCK *GetFreeBlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Queue the current block for writing (if it contains any data)
+   *
+   * @note currentlock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   CommitBlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Queue the current block for writing if it is older than the maximum write latency
+   *
+   * @return time in ms until the current block would need to be written
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint_t CommitExpiredBlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Gather the first queued block and any contiguous blocks following it
+   *
+   * @param iov array to receive buffers
+   * @param n maximum number of blocks
+   * @param offset variable to receive the file offset of the first block
+   * @param direct variable to receive whether the blocks can be written using direct I/O
+   *
+   * @return number of blocks gathered
+   *
+   * @note only the thread that writes blocks may call this
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t         GatherBlocks(IOVEC *iov, uint_t n, off_t& offset, bool& direct) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether block can be written using direct I/O
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool           IsDirectBlock(const BLOCK *block) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Remove written blocks from the queue and return them to the pool
+   */
+  /*--------------------------------------------------------------------------------*/
+  void           ReleaseBlocks(uint_t n);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Call the high-water handler for any crossings of the threshold since the last call
+   *
+   * @note only the calling thread may call this and currentlock MUST NOT be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  void           NotifyHighWater();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Update statistics after a write of queued blocks
+   *
+   * @param bytes number of bytes written
+   * @param duration time taken in ns
+   */
+  /*--------------------------------------------------------------------------------*/
+  void           UpdateWriteStats(size_t bytes, uint64_t duration);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write the first queued block (and any contiguous blocks following it) to disk and return them to the pool
+   *
+   * @note contiguous blocks are written using a single writev()
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   WriteBlocks();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start using the shared asynchronous file service (if enabled and possible)
+   */
   /*--------------------------------------------------------------------------------*/
-  /** Write the first block to disk
+  virtual void   StartAsyncIO();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Grow disk space reservation if a write up to end would get too close to the end of it
+   *
+   * @note only the thread that writes blocks (or, with the asynchronous file service, the
+   * thread calling fwrite()) may call this
+   */
+  /*--------------------------------------------------------------------------------*/
+  void           ExtendReservation(off_t end);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open file for direct I/O (if enabled and possible)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   StartDirectIO();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Close direct I/O file descriptor
+   *
+   * @note nothing may be queued
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   StopDirectIO();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Submit queued blocks to the asynchronous file service if no write is outstanding
+   *
+   * @note can be called from any thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  void           SubmitBlocks();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Asynchronous write has completed (called by the service)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   WriteComplete(AsyncFileIO::REQUEST *req, sint64_t result);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Periodic servicing by the asynchronous file service (handles write latency)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint_t Service();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of bytes queued for writing (used by the service to share workers fairly)
    */
   /*--------------------------------------------------------------------------------*/
-  virtual void WriteBlock();
+  virtual uint64_t GetQueuedBytes() const {return queuedbytes.load();}
 
   /*--------------------------------------------------------------------------------*/
   /** Flush any queued blocks to disk and shutdown thread
+   *
+   * @note this leaves the file at the logical position and stops position tracking
    */
   /*--------------------------------------------------------------------------------*/
   virtual void   FlushToDisk();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Start reading ahead from the current file position (if enabled and not already started)
+   *
+   * @return true if read ahead is running
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool   StartReadAhead();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Stop reading ahead, discard any blocks read and leave the file at the logical position
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   StopReadAhead();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Free read ahead blocks
+   *
+   * @note read ahead MUST NOT be running
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void   FreeReadAheadBlocks();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read ahead thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__ReadAheadStart(Thread& thread, void *arg)
+  {
+    UNUSED_PARAMETER(thread);
+    BackgroundFile& reader = *(BackgroundFile *)arg;
+    return reader.ReadAheadRun();
+  }
+  void *ReadAheadRun();
+
   /*--------------------------------------------------------------------------------*/
   /** Thread entry point
    */
@@ -91,24 +518,71 @@ protected:
   /*--------------------------------------------------------------------------------*/
   void *Run();
 
-  typedef struct _BLOCK
-  {
-    struct _BLOCK *next;
-    size_t  size;
-    size_t  count;
-    uint8_t data[0];
-  } BLOCK;
-  
 protected:
-  bool                   enablebackground;
-  Thread                 thread;
-  volatile BLOCK		 *first, *last;
+  bool                           enablebackground;
+  Thread                         thread;
+  size_t                         blocksize;
+  size_t                         alignment;     ///< memory alignment of block data
+  uint_t                         nblocks;
+  uint_t                         maxblocks;
+  POOL_POLICY                    poolpolicy;
+  uint_t                         maxlatency;
+  std::vector<BLOCK *>           blocks;        ///< all allocated blocks (owned by the calling thread)
+  ThreadLockObject               currentlock;   ///< protects current and the write side of queue
+  BLOCK                          *current;      ///< block currently being filled
+  bool                           tracking;      ///< true if the logical position is being tracked (i.e. blocks may be queued)
+  off_t                          position;      ///< logical file position (owned by the calling thread)
+  off_t                          diskposition;  ///< actual file position (owned by whichever thread is writing blocks)
+  WaitableLockFreeBuffer<BLOCK *> queue;        ///< blocks waiting to be written (calling thread -> background thread)
+  WaitableLockFreeBuffer<BLOCK *> freeblocks;   ///< blocks that have been written (background thread -> calling thread)
+  bool                           enableasync;
+  AsyncFileIO                    *asyncio;      ///< asynchronous file service in use (NULL if not in use)
+  std::atomic<bool>              asyncbusy;     ///< true whilst a write is outstanding (the holder owns the read side of queue)
+  AsyncFileIO::REQUEST           asyncrequest;
+  ThreadBoolSignalObject         writecomplete; ///< signalled when a write of queued blocks completes
+  std::atomic<uint64_t>          queuedbytes;   ///< bytes in queue
+  bool                           enabledirect;
+  int                            directfd;      ///< file descriptor opened for direct I/O (-1 if not in use)
+  off_t                          preallocsize;
+  off_t                          preallocextent;
+  bool                           preallocating; ///< false once reserving space has failed
+  bool                           enablereadahead;
+  bool                           reading;       ///< true whilst reading ahead
+  Thread                         readthread;
+  size_t                         readblocksize;
+  uint_t                         readnblocks;
+  std::vector<BLOCK *>           readblocks;    ///< all read ahead blocks (owned by the calling thread)
+  WaitableLockFreeBuffer<BLOCK *> readqueue;    ///< blocks that have been read (read ahead thread -> calling thread)
+  WaitableLockFreeBuffer<BLOCK *> readfree;     ///< blocks that have been consumed (calling thread -> read ahead thread)
+  BLOCK                          *readcurrent;  ///< block currently being consumed
+  size_t                         readoffset;    ///< offset into readcurrent
+  off_t                          readposition;  ///< logical file position whilst reading ahead
+  READAHEAD_STATS                readstats;
+  struct
+  {
+    std::atomic<uint64_t>        highwaterbytes;
+    std::atomic<uint_t>          highwaterblocks;
+    std::atomic<uint64_t>        highwaterevents;
+    std::atomic<uint64_t>        byteswritten;
+    std::atomic<uint64_t>        writes;
+    std::atomic<uint64_t>        writetime;
+    std::atomic<uint64_t>        maxwritetime;
+    std::atomic<uint64_t>        flushes;
+    std::atomic<uint64_t>        flushtime;
+    std::atomic<uint64_t>        maxflushtime;
+    std::atomic<uint64_t>        start;         ///< time statistics were reset (ns)
+  }                              writestats;
+  uint64_t                       asyncsubmittime; ///< time the outstanding asynchronous write was submitted (ns)
+  uint64_t                       highwater;     ///< high-water threshold in bytes (0 to disable)
+  HIGHWATERHANDLER               highwaterhandler;
+  void                           *highwatercontext;
+  std::atomic<bool>              abovehighwater;
+  std::atomic<uint_t>            highwaterrises; ///< number of times the queue has risen above the threshold
+  std::atomic<uint_t>            highwaterfalls; ///< number of times the queue has fallen back below half of it
+  uint_t                         notifiedrises;  ///< rises reported to the handler (calling thread only)
+  uint_t                         notifiedfalls;  ///< falls reported to the handler (calling thread only)
 };
 
 BBC_AUDIOTOOLBOX_END
 
-#ifdef COMPILER_MSVC
-#pragma warning( pop )
-#endif
-
 #endif
@@ -0,0 +1,231 @@
+
+#include <string.h>
+
+#include "OSCompiler.h"
+
+#if defined(COMPILER_GCC) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42
+#elif defined(COMPILER_MSVC) && defined(_M_X64)
+#define CRC32C_SSE42
+#include <intrin.h>
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARMV8
+#include <arm_acle.h>
+#endif
+
+#define BBCDEBUG_LEVEL 1
+#include "CRC32C.h"
+
+BBC_AUDIOTOOLBOX_START
+
+typedef uint32_t (*CRC32CFN)(const uint8_t *p, size_t bytes, uint32_t crc);
+
+/*--------------------------------------------------------------------------------*/
+/** Tables for software CRC calculation, 8 bytes at a time ('slicing-by-8')
+ */
+/*--------------------------------------------------------------------------------*/
+class CRC32CTable
+{
+public:
+  CRC32CTable()
+  {
+    // reflected Castagnoli polynomial
+    static const uint32_t poly = 0x82f63b78;
+    uint_t i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (j = 0; j < 8; j++) crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+      table[0][i] = crc;
+    }
+
+    // table[j][i] is the CRC of byte i followed by j zero bytes
+    for (j = 1; j < NUMBEROF(table); j++)
+    {
+      for (i = 0; i < 256; i++) table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+    }
+  }
+
+  uint32_t table[8][256];
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Calculate CRC in software
+ *
+ * @note crc is NOT inverted on entry or exit
+ */
+/*--------------------------------------------------------------------------------*/
+static uint32_t CRC32CSoftware(const uint8_t *p, size_t bytes, uint32_t crc)
+{
+  static const CRC32CTable tables;
+  const uint32_t (*table)[256] = tables.table;
+
+  while (bytes >= 8)
+  {
+    uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    uint32_t hi = ((uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24));
+
+    crc = (table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+           table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24]);
+    p     += 8;
+    bytes -= 8;
+  }
+
+  while (bytes--) crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+  return crc;
+}
+
+#ifdef CRC32C_SSE42
+/*--------------------------------------------------------------------------------*/
+/** Calculate CRC using the SSE4.2 crc32 instruction
+ *
+ * @note crc is NOT inverted on entry or exit
+ */
+/*--------------------------------------------------------------------------------*/
+#ifdef COMPILER_GCC
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t CRC32CSSE42(const uint8_t *p, size_t bytes, uint32_t crc)
+{
+#ifdef COMPILER_GCC
+#define CRC32C_U8(crc, val)  __builtin_ia32_crc32qi(crc, val)
+#define CRC32C_U32(crc, val) __builtin_ia32_crc32si(crc, val)
+#define CRC32C_U64(crc, val) __builtin_ia32_crc32di(crc, val)
+#else
+#define CRC32C_U8(crc, val)  _mm_crc32_u8(crc, val)
+#define CRC32C_U32(crc, val) _mm_crc32_u32(crc, val)
+#define CRC32C_U64(crc, val) _mm_crc32_u64(crc, val)
+#endif
+
+  // x86 is little-endian so words can be read directly
+#if defined(__x86_64__) || defined(_M_X64)
+  uint64_t crc64;
+
+  while (bytes && ((uintptr_t)p & 7))
+  {
+    crc = CRC32C_U8(crc, *p++);
+    bytes--;
+  }
+
+  crc64 = crc;
+  while (bytes >= 8)
+  {
+    uint64_t val;
+    memcpy(&val, p, sizeof(val));
+    crc64  = CRC32C_U64(crc64, val);
+    p     += 8;
+    bytes -= 8;
+  }
+  crc = (uint32_t)crc64;
+#endif
+
+  while (bytes >= 4)
+  {
+    uint32_t val;
+    memcpy(&val, p, sizeof(val));
+    crc    = CRC32C_U32(crc, val);
+    p     += 4;
+    bytes -= 4;
+  }
+
+  while (bytes--) crc = CRC32C_U8(crc, *p++);
+
+#undef CRC32C_U8
+#undef CRC32C_U32
+#undef CRC32C_U64
+
+  return crc;
+}
+#endif
+
+#ifdef CRC32C_ARMV8
+/*--------------------------------------------------------------------------------*/
+/** Calculate CRC using the ARMv8 CRC32 instructions
+ *
+ * @note crc is NOT inverted on entry or exit
+ */
+/*--------------------------------------------------------------------------------*/
+static uint32_t CRC32CARMv8(const uint8_t *p, size_t bytes, uint32_t crc)
+{
+  while (bytes >= 8)
+  {
+    uint64_t val;
+    memcpy(&val, p, sizeof(val));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#endif
+    crc    = __crc32cd(crc, val);
+    p     += 8;
+    bytes -= 8;
+  }
+
+  while (bytes--) crc = __crc32cb(crc, *p++);
+
+  return crc;
+}
+#endif
+
+/*--------------------------------------------------------------------------------*/
+/** Choose the fastest CRC implementation for this processor
+ */
+/*--------------------------------------------------------------------------------*/
+static CRC32CFN SelectCRC32C()
+{
+  CRC32CFN fn = &CRC32CSoftware;
+
+#ifdef CRC32C_SSE42
+#ifdef COMPILER_GCC
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) fn = &CRC32CSSE42;
+#else
+  int info[4];
+  __cpuid(info, 1);
+  if (info[2] & (1 << 20)) fn = &CRC32CSSE42;
+#endif
+#endif
+
+#ifdef CRC32C_ARMV8
+  fn = &CRC32CARMv8;
+#endif
+
+  BBCDEBUG2(("Using %s CRC-32C", (fn != &CRC32CSoftware) ? "hardware" : "software"));
+
+  return fn;
+}
+
+static CRC32CFN GetCRC32CFunction()
+{
+  static const CRC32CFN fn = SelectCRC32C();
+  return fn;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Calculate the CRC-32C (Castagnoli) checksum of a block of data
+ *
+ * @param data data to checksum
+ * @param bytes number of bytes
+ * @param crc CRC of preceding data (to checksum data in pieces) or 0 to start a new CRC
+ *
+ * @return CRC of data (including any preceding data)
+ *
+ * @note the CRC instructions of SSE4.2 (x86) or ARMv8 are used where the processor has them
+ */
+/*--------------------------------------------------------------------------------*/
+uint32_t CRC32C(const void *data, size_t bytes, uint32_t crc)
+{
+  return ~(*GetCRC32CFunction())((const uint8_t *)data, bytes, ~crc);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether CRC32C() uses the processor's CRC instructions
+ */
+/*--------------------------------------------------------------------------------*/
+bool CRC32CIsHardwareAccelerated()
+{
+  return (GetCRC32CFunction() != &CRC32CSoftware);
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,30 @@
+#ifndef __CRC32C__
+#define __CRC32C__
+
+#include "misc.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Calculate the CRC-32C (Castagnoli) checksum of a block of data
+ *
+ * @param data data to checksum
+ * @param bytes number of bytes
+ * @param crc CRC of preceding data (to checksum data in pieces) or 0 to start a new CRC
+ *
+ * @return CRC of data (including any preceding data)
+ *
+ * @note the CRC instructions of SSE4.2 (x86) or ARMv8 are used where the processor has them
+ */
+/*--------------------------------------------------------------------------------*/
+extern uint32_t CRC32C(const void *data, size_t bytes, uint32_t crc = 0);
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether CRC32C() uses the processor's CRC instructions
+ */
+/*--------------------------------------------------------------------------------*/
+extern bool CRC32CIsHardwareAccelerated();
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -4,6 +4,23 @@
 #include <string.h>
 #include <errno.h>
 
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef COMPILER_MSVC
+#include <io.h>
+#endif
+
+#include <vector>
+
 #define BBCDEBUG_LEVEL 2
 #include "EnhancedFile.h"
 
@@ -11,20 +28,26 @@ BBC_AUDIOTOOLBOX_START
 
 EnhancedFile::EnhancedFile() : RefCountedObject(),
                                fp(NULL),
-                               allowclose(false)
+                               allowclose(false),
+                               mappos(0),
+                               reserved(0)
 {
 }
 
 EnhancedFile::EnhancedFile(const char *filename, const char *mode) : RefCountedObject(),
                                                                      fp(NULL),
-                                                                     allowclose(false)
+                                                                     allowclose(false),
+                                                                     mappos(0),
+                                                                     reserved(0)
 {
   fopen(filename, mode);
 }
 
 EnhancedFile::EnhancedFile(const EnhancedFile& obj) : RefCountedObject(),
                                                       fp(NULL),
-                                                      allowclose(false)
+                                                      allowclose(false),
+                                                      mappos(0),
+                                                      reserved(0)
 {
   operator = (obj);
 }
@@ -40,9 +63,19 @@ EnhancedFile::~EnhancedFile()
 /*--------------------------------------------------------------------------------*/
 EnhancedFile& EnhancedFile::operator = (const EnhancedFile& obj)
 {
+  if (&obj == this) return *this;
+
   fclose();
 
-  if (obj.isopen())
+  if (obj.mapping)
+  {
+    // share mapping rather than opening file again
+    filename = obj.filename;
+    mode     = obj.mode;
+    mapping  = obj.mapping;
+    mappos   = obj.mappos;
+  }
+  else if (obj.isopen())
   {
     if (fopen(obj.filename.c_str(), obj.mode.c_str()))
     {
@@ -83,15 +116,28 @@ bool EnhancedFile::fopen(const char *filename, const char *mode)
       allowclose     = false;
       success        = true;
     }
-    else if ((fp = ::fopen(filename, mode)) != NULL)
+    else
     {
-      BBCDEBUG2(("Opened '%s' for '%s'", filename, mode));
-      this->filename = filename;
-      this->mode     = mode;
-      allowclose     = true;
-      success        = true;
+      // 'm' is not passed to fopen(), it requests memory mapping
+      std::string fmode = SearchAndReplace(mode, "m", "");
+      bool        map   = (fmode != mode);
+
+      if (map && ((fmode.find_first_of("wa+") != std::string::npos)))
+      {
+        BBCERROR("Memory mapping of '%s' is only supported for reading (mode '%s')", filename, mode);
+      }
+      else if ((fp = ::fopen(filename, fmode.c_str())) != NULL)
+      {
+        BBCDEBUG2(("Opened '%s' for '%s'", filename, mode));
+        this->filename = filename;
+        this->mode     = mode;
+        allowclose     = true;
+        success        = true;
+
+        if (map && !MapFile()) BBCDEBUG2(("Failed to map '%s', using normal file access", filename));
+      }
+      else BBCERROR("Failed to open '%s' for '%s' (%s)", filename, mode, strerror(errno));
     }
-    else BBCERROR("Failed to open '%s' for '%s' (%s)", filename, mode, strerror(errno));
   }
 
   return success;
@@ -99,19 +145,243 @@ bool EnhancedFile::fopen(const char *filename, const char *mode)
 
 void EnhancedFile::fclose()
 {
-  if (fp)
+  if (isopen())
   {
-    if (allowclose) ::fclose(fp);
+#ifdef TARGET_OS_UNIXBSD
+    if (fp && reserved)
+    {
+      struct stat st;
+
+      // release reserved space beyond the end of the file
+      ::fflush(fp);
+      if ((fstat(fileno(fp), &st) == 0) && (st.st_size < reserved) && (ftruncate(fileno(fp), st.st_size) != 0))
+      {
+        BBCERROR("Failed to release reserved space of '%s': %s", filename.c_str(), strerror(errno));
+      }
+    }
+#endif
+    reserved = 0;
+
+    if (fp && allowclose) ::fclose(fp);
     fp         = NULL;
     allowclose = false;
 
+    // release this object's reference to the mapping (the last one unmaps the file)
+    mapping = NULL;
+    mappos  = 0;
+
     filename = "";
     mode     = "";
   }
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Reserve disk space for the file without changing its length
+ *
+ * @param size number of bytes from the start of the file to reserve
+ *
+ * @return true if the space is reserved
+ *
+ * @note any reserved space beyond the end of the file is released by fclose()
+ */
+/*--------------------------------------------------------------------------------*/
+bool EnhancedFile::reserve(off_t size)
+{
+  bool success = false;
+
+  if (fp && !mapping)
+  {
+    if (size <= reserved) success = true;
+    else
+    {
+#if defined(TARGET_OS_UNIXBSD) && defined(FALLOC_FL_KEEP_SIZE)
+      // allocate extents beyond the end of the file without changing the length of the file
+      if (fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, reserved, size - reserved) == 0)
+      {
+        BBCDEBUG3(("Reserved %s bytes for '%s'", StringFrom(size).c_str(), filename.c_str()));
+        reserved = size;
+        success  = true;
+      }
+      else BBCDEBUG1(("Failed to reserve %s bytes for '%s': %s", StringFrom(size).c_str(), filename.c_str(), strerror(errno)));
+#else
+      BBCDEBUG1(("Reserving space for files is not supported on this platform"));
+#endif
+    }
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Flush buffered data and wait until the file's data is on the disk (fdatasync())
+ *
+ * @return 0 on success
+ */
+/*--------------------------------------------------------------------------------*/
+int EnhancedFile::fsync()
+{
+  int res = -1;
+
+  // mapped files are read-only
+  if (mapping) res = 0;
+  else if (fp && ((res = ::fflush(fp)) == 0))
+  {
+#if defined(TARGET_OS_UNIXBSD) && defined(__APPLE__)
+    res = ::fsync(fileno(fp));
+#elif defined(TARGET_OS_UNIXBSD)
+    // only the data (and the metadata needed to read it) needs to reach the disk
+    res = ::fdatasync(fileno(fp));
+#elif defined(COMPILER_MSVC)
+    res = _commit(_fileno(fp));
+#endif
+    if (res) BBCERROR("Failed to sync '%s' to disk: %s", filename.c_str(), strerror(errno));
+  }
+
+  return res;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set the length of the file
+ *
+ * @param size new length of the file in bytes
+ *
+ * @return true if the file was truncated (or extended)
+ *
+ * @note the file position is not changed
+ */
+/*--------------------------------------------------------------------------------*/
+bool EnhancedFile::truncate(off_t size)
+{
+  bool success = false;
+
+  if (fp && !mapping && (::fflush(fp) == 0))
+  {
+#ifdef TARGET_OS_UNIXBSD
+    success = (ftruncate(fileno(fp), size) == 0);
+#elif defined(COMPILER_MSVC)
+    success = (_chsize_s(_fileno(fp), size) == 0);
+#endif
+    if (success)
+    {
+      // any reservation beyond the new end of the file has gone
+      reserved = std::min(reserved, size);
+      BBCDEBUG3(("Truncated '%s' to %s bytes", filename.c_str(), StringFrom(size).c_str()));
+    }
+    else BBCERROR("Failed to truncate '%s' to %s bytes: %s", filename.c_str(), StringFrom(size).c_str(), strerror(errno));
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Map the open file into memory
+ *
+ * @return true if the file was mapped
+ *
+ * @note on success, the FILE handle is closed since all access is through the mapping
+ */
+/*--------------------------------------------------------------------------------*/
+bool EnhancedFile::MapFile()
+{
+  bool success = false;
+
+#ifdef TARGET_OS_UNIXBSD
+  struct stat st;
+
+  if (fstat(fileno(fp), &st) == 0)
+  {
+    const uint8_t *data = NULL;
+    size_t        size  = (size_t)st.st_size;
+    void          *p;
+
+    // an empty file cannot be mapped but needs no data
+    if (!size || ((p = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(fp), 0)) != MAP_FAILED))
+    {
+      if (size)
+      {
+        data = (const uint8_t *)p;
+        // the mapping is usually read sequentially
+        madvise(p, size, MADV_SEQUENTIAL);
+      }
+
+      BBCDEBUG2(("Mapped %s bytes of '%s'", StringFrom(size).c_str(), filename.c_str()));
+
+      // position in mapping starts where the file is
+      mappos  = ftell();
+      mapping = new Mapping(data, size);
+
+      // file handle no longer required
+      if (allowclose) ::fclose(fp);
+      fp         = NULL;
+      allowclose = false;
+
+      success = true;
+    }
+    else BBCERROR("Failed to map '%s' (%s)", filename.c_str(), strerror(errno));
+  }
+  else BBCERROR("Failed to stat '%s' (%s)", filename.c_str(), strerror(errno));
+#endif
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Unmap file
+ */
+/*--------------------------------------------------------------------------------*/
+EnhancedFile::Mapping::~Mapping()
+{
+#ifdef TARGET_OS_UNIXBSD
+  if (data) munmap((void *)data, size);
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return pointer to a region of a memory mapped file without copying
+ *
+ * @param offset offset of region in file
+ * @param len length of region in bytes
+ *
+ * @return pointer to data or NULL if the file is not mapped or the region is not entirely within the file
+ *
+ * @note the pointer is valid until the file (and all its duplicates) are closed
+ */
+/*--------------------------------------------------------------------------------*/
+const uint8_t *EnhancedFile::GetMappedRegion(off_t offset, size_t len) const
+{
+  const uint8_t *p = NULL;
+
+  if (mapping && (offset >= 0) && ((size_t)offset <= mapping.Obj()->size) && (len <= (mapping.Obj()->size - (size_t)offset)))
+  {
+    p = mapping.Obj()->data + offset;
+  }
+
+  return p;
+}
+
+size_t EnhancedFile::fread(void *ptr, size_t size, size_t count)
+{
+  if (mapping)
+  {
+    // whole items only, as fread()
+    size_t avail = ((mappos >= 0) && ((size_t)mappos < mapping.Obj()->size)) ? mapping.Obj()->size - (size_t)mappos : 0;
+
+    count = size ? std::min(count, avail / size) : 0;
+    if (count)
+    {
+      memcpy(ptr, mapping.Obj()->data + mappos, size * count);
+      mappos += size * count;
+    }
+
+    return count;
+  }
+
+  return ::fread(ptr, size, count, fp);
+}
+
 off_t EnhancedFile::ftell() const
 {
+  if (mapping) return mappos;
 #ifdef COMPILER_MSVC
   return ::_ftelli64(fp);
 #else  
@@ -121,6 +391,7 @@ off_t EnhancedFile::ftell() const
 
 off_t EnhancedFile::ftell()
 {
+  if (mapping) return mappos;
 #ifdef COMPILER_MSVC
   return ::_ftelli64(fp);
 #else  
@@ -130,6 +401,22 @@ off_t EnhancedFile::ftell()
 
 int EnhancedFile::fseek(off_t offset, int origin)
 {
+  if (mapping)
+  {
+    if      (origin == SEEK_CUR) offset += mappos;
+    else if (origin == SEEK_END) offset += (off_t)mapping.Obj()->size;
+
+    if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    // like fseek(), seeking beyond the end is allowed (subsequent reads return nothing)
+    mappos = offset;
+    return 0;
+  }
+
 #ifdef COMPILER_MSVC
   return ::_fseeki64(fp, offset, origin);
 #else  
@@ -161,6 +448,146 @@ int EnhancedFile::vfprintf(const char *fmt, va_list ap)
   return res;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Write a list of buffers to the file at the current position using a single system call (where possible)
+ *
+ * @param iov list of buffers
+ * @param n number of buffers in list
+ *
+ * @return number of bytes written
+ */
+/*--------------------------------------------------------------------------------*/
+size_t EnhancedFile::writev(const IOVEC *iov, uint_t n)
+{
+  sint64_t res = 0;
+
+  if (fp && ((res = TransferV(iov, n, true)) < 0))
+  {
+    uint_t i;
+
+    // fall back to individual writes
+    for (i = res = 0; i < n; i++)
+    {
+      size_t nbytes = ::fwrite(iov[i].data, 1, iov[i].size, fp);
+      res += nbytes;
+      if (nbytes < iov[i].size) break;
+    }
+  }
+
+  return (size_t)res;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read from the file at the current position into a list of buffers using a single system call (where possible)
+ *
+ * @param iov list of buffers
+ * @param n number of buffers in list
+ *
+ * @return number of bytes read
+ */
+/*--------------------------------------------------------------------------------*/
+size_t EnhancedFile::readv(const IOVEC *iov, uint_t n)
+{
+  sint64_t res = 0;
+  uint_t   i;
+
+  if (mapping)
+  {
+    // mapped files are read by copying from the mapping
+    for (i = 0; i < n; i++)
+    {
+      size_t nbytes = EnhancedFile::fread(iov[i].data, 1, iov[i].size);
+      res += nbytes;
+      if (nbytes < iov[i].size) break;
+    }
+  }
+  else if (fp && ((res = TransferV(iov, n, false)) < 0))
+  {
+    // fall back to individual reads
+    for (i = res = 0; i < n; i++)
+    {
+      size_t nbytes = ::fread(iov[i].data, 1, iov[i].size, fp);
+      res += nbytes;
+      if (nbytes < iov[i].size) break;
+    }
+  }
+
+  return (size_t)res;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Perform readv()/writev() on the underlying file descriptor
+ *
+ * @return number of bytes transferred or -1 if not supported
+ */
+/*--------------------------------------------------------------------------------*/
+sint64_t EnhancedFile::TransferV(const IOVEC *iov, uint_t n, bool write)
+{
+  sint64_t res = -1;
+
+#ifdef TARGET_OS_UNIXBSD
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+  off_t pos;
+
+  // the descriptor is accessed directly so stdio's buffer must be flushed (or discarded
+  // for reading) and the descriptor moved to the stream's position
+  if (((pos = EnhancedFile::ftell()) >= 0) && (::fflush(fp) == 0) && (lseek(fileno(fp), pos, SEEK_SET) >= 0))
+  {
+    std::vector<struct iovec> vec(n);
+    uint_t i;
+
+    for (i = 0; i < n; i++)
+    {
+      vec[i].iov_base = iov[i].data;
+      vec[i].iov_len  = iov[i].size;
+    }
+
+    // loop to handle partial transfers and lists longer than IOV_MAX
+    for (i = res = 0; i < n;)
+    {
+      ssize_t nbytes;
+
+      if (!vec[i].iov_len)
+      {
+        i++;
+        continue;
+      }
+
+      nbytes = write ? ::writev(fileno(fp), &vec[i], std::min(n - i, (uint_t)IOV_MAX)) : ::readv(fileno(fp), &vec[i], std::min(n - i, (uint_t)IOV_MAX));
+      if (nbytes < 0)
+      {
+        if (errno == EINTR) continue;
+        BBCERROR("Failed to %s %s buffers for '%s' (%s)", write ? "write" : "read", StringFrom(n - i).c_str(), filename.c_str(), strerror(errno));
+        break;
+      }
+      // end of file
+      if (!nbytes) break;
+
+      res += nbytes;
+
+      // skip buffers that have been completely transferred and adjust the partially transferred one
+      for (; (i < n) && ((size_t)nbytes >= vec[i].iov_len); i++) nbytes -= vec[i].iov_len;
+      if (i < n)
+      {
+        vec[i].iov_base = (uint8_t *)vec[i].iov_base + nbytes;
+        vec[i].iov_len -= nbytes;
+      }
+    }
+
+    // move stream to the descriptor's new position (which allows for append mode)
+    if ((pos = lseek(fileno(fp), 0, SEEK_CUR)) >= 0) EnhancedFile::fseek(pos, SEEK_SET);
+  }
+#else
+  UNUSED_PARAMETER(iov);
+  UNUSED_PARAMETER(n);
+  UNUSED_PARAMETER(write);
+#endif
+
+  return res;
+}
+
 /*--------------------------------------------------------------------------------*/
 /** Read a line of text from an open file
  *
@@ -174,7 +601,33 @@ int EnhancedFile::readline(char *line, uint_t maxlen)
 {
   int l = EOF;
 
-  if (fp)
+  if (mapping)
+  {
+    const uint8_t *p   = mapping.Obj()->data + std::min((size_t)std::max(mappos, (off_t)0), mapping.Obj()->size);
+    const uint8_t *end = mapping.Obj()->data + mapping.Obj()->size;
+    const uint8_t *nl  = (p < end) ? (const uint8_t *)memchr(p, '\n', end - p) : NULL;
+    const uint8_t *eol = nl ? nl : end;
+    uint_t i;
+
+    // reduce buffer space by one for terminator
+    maxlen--;
+
+    // copy characters up to the linefeed, ignoring overspill characters and carriage-returns
+    for (i = 0; p < eol; p++)
+    {
+      if ((i < maxlen) && (*p != '\r')) line[i++] = *p;
+    }
+
+    // add terminator
+    line[i] = 0;
+
+    // move past linefeed
+    mappos = (eol - mapping.Obj()->data) + (nl ? 1 : 0);
+
+    // same return as below: EOF only if no characters stored and there was no linefeed
+    l = (i || nl) ? i : EOF;
+  }
+  else if (fp)
   {
     uint_t i;
     int    c;   // characters read as int to allow EOF to be detected
@@ -182,13 +635,26 @@ int EnhancedFile::readline(char *line, uint_t maxlen)
     // reduce buffer space by one for terminator
     maxlen--;
 
+#ifdef TARGET_OS_UNIXBSD
+    // lock the stream once for the whole line rather than for every character
+    flockfile(fp);
+#define READLINE_GETC getc_unlocked
+#else
+#define READLINE_GETC fgetc
+#endif
+
     // loop reading characters until EOF or no more space or linefeed character read
-    for (i = 0; ((c = fgetc(fp)) != EOF) && (c != '\n');)
+    for (i = 0; ((c = READLINE_GETC(fp)) != EOF) && (c != '\n');)
     {
       // ignore overspill characters carriage-returns
       if ((i < maxlen) && (c != '\r')) line[i++] = c;
     }
 
+#undef READLINE_GETC
+#ifdef TARGET_OS_UNIXBSD
+    funlockfile(fp);
+#endif
+
     // add terminator
     line[i] = 0;
 
@@ -16,6 +16,12 @@ typedef sint64_t off_t;
 
 /*--------------------------------------------------------------------------------*/
 /** Class mimicking FILE functions but which keeps the filename and open mode allowing duplication 
+ *
+ * Adding 'm' to a read-only open mode (e.g. "rbm") maps the whole file into memory:
+ * fread(), fseek(), ftell() and readline() then operate directly on the mapping,
+ * GetMappedRegion() gives zero-copy access to the data and duplicates share the
+ * mapping instead of opening the file again.  If the file cannot be mapped, it is
+ * accessed normally
  */
 /*--------------------------------------------------------------------------------*/
 class EnhancedFile : public RefCountedObject
@@ -47,21 +53,53 @@ public:
    */
   /*--------------------------------------------------------------------------------*/
   virtual bool   fopen(const char *filename, const char *mode = "rb");
-  bool           isopen() const {return (fp != NULL);}
+  bool           isopen() const {return ((fp != NULL) || (mapping != NULL));}
   virtual void   fclose();
 
-  virtual size_t fread(void *ptr, size_t size, size_t count)        {return ::fread(ptr, size, count, fp);}
-  virtual size_t fwrite(const void *ptr, size_t size, size_t count) {return ::fwrite(ptr, size, count, fp);}
+  virtual size_t fread(void *ptr, size_t size, size_t count);
+  virtual size_t fwrite(const void *ptr, size_t size, size_t count) {return mapping ? 0 : ::fwrite(ptr, size, count, fp);}
   virtual off_t  ftell() const;
   virtual off_t  ftell();
   virtual int    fseek(off_t offset, int origin);
-  virtual int    ferror() const {return ::ferror(fp);}
-  virtual int    fflush() {return ::fflush(fp);}
-  virtual void   rewind() {::rewind(fp);}
+  virtual int    ferror() const {return mapping ? 0 : ::ferror(fp);}
+  virtual int    fflush() {return mapping ? 0 : ::fflush(fp);}
+  virtual void   rewind() {if (mapping) mappos = 0; else ::rewind(fp);}
 
   virtual int    fprintf(const char *fmt, ...) PRINTF_FORMAT2;
   virtual int    vfprintf(const char *fmt, va_list ap);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Scatter/gather element (mirrors struct iovec)
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    void   *data;
+    size_t size;
+  } IOVEC;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write a list of buffers to the file at the current position using a single system call (where possible)
+   *
+   * @param iov list of buffers
+   * @param n number of buffers in list
+   *
+   * @return number of bytes written
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual size_t writev(const IOVEC *iov, uint_t n);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read from the file at the current position into a list of buffers using a single system call (where possible)
+   *
+   * @param iov list of buffers
+   * @param n number of buffers in list
+   *
+   * @return number of bytes read
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual size_t readv(const IOVEC *iov, uint_t n);
+
   /*--------------------------------------------------------------------------------*/
   /** Read a line of text from an open file
    *
@@ -71,10 +109,68 @@ public:
    * @return number of chracters in buffer (excluding terminator), EOF on end of file (with no characters stored)
    */
   /*--------------------------------------------------------------------------------*/
-  int readline(char *line, uint_t maxlen);
+  virtual int readline(char *line, uint_t maxlen);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reserve disk space for the file without changing its length
+   *
+   * @param size number of bytes from the start of the file to reserve
+   *
+   * @return true if the space is reserved
+   *
+   * @note any reserved space beyond the end of the file is released by fclose()
+   * @note only supported where space can be reserved without extending the file (Linux)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool reserve(off_t size);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Flush buffered data and wait until the file's data is on the disk (fdatasync())
+   *
+   * @return 0 on success
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual int fsync();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set the length of the file
+   *
+   * @param size new length of the file in bytes
+   *
+   * @return true if the file was truncated (or extended)
+   *
+   * @note the file position is not changed
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool truncate(off_t size);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of bytes reserved by reserve()
+   */
+  /*--------------------------------------------------------------------------------*/
+  off_t getreserved() const {return reserved;}
 
   const std::string& getfilename() const {return filename;}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the file is memory mapped
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ismapped() const {return (mapping != NULL);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return pointer to a region of a memory mapped file without copying
+   *
+   * @param offset offset of region in file
+   * @param len length of region in bytes
+   *
+   * @return pointer to data or NULL if the file is not mapped or the region is not entirely within the file
+   *
+   * @note the pointer is valid until the file (and all its duplicates) are closed
+   */
+  /*--------------------------------------------------------------------------------*/
+  const uint8_t *GetMappedRegion(off_t offset, size_t len) const;
+
   /*--------------------------------------------------------------------------------*/
   /** Return whether a file exists
    */
@@ -88,10 +184,48 @@ public:
   static std::string catpath(const std::string& dir1, const std::string& dir2);
 
 protected:
-  std::string filename;
-  std::string mode;
-  FILE        *fp;
-  bool        allowclose;
+  /*--------------------------------------------------------------------------------*/
+  /** Read-only memory mapping of a file, shared between duplicates
+   */
+  /*--------------------------------------------------------------------------------*/
+  class Mapping : public RefCountedObject
+  {
+  public:
+    Mapping(const uint8_t *_data, size_t _size) : RefCountedObject(),
+                                                  data(_data),
+                                                  size(_size) {}
+    virtual ~Mapping();
+
+    const uint8_t *data;
+    size_t        size;
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Map the open file into memory
+   *
+   * @return true if the file was mapped
+   *
+   * @note on success, the FILE handle is closed since all access is through the mapping
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool MapFile();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Perform readv()/writev() on the underlying file descriptor
+   *
+   * @return number of bytes transferred or -1 if not supported
+   */
+  /*--------------------------------------------------------------------------------*/
+  sint64_t TransferV(const IOVEC *iov, uint_t n, bool write);
+
+protected:
+  std::string       filename;
+  std::string       mode;
+  FILE              *fp;
+  bool              allowclose;
+  RefCount<Mapping> mapping;
+  off_t             mappos;     ///< read position within mapping
+  off_t             reserved;   ///< disk space reserved by reserve()
 };
 
 BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,434 @@
+
+#include <string.h>
+#include <errno.h>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define BBCDEBUG_LEVEL 1
+#include "JournalFile.h"
+#include "ByteSwap.h"
+#include "CRC32C.h"
+
+BBC_AUDIOTOOLBOX_START
+
+const uint8_t JournalFile::Signature[8] = {'B', 'B', 'C', 'J', 'R', 'N', 'L', '1'};
+const size_t  JournalFile::MaxRecordSize = 64 << 20;
+const uint_t  JournalFile::DefaultCommitLatency = 20;
+
+/*--------------------------------------------------------------------------------*/
+/** Make sure a newly created file's directory entry is on the disk
+ */
+/*--------------------------------------------------------------------------------*/
+static void SyncDirectory(const char *filename)
+{
+#ifdef TARGET_OS_UNIXBSD
+  std::string dir = filename;
+  size_t      p   = dir.rfind('/');
+  int         fd;
+
+  if      (p == std::string::npos) dir = ".";
+  else if (p == 0)                 dir = "/";
+  else                             dir = dir.substr(0, p);
+
+  if ((fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC)) >= 0)
+  {
+    if (::fsync(fd) != 0) BBCERROR("Failed to sync directory '%s': %s", dir.c_str(), strerror(errno));
+    close(fd);
+  }
+#else
+  UNUSED_PARAMETER(filename);
+#endif
+}
+
+JournalFile::JournalFile() : latency(DefaultCommitLatency),
+                             appended(0),
+                             durable(0),
+                             commits(0),
+                             pendingtime(0),
+                             synctime(0),
+                             failed(false)
+{
+  memset(&recovery, 0, sizeof(recovery));
+}
+
+JournalFile::~JournalFile()
+{
+  Close();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open a journal for appending, creating it if necessary
+ *
+ * @param filename journal filename
+ *
+ * @return true if the journal is open
+ *
+ * @note an existing journal is recovered to its last valid record (see GetRecovery())
+ */
+/*--------------------------------------------------------------------------------*/
+bool JournalFile::Open(const char *filename)
+{
+  bool created = false;
+
+  Close();
+
+  memset(&recovery, 0, sizeof(recovery));
+  appended = durable = commits = 0;
+  failed   = false;
+
+  // open existing journal without truncating it
+  if (!file.fopen(filename, "rb+"))
+  {
+    if (!file.fopen(filename, "wb+"))
+    {
+      BBCERROR("Failed to open journal '%s': %s", filename, strerror(errno));
+      return false;
+    }
+    created = true;
+  }
+
+  if (!CheckSignature(file, true))
+  {
+    BBCERROR("'%s' is not a journal", filename);
+    file.fclose();
+    return false;
+  }
+
+  if (created) SyncDirectory(filename);
+
+  // scan existing records using read ahead
+  file.EnableReadAhead();
+  Scan(file, NULL, NULL, recovery);
+  file.EnableReadAhead(false);
+
+  if (recovery.discardedbytes)
+  {
+    BBCDEBUG1(("Discarding %s bytes after last valid record (%s records) of '%s'", StringFrom(recovery.discardedbytes).c_str(), StringFrom(recovery.records).c_str(), filename));
+
+    // the partial record must be gone before new records are appended after it
+    if (!file.truncate(recovery.validbytes) || (file.fsync() != 0))
+    {
+      BBCERROR("Failed to recover journal '%s'", filename);
+      file.fclose();
+      return false;
+    }
+  }
+
+  if (file.fseek(recovery.validbytes, SEEK_SET) != 0)
+  {
+    BBCERROR("Failed to seek to end of journal '%s': %s", filename, strerror(errno));
+    file.fclose();
+    return false;
+  }
+
+  file.EnableBackground();
+
+  if (!thread.Start(&__CommitStart, (void *)this)) BBCERROR("Failed to start commit thread for journal '%s', records will be committed by Sync() only", filename);
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Commit all appended records and close journal
+ */
+/*--------------------------------------------------------------------------------*/
+void JournalFile::Close()
+{
+  if (thread.IsRunning())
+  {
+    // tell thread to quit, wake it up and wait for it to finish
+    thread.Stop(false);
+    wake.Signal();
+    thread.Stop();
+  }
+
+  if (file.isopen())
+  {
+    if (!Sync()) BBCERROR("Failed to commit journal '%s' on close", file.getfilename().c_str());
+    file.fclose();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set the maximum time between a record being appended and it being durable
+ *
+ * @param latency commit latency in ms (0 to commit each record before Append() returns)
+ */
+/*--------------------------------------------------------------------------------*/
+void JournalFile::SetCommitLatency(uint_t _latency)
+{
+  latency = _latency;
+  wake.Signal();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Append a record to the journal
+ *
+ * @param data record data
+ * @param bytes number of bytes in record (up to MaxRecordSize)
+ *
+ * @return sequence number of record (1 for the first record appended after opening) or 0 on failure
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t JournalFile::Append(const void *data, size_t bytes)
+{
+  EnhancedFile::IOVEC iov[2];
+  uint32_t            header[2];
+  uint64_t            seq = 0;
+
+  if (bytes > MaxRecordSize)
+  {
+    BBCERROR("Journal record of %s bytes is too large", StringFrom(bytes).c_str());
+    return 0;
+  }
+
+  // the CRC covers the length so that a corrupt length is detected
+  header[0] = (uint32_t)bytes;
+  ByteSwap(header[0], SWAP_FOR_LE);
+  header[1] = CRC32C(data, bytes, CRC32C(&header[0], sizeof(header[0])));
+  ByteSwap(header[1], SWAP_FOR_LE);
+
+  iov[0].data = header;
+  iov[0].size = sizeof(header);
+  iov[1].data = (void *)data;
+  iov[1].size = bytes;
+
+  {
+    ThreadLock lock(filelock);
+
+    if (file.isopen() && !failed)
+    {
+      if (file.writev(iov, NUMBEROF(iov)) == (sizeof(header) + bytes))
+      {
+        // start the commit latency from the first record that is not durable
+        if (appended == durable)
+        {
+          pendingtime = GetTickCount();
+          wake.Signal();
+        }
+
+        seq = ++appended;
+      }
+      else
+      {
+        BBCERROR("Failed to append %s bytes to journal '%s'", StringFrom(bytes).c_str(), file.getfilename().c_str());
+        failed = true;
+      }
+    }
+  }
+
+  if (seq && !latency && !Sync(seq)) seq = 0;
+
+  return seq;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Wait until a record (and all records before it) is durable
+ *
+ * @param seq sequence number returned by Append() or 0 for all records appended so far
+ *
+ * @return true if the record is on the disk
+ */
+/*--------------------------------------------------------------------------------*/
+bool JournalFile::Sync(uint64_t seq)
+{
+  if (!seq) seq = appended;
+  if (durable >= seq) return true;
+
+  ThreadLock lock(commitlock);
+
+  // whilst waiting for the lock, another thread's commit may have included this record
+  return ((durable >= seq) || (Commit() && (durable >= seq)));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Make all records appended so far durable
+ *
+ * @return true if they are on the disk
+ *
+ * @note commitlock MUST be held
+ */
+/*--------------------------------------------------------------------------------*/
+bool JournalFile::Commit()
+{
+  uint64_t target;
+  ulong_t  start;
+
+  {
+    ThreadLock lock(filelock);
+
+    target = appended;
+    if (failed || !file.isopen()) return false;
+    if (durable == target) return true;
+
+    // pass all queued blocks to the OS
+    start = GetTickCount();
+    file.WaitForWrites();
+  }
+
+  // records can be appended whilst waiting for the disk (they will be committed next time)
+  if (file.EnhancedFile::fsync() != 0)
+  {
+    BBCERROR("Failed to commit journal '%s'", file.getfilename().c_str());
+    failed = true;
+    return false;
+  }
+
+  synctime = GetTickCount() - start;
+  commits++;
+
+  {
+    ThreadLock lock(filelock);
+
+    durable = target;
+
+    // the records appended since have not been waiting longer than this commit
+    if (appended > durable) pendingtime = start;
+  }
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Group commit thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *JournalFile::CommitRun()
+{
+  // wait time when there is nothing to commit (thread is woken when records are appended or when stopping)
+  static const uint_t idletimeout = 1000;
+
+  while (!thread.StopRequested())
+  {
+    uint_t timeout = idletimeout;
+
+    if (latency && !failed && (appended > durable))
+    {
+      // commit early enough for the fsync() to complete within the latency
+      ulong_t budget = latency - std::min((ulong_t)synctime, (ulong_t)latency);
+      ulong_t age    = GetTickCount() - pendingtime;
+
+      if (age >= budget)
+      {
+        ThreadLock lock(commitlock);
+        Commit();
+        continue;
+      }
+
+      timeout = (uint_t)(budget - age);
+    }
+
+    wake.TimedWait(timeout);
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Check/write signature at the start of the file
+ *
+ * @param file open file positioned at the start
+ * @param create true to write the signature if the file is empty (or a crash left a partial signature)
+ *
+ * @return true if the file is a journal
+ */
+/*--------------------------------------------------------------------------------*/
+bool JournalFile::CheckSignature(EnhancedFile& file, bool create)
+{
+  uint8_t sig[sizeof(Signature)];
+  size_t  n = file.fread(sig, 1, sizeof(sig));
+
+  if (n == sizeof(sig)) return (memcmp(sig, Signature, sizeof(sig)) == 0);
+
+  // anything other than part of a signature is not a journal
+  if (!create || (memcmp(sig, Signature, n) != 0)) return false;
+
+  return ((file.fseek(0, SEEK_SET) == 0) &&
+          (file.fwrite(Signature, 1, sizeof(Signature)) == sizeof(Signature)) &&
+          (file.fsync() == 0));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read records from the current position until the end of the file or the first invalid record
+ */
+/*--------------------------------------------------------------------------------*/
+void JournalFile::Scan(EnhancedFile& file, RECORDHANDLER handler, void *context, SCAN_RESULT& result)
+{
+  std::vector<uint8_t> data;
+  uint32_t             header[2];
+  off_t                pos = file.ftell(), end;
+  bool                 stopped = false;
+
+  // the length of the file limits the length of valid records
+  file.fseek(0, SEEK_END);
+  end = file.ftell();
+  file.fseek(pos, SEEK_SET);
+
+  result.records = 0;
+
+  while (file.fread(header, 1, sizeof(header)) == sizeof(header))
+  {
+    uint32_t length = header[0], crc = header[1];
+
+    ByteSwap(length, SWAP_FOR_LE);
+    ByteSwap(crc, SWAP_FOR_LE);
+
+    if ((length > MaxRecordSize) || ((off_t)length > (end - pos - (off_t)sizeof(header)))) break;
+
+    if (data.size() < length) data.resize(length);
+    if (length && (file.fread(&data[0], 1, length) < length)) break;
+    if (CRC32C(data.empty() ? NULL : &data[0], length, CRC32C(&header[0], sizeof(header[0]))) != crc) break;
+
+    pos += sizeof(header) + length;
+    result.records++;
+
+    if (handler && !(*handler)(data.empty() ? NULL : &data[0], length, context))
+    {
+      stopped = true;
+      break;
+    }
+  }
+
+  result.validbytes     = pos;
+  result.discardedbytes = stopped ? 0 : end - pos;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read the valid records of a journal
+ *
+ * @param filename journal filename
+ * @param handler function to call for each record (or NULL to just scan)
+ * @param context context pointer for handler
+ * @param result optional structure to receive the result of the scan
+ *
+ * @return false if the file could not be opened or is not a journal
+ */
+/*--------------------------------------------------------------------------------*/
+bool JournalFile::Read(const char *filename, RECORDHANDLER handler, void *context, SCAN_RESULT *result)
+{
+  BackgroundFile file;
+  SCAN_RESULT    res;
+  bool           success = false;
+
+  if (file.fopen(filename, "rb"))
+  {
+    if (CheckSignature(file, false))
+    {
+      file.EnableReadAhead();
+      Scan(file, handler, context, res);
+      if (result) *result = res;
+      success = true;
+    }
+    else BBCERROR("'%s' is not a journal", filename);
+  }
+  else BBCERROR("Failed to open journal '%s': %s", filename, strerror(errno));
+
+  return success;
+}
+
+BBC_AUDIOTOOLBOX_END
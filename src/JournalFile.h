@@ -0,0 +1,201 @@
+#ifndef __JOURNAL_FILE__
+#define __JOURNAL_FILE__
+
+#include <atomic>
+
+#include "BackgroundFile.h"
+#include "ThreadLock.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Crash-safe, append-only file of records (e.g. automation or metadata streams logged
+ * alongside audio)
+ *
+ * Records are written using a BackgroundFile and each is framed by its length and a
+ * CRC-32C of the length and data:
+ *
+ *   file:   signature (8 bytes) record record ...
+ *   record: length (uint32 LE) crc (uint32 LE) data (length bytes)
+ *
+ * Appended records are made durable (written and fdatasync()'d) in batches ('group
+ * commits') by a background thread so that each record is on the disk no later than
+ * the commit latency after it was appended, without an fsync() per record.  Sync() can
+ * be used to wait until a record is durable (any records appended by other threads up
+ * to then are committed by the same fsync())
+ *
+ * When an existing journal is opened, it is scanned (using read ahead) and anything
+ * after the last valid record (e.g. a partially written record or garbage left by a
+ * crash) is removed before new records are appended
+ *
+ * Append() and Sync() may be called from any number of threads
+ */
+/*--------------------------------------------------------------------------------*/
+class JournalFile
+{
+public:
+  JournalFile();
+  virtual ~JournalFile();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Result of scanning a journal
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    uint64_t records;           ///< number of valid records
+    off_t    validbytes;        ///< length of journal up to the end of the last valid record
+    off_t    discardedbytes;    ///< number of bytes after the last valid record
+  } SCAN_RESULT;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open a journal for appending, creating it if necessary
+   *
+   * @param filename journal filename
+   *
+   * @return true if the journal is open
+   *
+   * @note an existing journal is recovered to its last valid record (see GetRecovery())
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool Open(const char *filename);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Commit all appended records and close journal
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void Close();
+
+  bool IsOpen() const {return file.isopen();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return the result of scanning the journal when it was opened
+   */
+  /*--------------------------------------------------------------------------------*/
+  const SCAN_RESULT& GetRecovery() const {return recovery;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set the maximum time between a record being appended and it being durable
+   *
+   * @param latency commit latency in ms (0 to commit each record before Append() returns)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetCommitLatency(uint_t latency);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Append a record to the journal
+   *
+   * @param data record data
+   * @param bytes number of bytes in record (up to MaxRecordSize)
+   *
+   * @return sequence number of record (1 for the first record appended after opening) or 0 on failure
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint64_t Append(const void *data, size_t bytes);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until a record (and all records before it) is durable
+   *
+   * @param seq sequence number returned by Append() or 0 for all records appended so far
+   *
+   * @return true if the record is on the disk
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool Sync(uint64_t seq = 0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return sequence number of last record appended/made durable
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetAppendedSequence() const {return appended.load();}
+  uint64_t GetDurableSequence() const {return durable.load();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of commits (fsync()'s) made since opening
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetCommitCount() const {return commits.load();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Callback for each valid record of a journal
+   *
+   * @return false to stop reading
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef bool (*RECORDHANDLER)(const uint8_t *data, size_t bytes, void *context);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read the valid records of a journal
+   *
+   * @param filename journal filename
+   * @param handler function to call for each record (or NULL to just scan)
+   * @param context context pointer for handler
+   * @param result optional structure to receive the result of the scan
+   *
+   * @return false if the file could not be opened or is not a journal
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool Read(const char *filename, RECORDHANDLER handler, void *context = NULL, SCAN_RESULT *result = NULL);
+
+  static const uint8_t Signature[8];
+  static const size_t  MaxRecordSize;
+  static const uint_t  DefaultCommitLatency;
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Check/write signature at the start of the file
+   *
+   * @param file open file positioned at the start
+   * @param create true to write the signature if the file is empty (or a crash left a partial signature)
+   *
+   * @return true if the file is a journal
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool CheckSignature(EnhancedFile& file, bool create);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read records from the current position until the end of the file or the first invalid record
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void Scan(EnhancedFile& file, RECORDHANDLER handler, void *context, SCAN_RESULT& result);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Make all records appended so far durable
+   *
+   * @return true if they are on the disk
+   *
+   * @note commitlock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool Commit();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Group commit thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__CommitStart(Thread& thread, void *arg)
+  {
+    UNUSED_PARAMETER(thread);
+    return ((JournalFile *)arg)->CommitRun();
+  }
+  virtual void *CommitRun();
+
+protected:
+  BackgroundFile         file;
+  ThreadLockObject       filelock;      ///< protects file and appended
+  ThreadLockObject       commitlock;    ///< held whilst committing
+  Thread                 thread;
+  ThreadBoolSignalObject wake;          ///< wakes the commit thread
+  SCAN_RESULT            recovery;
+  std::atomic<uint_t>    latency;
+  std::atomic<uint64_t>  appended;      ///< sequence number of last record appended
+  std::atomic<uint64_t>  durable;       ///< sequence number of last record on the disk
+  std::atomic<uint64_t>  commits;
+  std::atomic<ulong_t>   pendingtime;   ///< tick count when the oldest record that is not durable was appended
+  std::atomic<ulong_t>   synctime;      ///< time taken by the last fsync() in ms
+  std::atomic<bool>      failed;        ///< true once writing or syncing has failed
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
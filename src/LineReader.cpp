@@ -0,0 +1,127 @@
+
+#include <string.h>
+
+#define BBCDEBUG_LEVEL 1
+#include "LineReader.h"
+
+BBC_AUDIOTOOLBOX_START
+
+const size_t LineReader::DefaultMaxLineLength = 4096;
+const size_t LineReader::DefaultBufferSize    = 65536;
+
+LineReader::LineReader(EnhancedFile& _file, size_t _maxlinelength, size_t buffersize) : file(_file),
+                                                                                         maxlinelength(std::max(_maxlinelength, (size_t)1)),
+                                                                                         pos(0),
+                                                                                         fill(0),
+                                                                                         linenumber(0),
+                                                                                         eof(false),
+                                                                                         discarding(false)
+{
+  // the buffer must be able to hold a maximum length line and its linefeed
+  buffer.resize(std::max(buffersize, maxlinelength + 1));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Move unread data to the start of the buffer and fill the rest from the file
+ *
+ * @return false if no more data could be read
+ */
+/*--------------------------------------------------------------------------------*/
+bool LineReader::Fill()
+{
+  size_t n = 0;
+
+  if (!eof)
+  {
+    char *p, *q, *e;
+
+    if (pos)
+    {
+      memmove(&buffer[0], &buffer[pos], fill - pos);
+      fill -= pos;
+      pos  = 0;
+    }
+
+    if ((n = file.fread(&buffer[fill], 1, buffer.size() - fill)) == 0) eof = true;
+
+    // remove carriage-returns from the new data (the copy is skipped until the first one)
+    p = &buffer[fill];
+    e = p + n;
+    if ((q = (char *)memchr(p, '\r', n)) != NULL)
+    {
+      for (p = q; p < e; p++)
+      {
+        if (*p != '\r') *q++ = *p;
+      }
+      n = q - &buffer[fill];
+    }
+
+    fill += n;
+  }
+
+  return (n > 0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read next line
+ *
+ * @param line object to receive line
+ *
+ * @return true if a line has been read, false at the end of the file
+ */
+/*--------------------------------------------------------------------------------*/
+bool LineReader::ReadLine(Line& line)
+{
+  while (true)
+  {
+    const char *p  = &buffer[0] + pos;
+    const char *nl = (const char *)memchr(p, '\n', fill - pos);
+
+    if (nl)
+    {
+      pos = (nl + 1) - &buffer[0];
+
+      // the end of an overlong line has been found
+      if (discarding)
+      {
+        discarding = false;
+        continue;
+      }
+
+      line.data   = p;
+      line.length = std::min((size_t)(nl - p), maxlinelength);
+      linenumber++;
+      return true;
+    }
+
+    if (!discarding && ((fill - pos) >= maxlinelength))
+    {
+      // overlong line: return what fits and discard the rest up to the next linefeed
+      line.data   = p;
+      line.length = maxlinelength;
+      pos         = fill;
+      discarding  = true;
+      linenumber++;
+      return true;
+    }
+
+    if (discarding) pos = fill;
+
+    if (!Fill())
+    {
+      // last line without linefeed
+      if (!discarding && (fill > pos))
+      {
+        line.data   = &buffer[0] + pos;
+        line.length = fill - pos;
+        pos         = fill;
+        linenumber++;
+        return true;
+      }
+
+      return false;
+    }
+  }
+}
+
+BBC_AUDIOTOOLBOX_END
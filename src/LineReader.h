@@ -0,0 +1,128 @@
+#ifndef __LINE_READER__
+#define __LINE_READER__
+
+#include <iterator>
+#include <vector>
+
+#include "EnhancedFile.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Block-buffered line reader for EnhancedFile
+ *
+ * Reads the file in large blocks and finds lines using memchr() so that text files can
+ * be parsed quickly without per-character reads and without any allocation per line.
+ * Each line is returned as a pointer into the reader's buffer (NOT terminated) which
+ * remains valid until the next line is read
+ *
+ * Lines follow the same rules as EnhancedFile::readline():
+ *  1. carriage-returns are removed (wherever they are in the line)
+ *  2. lines longer than the maximum line length are truncated and the rest of the line
+ *     is discarded
+ *  3. the last line of the file does not need a linefeed (but an empty last line is
+ *     not returned)
+ *
+ * Lines can be read using ReadLine() or by iterating:
+ *
+ *   LineReader reader(file);
+ *   for (LineReader::iterator it = reader.begin(); it != reader.end(); ++it) Process(it->str());
+ *
+ * @note the file is read from its current position and, after reading, the file position
+ * will be beyond the last line returned (the reader reads ahead)
+ */
+/*--------------------------------------------------------------------------------*/
+class LineReader
+{
+public:
+  LineReader(EnhancedFile& file, size_t maxlinelength = DefaultMaxLineLength, size_t buffersize = DefaultBufferSize);
+  virtual ~LineReader() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** A single line of text within the reader's buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  class Line
+  {
+  public:
+    Line() : data(NULL), length(0) {}
+
+    /*--------------------------------------------------------------------------------*/
+    /** Return line as a string (this allocates)
+     */
+    /*--------------------------------------------------------------------------------*/
+    std::string str() const {return std::string(data, length);}
+
+    const char *data;       ///< start of line (NOT terminated)
+    size_t     length;      ///< number of characters in line
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read next line
+   *
+   * @param line object to receive line
+   *
+   * @return true if a line has been read, false at the end of the file
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ReadLine(Line& line);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of lines read so far
+   */
+  /*--------------------------------------------------------------------------------*/
+  ulong_t GetLineNumber() const {return linenumber;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Input iterator over the lines of the file
+   *
+   * @note as with all input iterators, only one pass is possible
+   */
+  /*--------------------------------------------------------------------------------*/
+  class iterator : public std::iterator<std::input_iterator_tag, Line>
+  {
+  public:
+    iterator(LineReader *_reader = NULL) : reader(_reader) {++(*this);}
+
+    const Line& operator * () const {return line;}
+    const Line *operator -> () const {return &line;}
+
+    iterator& operator ++ () {if (reader && !reader->ReadLine(line)) reader = NULL; return *this;}
+
+    bool operator == (const iterator& obj) const {return (reader == obj.reader);}
+    bool operator != (const iterator& obj) const {return (reader != obj.reader);}
+
+  protected:
+    LineReader *reader;   ///< NULL at end of file
+    Line       line;
+  };
+
+  iterator begin() {return iterator(this);}
+  iterator end()   {return iterator();}
+
+  static const size_t DefaultMaxLineLength;
+  static const size_t DefaultBufferSize;
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Move unread data to the start of the buffer and fill the rest from the file
+   *
+   * @return false if no more data could be read
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Fill();
+
+protected:
+  EnhancedFile&     file;
+  std::vector<char> buffer;
+  size_t            maxlinelength;
+  size_t            pos;          ///< start of unread data in buffer
+  size_t            fill;         ///< end of data in buffer
+  ulong_t           linenumber;
+  bool              eof;          ///< true once the file has been read to the end
+  bool              discarding;   ///< true whilst discarding the rest of an overlong line
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -2,6 +2,8 @@
 #define __LOCK_FREE_BUFFER__
 
 #include <vector>
+#include <atomic>
+#include <algorithm>
 
 #include "misc.h"
 
@@ -22,36 +24,110 @@ BBC_AUDIOTOOLBOX_START
  * GetWriteBuffersAvailable() always returns number of buffers that can be written to
  * Write-ahead allows buffers to be written (but not committed) using GetWriteBuffer(<x>)
  *
+ * For block transfers:
+ * GetWriteSpans()/GetReadSpans() return up to two contiguous regions (before and after the wrap point)
+ * and Write()/Read() copy blocks of items in and out in (at most) two copies
+ *
  * Notes:
  *  1. to detect empty/full, *one* of the slots is unavailable (to detect the difference between empty and full)
+ *     UNLESS power-of-two mode is selected at construction, see below
+ *  2. this is a single-producer/single-consumer buffer: ONE thread may write (GetWriteBuffer()/IncrementWrite())
+ *     and ONE thread may read (GetReadBuffer()/IncrementRead()/Reset()) at the same time
+ *  3. the read and write positions are atomics: committing buffers uses release semantics and the
+ *     other side reads the position with acquire semantics so buffer contents are always visible
+ *     before the position that covers them
+ *  4. the read and write positions are kept on separate cache lines so that the reader and writer
+ *     do not contend for the same cache line
+ *  5. in power-of-two mode the capacity is rounded up to a power of two and the read and write
+ *     positions are free-running counters which are masked to index the buffer, this avoids
+ *     integer divisions on every access and means *all* slots can be used (the number of
+ *     occupied slots is simply wr - rd)
  */
 /*--------------------------------------------------------------------------------*/
 template<typename T>
 class LockFreeBuffer
 {
 public:
+  /*--------------------------------------------------------------------------------*/
+  /** A contiguous region of the buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    T      *data;
+    uint_t count;
+  } SPAN;
+
   /*--------------------------------------------------------------------------------*/
   /** Initialise the buffer
    *
-   * @note the buffer is initialised to one more than required because there must
-   * always be an unused item in the list
+   * @param l number of items required
+   * @param pow2 true to round capacity up to a power of two and use masked indexing
+   *
+   * @note when pow2 is false, the buffer is initialised to one more than required because
+   * there must always be an unused item in the list
+   */
+  /*--------------------------------------------------------------------------------*/
+  LockFreeBuffer(uint_t l = 0, bool pow2 = false) : mask(0),
+                                                    powerof2(false),
+                                                    rd(0),
+                                                    wr(0) {Allocate(l, pow2);}
+  /*--------------------------------------------------------------------------------*/
+  /** Copy constructor
+   *
+   * @note NOT thread safe: neither buffer must be in use
    */
   /*--------------------------------------------------------------------------------*/
-  LockFreeBuffer(uint_t l = 0) : buffer(l + 1),
-                                 rd(0),
-                                 wr(0) {}
+  LockFreeBuffer(const LockFreeBuffer& obj) : buffer(obj.buffer),
+                                              mask(obj.mask),
+                                              powerof2(obj.powerof2),
+                                              rd(obj.rd.load()),
+                                              wr(obj.wr.load()) {}
   virtual ~LockFreeBuffer() {}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Assignment operator
+   *
+   * @note NOT thread safe: neither buffer must be in use
+   */
+  /*--------------------------------------------------------------------------------*/
+  LockFreeBuffer& operator = (const LockFreeBuffer& obj)
+  {
+    if (&obj != this)
+    {
+      buffer   = obj.buffer;
+      mask     = obj.mask;
+      powerof2 = obj.powerof2;
+      rd.store(obj.rd.load());
+      wr.store(obj.wr.load());
+    }
+    return *this;
+  }
+
   /*--------------------------------------------------------------------------------*/
   /** Resize the buffer and reset the pointers
    *
    * @note the buffer is initialised to one more than required because there must
-   * always be an unused item in the list
+   * always be an unused item in the list (unless in power-of-two mode, which is retained)
    *
    * @note this will effectively empty the buffer
+   *
+   * @note NOT thread safe: neither reader nor writer must be using the buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Resize(uint_t l) {Allocate(l, IsPowerOfTwo()); rd.store(0); wr.store(0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the buffer is in power-of-two (masked indexing) mode
    */
   /*--------------------------------------------------------------------------------*/
-  void Resize(uint_t l) {buffer.resize(l + 1); rd = wr = 0;}
+  bool IsPowerOfTwo() const {return powerof2;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return maximum number of items that can be held in the buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Capacity() const {return IsPowerOfTwo() ? (uint_t)buffer.size() : (uint_t)buffer.size() - 1;}
 
   /*--------------------------------------------------------------------------------*/
   /** Return ptr to item at write position
@@ -60,19 +136,24 @@ public:
    *
    * @return ptr to data to write to or NULL if no free items available
    *
-   * @note this function deliberately prevents the last item before the read item
-   * from being used
+   * @note in modulo (non-power-of-two) mode this function deliberately prevents the
+   * last item before the read item from being used, in power-of-two mode every item can be used
    */
   /*--------------------------------------------------------------------------------*/
-  T *GetWriteBuffer(uint_t offset = 0) {return (offset < WriteBuffersAvailable()) ? &buffer[(wr + offset) % buffer.size()] : NULL;}
-  
+  T *GetWriteBuffer(uint_t offset = 0) {return (offset < WriteBuffersAvailable()) ? &buffer[Index(wr.load(std::memory_order_relaxed) + offset)] : NULL;}
+
   /*--------------------------------------------------------------------------------*/
   /** Return number of write buffers available
-   * 
+   *
    * @note number of write buffers = rd - wr - 1 but each subtraction requires addition of buffer size to prevent underflow
+   * @note in power-of-two mode, number of write buffers = size - (wr - rd) (unsigned wrap-around is harmless)
    */
   /*--------------------------------------------------------------------------------*/
-  uint_t WriteBuffersAvailable() const {return (uint_t)((rd + 2 * buffer.size() - wr - 1) % buffer.size());}
+  uint_t WriteBuffersAvailable() const
+  {
+    if (IsPowerOfTwo()) return (uint_t)buffer.size() - (wr.load(std::memory_order_relaxed) - rd.load(std::memory_order_acquire));
+    return (uint_t)((rd.load(std::memory_order_acquire) + 2 * buffer.size() - wr.load(std::memory_order_relaxed) - 1) % buffer.size());
+  }
 
   /*--------------------------------------------------------------------------------*/
   /** Increment the write pointer (after writing data, essentially committing buffers)
@@ -85,17 +166,22 @@ public:
   bool IncrementWrite(uint_t n = 1)
   {
     uint_t avail = WriteBuffersAvailable();
-    if ((n = std::min(n, avail)) > 0) {wr = (wr + n) % buffer.size(); return true;}
+    if ((n = std::min(n, avail)) > 0) {wr.store(Advance(wr.load(std::memory_order_relaxed), n), std::memory_order_release); return true;}
     return false;
   }
 
   /*--------------------------------------------------------------------------------*/
   /** Return how many occupied read buffers are available
-   * 
+   *
    * @note number of read buffers = wr - rd but the subtraction requires addition of buffer size to prevent underflow
+   * @note in power-of-two mode, no addition is required (unsigned wrap-around is harmless)
    */
   /*--------------------------------------------------------------------------------*/
-  uint_t ReadBuffersAvailable() const {return (uint_t)((wr + buffer.size() - rd) % buffer.size());}
+  uint_t ReadBuffersAvailable() const
+  {
+    if (IsPowerOfTwo()) return wr.load(std::memory_order_acquire) - rd.load(std::memory_order_relaxed);
+    return (uint_t)((wr.load(std::memory_order_acquire) + buffer.size() - rd.load(std::memory_order_relaxed)) % buffer.size());
+  }
 
   /*--------------------------------------------------------------------------------*/
   /** Return ptr to item at read position
@@ -105,8 +191,8 @@ public:
    * @return ptr to data to read from or NULL if no items available
    */
   /*--------------------------------------------------------------------------------*/
-  const T *GetReadBuffer(uint_t offset = 0) const {return (offset < ReadBuffersAvailable()) ? &buffer[(rd + offset) % buffer.size()] : NULL;}
-  T       *GetReadBuffer(uint_t offset = 0)       {return (offset < ReadBuffersAvailable()) ? &buffer[(rd + offset) % buffer.size()] : NULL;}
+  const T *GetReadBuffer(uint_t offset = 0) const {return (offset < ReadBuffersAvailable()) ? &buffer[Index(rd.load(std::memory_order_relaxed) + offset)] : NULL;}
+  T       *GetReadBuffer(uint_t offset = 0)       {return (offset < ReadBuffersAvailable()) ? &buffer[Index(rd.load(std::memory_order_relaxed) + offset)] : NULL;}
 
   /*--------------------------------------------------------------------------------*/
   /** Increment the read pointer (after reading data)
@@ -119,19 +205,151 @@ public:
   bool IncrementRead(uint_t n = 1)
   {
     uint_t avail = ReadBuffersAvailable();
-    if ((n = std::min(n, avail)) > 0) {rd = (rd + n) % buffer.size(); return true;}
+    if ((n = std::min(n, avail)) > 0) {rd.store(Advance(rd.load(std::memory_order_relaxed), n), std::memory_order_release); return true;}
     return false;
   }
 
+  /*--------------------------------------------------------------------------------*/
+  /** Return up to two contiguous regions that can be written to
+   *
+   * @param spans array of two spans to be populated (second span is only used if the region wraps)
+   * @param n maximum number of items required
+   *
+   * @return total number of items in the spans (which may be less than n)
+   *
+   * @note after writing, call IncrementWrite() with the number of items written
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetWriteSpans(SPAN spans[2], uint_t n = ~0U) {return GetSpans(spans, wr.load(std::memory_order_relaxed), std::min(n, WriteBuffersAvailable()));}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return up to two contiguous regions that can be read from
+   *
+   * @param spans array of two spans to be populated (second span is only used if the region wraps)
+   * @param n maximum number of items required
+   *
+   * @return total number of items in the spans (which may be less than n)
+   *
+   * @note after reading, call IncrementRead() with the number of items read
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetReadSpans(SPAN spans[2], uint_t n = ~0U) {return GetSpans(spans, rd.load(std::memory_order_relaxed), std::min(n, ReadBuffersAvailable()));}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy a block of items into the buffer and commit them
+   *
+   * @param data items to write
+   * @param n number of items
+   *
+   * @return number of items written (which may be less than n if there is not enough space)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Write(const T *data, uint_t n)
+  {
+    SPAN spans[2];
+
+    if ((n = GetWriteSpans(spans, n)) > 0)
+    {
+      std::copy(data, data + spans[0].count, spans[0].data);
+      std::copy(data + spans[0].count, data + n, spans[1].data);
+      IncrementWrite(n);
+    }
+
+    return n;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy a block of items out of the buffer and release them
+   *
+   * @param data buffer to receive items
+   * @param n maximum number of items to read
+   *
+   * @return number of items read (which may be less than n if not enough are available)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Read(T *data, uint_t n)
+  {
+    SPAN spans[2];
+
+    if ((n = GetReadSpans(spans, n)) > 0)
+    {
+      std::copy(spans[0].data, spans[0].data + spans[0].count, data);
+      std::copy(spans[1].data, spans[1].data + spans[1].count, data + spans[0].count);
+      IncrementRead(n);
+    }
+
+    return n;
+  }
+
   /*--------------------------------------------------------------------------------*/
   /** Reset the buffer (losing all data)
+   *
+   * @note this must be called by the reader
    */
   /*--------------------------------------------------------------------------------*/
-  void Reset() {rd = wr;}
+  void Reset() {rd.store(wr.load(std::memory_order_acquire), std::memory_order_release);}
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Allocate buffer for l items, optionally rounding up to a power of two
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Allocate(uint_t l, bool pow2)
+  {
+    if (pow2)
+    {
+      uint_t size = 1;
+      // limit size so that the difference between free-running counters is always valid
+      while ((size < l) && (size < 0x80000000)) size <<= 1;
+      buffer.resize(size);
+      mask = size - 1;
+    }
+    else
+    {
+      buffer.resize(l + 1);
+      mask = 0;
+    }
+    powerof2 = pow2;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Convert read or write position into index into the buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Index(uint_t pos) const {return IsPowerOfTwo() ? (pos & mask) : (uint_t)(pos % buffer.size());}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Advance read or write position by n items
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Advance(uint_t pos, uint_t n) const {return IsPowerOfTwo() ? (pos + n) : (uint_t)((pos + n) % buffer.size());}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Split n items starting at position pos into contiguous regions
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetSpans(SPAN spans[2], uint_t pos, uint_t n)
+  {
+    uint_t index = Index(pos);
+
+    spans[0].data  = &buffer[index];
+    spans[0].count = std::min(n, (uint_t)buffer.size() - index);
+    spans[1].data  = &buffer[0];
+    spans[1].count = n - spans[0].count;
+
+    return n;
+  }
 
 protected:
-  std::vector<T> buffer;
-  volatile uint_t rd, wr;
+  std::vector<T>      buffer;
+  uint_t              mask;         // index mask (power-of-two mode only)
+  bool                powerof2;
+  // padding keeps rd (written by the reader) and wr (written by the writer) on separate cache lines
+  uint8_t             rdpad[CACHE_LINE_SIZE];
+  std::atomic<uint_t> rd;
+  uint8_t             wrpad[CACHE_LINE_SIZE - sizeof(std::atomic<uint_t>)];
+  std::atomic<uint_t> wr;
+  uint8_t             endpad[CACHE_LINE_SIZE - sizeof(std::atomic<uint_t>)];
 };
 
 BBC_AUDIOTOOLBOX_END
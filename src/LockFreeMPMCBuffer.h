@@ -0,0 +1,243 @@
+#ifndef __LOCK_FREE_MPMC_BUFFER__
+#define __LOCK_FREE_MPMC_BUFFER__
+
+#include <vector>
+#include <atomic>
+
+#include "misc.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Lock-free fixed-size circular buffer for multiple writers and multiple readers
+ *
+ * To write:
+ * Call GetWriteBuffer(), if it returns non-NULL, the slot is claimed by this thread,
+ * write to the buffer and then call IncrementWrite() with the same pointer
+ *
+ * To read:
+ * Call GetReadBuffer(), if it returns non-NULL, the slot is claimed by this thread,
+ * read from the buffer and then call IncrementRead() with the same pointer
+ *
+ * Or use Write()/Read() to copy a single item in or out
+ *
+ * Notes:
+ *  1. unlike LockFreeBuffer, any number of threads may read and write at the same time
+ *  2. the capacity is rounded up to a power of two
+ *  3. each slot carries a sequence number which tells writers whether the slot is free and
+ *     readers whether it has been committed, so claiming a slot is a single compare-and-swap
+ *     on the shared write (or read) position and committing/releasing a slot is a single
+ *     release store to the slot's own sequence number
+ *  4. a slot claimed but not yet committed will hold up readers of that slot (but not
+ *     readers of earlier slots) so slots should be committed as soon as possible
+ *  5. read-ahead and write-ahead are not supported
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename T>
+class LockFreeMPMCBuffer
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Initialise the buffer
+   *
+   * @param l number of items required (rounded up to a power of two)
+   */
+  /*--------------------------------------------------------------------------------*/
+  LockFreeMPMCBuffer(uint_t l = 1) : wr(0),
+                                     rd(0) {Allocate(l);}
+  virtual ~LockFreeMPMCBuffer() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Resize the buffer and reset the positions
+   *
+   * @note this will effectively empty the buffer
+   *
+   * @note NOT thread safe: no thread must be using the buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Resize(uint_t l) {Allocate(l);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return maximum number of items that can be held in the buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Capacity() const {return (uint_t)cells.size();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Claim slot at write position
+   *
+   * @return ptr to data to write to or NULL if no free items available
+   *
+   * @note the returned pointer MUST be passed to IncrementWrite() once written
+   */
+  /*--------------------------------------------------------------------------------*/
+  T *GetWriteBuffer()
+  {
+    uint_t pos = wr.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+      CELL&  cell = cells[pos & mask];
+      sint_t diff = (sint_t)(cell.seq.load(std::memory_order_acquire) - pos);
+
+      // slot is free for position pos: attempt to claim it
+      if (diff == 0)
+      {
+        if (wr.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &cell.data;
+        // pos has been updated by the failed exchange
+      }
+      // slot still holds an item from the previous lap: buffer is full
+      else if (diff < 0) return NULL;
+      // another writer has claimed this position: try again
+      else pos = wr.load(std::memory_order_relaxed);
+    }
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Commit slot claimed by GetWriteBuffer() (making it available to readers)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void IncrementWrite(T *buf)
+  {
+    CELL& cell = GetCell(buf);
+    // slot sequence number is the position it was claimed at, move it on by one to mark it as committed
+    cell.seq.store(cell.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Claim slot at read position
+   *
+   * @return ptr to data to read from or NULL if no items available
+   *
+   * @note the returned pointer MUST be passed to IncrementRead() once read
+   */
+  /*--------------------------------------------------------------------------------*/
+  T *GetReadBuffer()
+  {
+    uint_t pos = rd.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+      CELL&  cell = cells[pos & mask];
+      sint_t diff = (sint_t)(cell.seq.load(std::memory_order_acquire) - (pos + 1));
+
+      // slot has been committed for position pos: attempt to claim it
+      if (diff == 0)
+      {
+        if (rd.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &cell.data;
+        // pos has been updated by the failed exchange
+      }
+      // slot not yet committed: buffer is empty
+      else if (diff < 0) return NULL;
+      // another reader has claimed this position: try again
+      else pos = rd.load(std::memory_order_relaxed);
+    }
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Release slot claimed by GetReadBuffer() (making it available to writers)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void IncrementRead(T *buf)
+  {
+    CELL& cell = GetCell(buf);
+    // slot sequence number is one more than the position it was read from, move it on to the next lap
+    cell.seq.store(cell.seq.load(std::memory_order_relaxed) + mask, std::memory_order_release);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy item into buffer
+   *
+   * @return true if item was written, false if buffer is full
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Write(const T& item)
+  {
+    T *buf;
+    if ((buf = GetWriteBuffer()) != NULL)
+    {
+      *buf = item;
+      IncrementWrite(buf);
+      return true;
+    }
+    return false;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy item out of buffer
+   *
+   * @return true if item was read, false if buffer is empty
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Read(T& item)
+  {
+    T *buf;
+    if ((buf = GetReadBuffer()) != NULL)
+    {
+      item = *buf;
+      IncrementRead(buf);
+      return true;
+    }
+    return false;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return approximate number of items in the buffer
+   *
+   * @note this is only a snapshot and includes claimed but uncommitted slots
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadBuffersAvailable() const
+  {
+    sint_t n = (sint_t)(wr.load(std::memory_order_relaxed) - rd.load(std::memory_order_relaxed));
+    return (uint_t)std::max(n, (sint_t)0);
+  }
+
+protected:
+  typedef struct
+  {
+    std::atomic<uint_t> seq;
+    T                   data;
+  } CELL;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Allocate buffer for l items, rounding up to a power of two
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Allocate(uint_t l)
+  {
+    uint_t i, size = 1;
+
+    // limit size so that the difference between free-running counters is always valid
+    while ((size < l) && (size < 0x40000000)) size <<= 1;
+
+    std::vector<CELL>(size).swap(cells);
+    mask = size - 1;
+
+    // each slot is initially free for the first lap
+    for (i = 0; i < size; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+
+    wr.store(0);
+    rd.store(0);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return cell containing data pointer
+   */
+  /*--------------------------------------------------------------------------------*/
+  CELL& GetCell(T *buf) {return cells[((const uint8_t *)buf - (const uint8_t *)&cells[0].data) / sizeof(CELL)];}
+
+protected:
+  std::vector<CELL>   cells;
+  uint_t              mask;
+  // padding keeps wr (shared by writers) and rd (shared by readers) on separate cache lines
+  uint8_t             wrpad[CACHE_LINE_SIZE];
+  std::atomic<uint_t> wr;
+  uint8_t             rdpad[CACHE_LINE_SIZE - sizeof(std::atomic<uint_t>)];
+  std::atomic<uint_t> rd;
+  uint8_t             endpad[CACHE_LINE_SIZE - sizeof(std::atomic<uint_t>)];
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
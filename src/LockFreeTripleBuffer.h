@@ -0,0 +1,159 @@
+#ifndef __LOCK_FREE_TRIPLE_BUFFER__
+#define __LOCK_FREE_TRIPLE_BUFFER__
+
+#include <atomic>
+
+#include "misc.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Wait-free triple buffer for publishing the latest state of an object (e.g. a
+ * PositionTransform, ScreenTransform or ParameterSet) from one thread to another
+ *
+ * Unlike LockFreeBuffer, which queues every item, only the most recent complete copy
+ * is kept: the writer can publish as often as it likes without ever waiting for the
+ * reader and the reader always gets the newest copy without ever waiting for the writer
+ *
+ * To write:
+ * Call GetWriteBuffer(), modify the object and then call Publish() (or call Write())
+ *
+ * To read:
+ * Call Update(), which returns true if a new copy has been published since the last
+ * Update(), and then use GetReadBuffer() (or call Read())
+ *
+ * Notes:
+ *  1. this is a single-producer/single-consumer buffer: ONE thread may write
+ *     (GetWriteBuffer()/Publish()/Write()) and ONE thread may read (Update()/
+ *     GetReadBuffer()/Read()) at the same time
+ *  2. there are three copies of the object: one owned by the writer, one owned by the
+ *     reader and one in the middle holding the most recently published copy.  Publishing
+ *     swaps the writer's copy with the middle one and updating swaps the middle one
+ *     with the reader's copy, each with a single atomic exchange so neither side locks,
+ *     allocates or waits
+ *  3. the write buffer is NOT a copy of the last published object (it is whichever copy
+ *     the reader last released) so the writer must either set the whole object or keep
+ *     its own master copy and use Write()
+ *  4. the read buffer stays valid and unchanged until the next Update() so the reader
+ *     can skip recalculation of anything derived from it whilst Update() returns false
+ *  5. each copy is padded to avoid the reader and writer contending for the same cache line
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename T>
+class LockFreeTripleBuffer
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Initialise the buffer
+   *
+   * @param initial value of all three copies (and therefore of the read buffer before
+   * anything is published)
+   */
+  /*--------------------------------------------------------------------------------*/
+  LockFreeTripleBuffer(const T& initial = T()) : front(0),
+                                                 back(2),
+                                                 middle(1)
+  {
+    uint_t i;
+    for (i = 0; i < NUMBEROF(slots); i++) slots[i].data = initial;
+  }
+  virtual ~LockFreeTripleBuffer() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return ptr to the writer's copy of the object
+   *
+   * @note call Publish() once the object is complete
+   */
+  /*--------------------------------------------------------------------------------*/
+  T *GetWriteBuffer() {return &slots[back].data;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Publish the writer's copy of the object, replacing any copy the reader has not yet taken
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Publish()
+  {
+    // release makes the contents visible before the index, acquire makes the reader's use
+    // of the copy being taken back complete before it is overwritten
+    back = middle.exchange(back | Updated, std::memory_order_acq_rel) & IndexMask;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy an object into the writer's copy and publish it
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Write(const T& obj)
+  {
+    *GetWriteBuffer() = obj;
+    Publish();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether a new copy has been published since the last Update()
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsUpdated() const {return ((middle.load(std::memory_order_relaxed) & Updated) != 0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Take the most recently published copy of the object (if any) as the read buffer
+   *
+   * @return true if the read buffer has been updated, false if nothing has been published since the last Update()
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Update()
+  {
+    if (!IsUpdated()) return false;
+
+    front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+    return true;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return ptr to the reader's copy of the object
+   *
+   * @note this does NOT check for new copies, call Update() first
+   */
+  /*--------------------------------------------------------------------------------*/
+  const T *GetReadBuffer() const {return &slots[front].data;}
+  T       *GetReadBuffer()       {return &slots[front].data;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Update and return the reader's copy of the object
+   *
+   * @param updated optional ptr to bool to receive whether the object has changed since the last read
+   */
+  /*--------------------------------------------------------------------------------*/
+  const T& Read(bool *updated = NULL)
+  {
+    bool res = Update();
+    if (updated) *updated = res;
+    return *GetReadBuffer();
+  }
+
+protected:
+  // middle holds the index of the middle copy and the updated flag
+  enum
+  {
+    IndexMask = 3,
+    Updated   = 4,
+  };
+
+  typedef struct
+  {
+    T       data;
+    uint8_t pad[CACHE_LINE_SIZE];
+  } SLOT;
+
+protected:
+  SLOT                slots[3];
+  uint_t              front;        // index of reader's copy (reader only)
+  uint8_t             frontpad[CACHE_LINE_SIZE - sizeof(uint_t)];
+  uint_t              back;         // index of writer's copy (writer only)
+  uint8_t             backpad[CACHE_LINE_SIZE - sizeof(uint_t)];
+  std::atomic<uint_t> middle;
+  uint8_t             endpad[CACHE_LINE_SIZE - sizeof(std::atomic<uint_t>)];
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,188 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include "RCUObject.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// epoch 0 means 'not in a critical section'
+std::atomic<uint64_t> RCU::epoch(1);
+
+// reader record of the calling thread (trivial so that it can be used during thread exit)
+static thread_local void *currentreader = NULL;
+static thread_local bool  readerexited  = false;
+
+/*--------------------------------------------------------------------------------*/
+/** Releases the calling thread's reader record when the thread exits
+ */
+/*--------------------------------------------------------------------------------*/
+class RCUReaderHolder
+{
+public:
+  RCUReaderHolder() {}
+  ~RCUReaderHolder()
+  {
+    if (currentreader) RCU::ReleaseReader((RCU::READER *)currentreader);
+    currentreader = NULL;
+    readerexited  = true;
+  }
+
+  // using the holder ensures it is constructed (and therefore destroyed on thread exit)
+  void Register() {}
+};
+
+static thread_local RCUReaderHolder readerholder;
+
+/*--------------------------------------------------------------------------------*/
+/** Return list of every reader record and the lock that protects it
+ *
+ * @note neither is ever destroyed so that RCU can be used during static destruction
+ */
+/*--------------------------------------------------------------------------------*/
+std::vector<RCU::READER *>& RCU::GetReaderList()
+{
+  static std::vector<READER *> *_list = new std::vector<READER *>;
+  return *_list;
+}
+
+ThreadMutexObject& RCU::GetReaderListLock()
+{
+  static ThreadMutexObject *_lock = new ThreadMutexObject;
+  return *_lock;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return reader record of the calling thread, allocating one if necessary
+ */
+/*--------------------------------------------------------------------------------*/
+RCU::READER *RCU::GetReader()
+{
+  READER *reader;
+
+  if ((reader = (READER *)currentreader) == NULL)
+  {
+    ThreadMutexLock lock(GetReaderListLock());
+    std::vector<READER *>& list = GetReaderList();
+    uint_t i;
+
+    // reuse the record of a thread that has exited
+    for (i = 0; (i < list.size()) && !reader; i++)
+    {
+      if (!list[i]->inuse) reader = list[i];
+    }
+
+    if (!reader)
+    {
+      reader = new READER;
+      list.push_back(reader);
+    }
+
+    reader->epoch = 0;
+    reader->depth = 0;
+    reader->inuse = true;
+
+    currentreader = (void *)reader;
+
+    // a record allocated after the thread's holder has been destroyed is never released (but is harmless)
+    if (!readerexited) readerholder.Register();
+  }
+
+  return reader;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Release reader record when its thread exits
+ */
+/*--------------------------------------------------------------------------------*/
+void RCU::ReleaseReader(READER *reader)
+{
+  ThreadMutexLock lock(GetReaderListLock());
+
+  reader->epoch = 0;
+  reader->inuse = false;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enter/leave read-side critical section (AVOID: use an RCUReadLock object)
+ *
+ * @note critical sections can be nested
+ */
+/*--------------------------------------------------------------------------------*/
+void RCU::ReadLock()
+{
+  READER *reader = GetReader();
+
+  if (!reader->depth++)
+  {
+    // acquire pairs with Retire(): a reader that sees the new epoch also sees the new object
+    reader->epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+
+    // the epoch MUST be visible to writers before any object is read
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+}
+
+void RCU::ReadUnlock()
+{
+  READER *reader = (READER *)currentreader;
+
+  if (reader && reader->depth && !--reader->depth)
+  {
+    // every read of objects MUST complete before leaving
+    reader->epoch.store(0, std::memory_order_release);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Advance the global epoch (after an object has been replaced)
+ *
+ * @return epoch the replaced object must be tagged with
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t RCU::Retire()
+{
+  // any reader that could have read the replaced object entered in this epoch or earlier
+  return epoch.fetch_add(1, std::memory_order_seq_cst);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return the oldest epoch any reader is in (or ~0 if there are no readers)
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t RCU::GetOldestReaderEpoch()
+{
+  ThreadMutexLock lock(GetReaderListLock());
+  const std::vector<READER *>& list = GetReaderList();
+  uint64_t oldest = ~(uint64_t)0;
+  uint_t   i;
+
+  // pairs with the fence in ReadLock(): either this sees the reader's epoch or the reader sees the new object
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  for (i = 0; i < list.size(); i++)
+  {
+    uint64_t readerepoch = list[i]->epoch.load(std::memory_order_acquire);
+    if (readerepoch) oldest = std::min(oldest, readerepoch);
+  }
+
+  return oldest;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Wait until objects retired in the specified epoch can be deleted
+ *
+ * @note MUST NOT be called from within a read-side critical section (it would wait forever)
+ */
+/*--------------------------------------------------------------------------------*/
+void RCU::WaitForReaders(uint64_t retiredepoch)
+{
+  while (!CanReclaim(retiredepoch)) std::this_thread::yield();
+}
+
+BBC_AUDIOTOOLBOX_END
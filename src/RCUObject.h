@@ -0,0 +1,298 @@
+#ifndef __RCU_OBJECT__
+#define __RCU_OBJECT__
+
+#include <vector>
+#include <atomic>
+
+#include "ThreadLock.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Epoch-based read-copy-update (RCU) support shared by every RCUObject
+ *
+ * Each thread that reads an RCUObject has a reader record holding the epoch it entered
+ * its read-side critical section in (or 0 if it is outside one).  Writers replace an
+ * object by swapping in a new copy and then advancing the global epoch; the old copy is
+ * tagged with the epoch it was retired in and is only deleted once every reader is
+ * either outside a critical section or in a later epoch
+ *
+ * Entering and leaving a critical section are plain stores to the calling thread's own
+ * record (plus a fence on entry) so readers never perform an atomic read-modify-write
+ * and never contend with each other or with writers
+ */
+/*--------------------------------------------------------------------------------*/
+class RCU
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Enter/leave read-side critical section (AVOID: use an RCUReadLock object)
+   *
+   * @note critical sections can be nested
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void ReadLock();
+  static void ReadUnlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Advance the global epoch (after an object has been replaced)
+   *
+   * @return epoch the replaced object must be tagged with
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint64_t Retire();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether objects retired in the specified epoch can be deleted
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool CanReclaim(uint64_t retiredepoch) {return (retiredepoch < GetOldestReaderEpoch());}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return the oldest epoch any reader is in (or ~0 if there are no readers)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint64_t GetOldestReaderEpoch();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until objects retired in the specified epoch can be deleted
+   *
+   * @note MUST NOT be called from within a read-side critical section (it would wait forever)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void WaitForReaders(uint64_t retiredepoch);
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Per-thread reader record
+   *
+   * @note records are never deleted, records of threads that have exited are reused
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    std::atomic<uint64_t> epoch;        ///< epoch of current critical section (0 if not in one)
+    std::atomic<bool>     inuse;        ///< true whilst owned by a thread
+    uint_t                depth;        ///< nesting depth (owning thread only)
+    uint8_t               pad[CACHE_LINE_SIZE];
+  } READER;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return reader record of the calling thread, allocating one if necessary
+   */
+  /*--------------------------------------------------------------------------------*/
+  static READER *GetReader();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Release reader record when its thread exits
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void ReleaseReader(READER *reader);
+
+  static std::vector<READER *>& GetReaderList();
+  static ThreadMutexObject&     GetReaderListLock();
+
+  friend class RCUReaderHolder;
+
+protected:
+  static std::atomic<uint64_t> epoch;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Read-side critical section object for RCUObject
+ *
+ * Pointers returned by RCUObject::Get() remain valid until this object is destroyed
+ */
+/*--------------------------------------------------------------------------------*/
+class RCUReadLock
+{
+public:
+  RCUReadLock() {RCU::ReadLock();}
+  ~RCUReadLock() {RCU::ReadUnlock();}
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Holder of a read-mostly object (such as configuration) using read-copy-update
+ *
+ * Readers never lock: within an RCUReadLock, Get() returns a pointer to the current,
+ * immutable copy of the object which remains valid (and unchanged) until the RCUReadLock
+ * is destroyed, even if a writer replaces the object in the meantime
+ *
+ * Writers replace the whole object:
+ *  Update(obj):               replace the object with a new one
+ *  BeginUpdate()/EndUpdate(): take a copy of the current object for modification and
+ *                             then publish it (or AbandonUpdate() to discard it), writers
+ *                             are serialised in between so no modifications are lost
+ *
+ * Replaced objects are deleted once no reader can be using them, which happens during
+ * later updates, Reclaim() or Synchronize()
+ *
+ * Notes:
+ *  1. writing is relatively expensive (a copy of the object per update) so this is
+ *     intended for objects that are read far more often than they are written
+ *  2. objects MUST NOT be modified once they have been passed to Update()/EndUpdate()
+ *  3. Synchronize() (and therefore destruction) MUST NOT happen within a read-side
+ *     critical section
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename T>
+class RCUObject
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param obj initial object (which becomes owned by this object) or NULL for a default object
+   */
+  /*--------------------------------------------------------------------------------*/
+  RCUObject(T *obj = NULL) : current(obj ? obj : new T) {}
+  virtual ~RCUObject()
+  {
+    Synchronize();
+    delete current.load();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return the current object
+   *
+   * @note the caller MUST be within an RCUReadLock and the returned pointer MUST NOT be used after it has been destroyed
+   */
+  /*--------------------------------------------------------------------------------*/
+  const T *Get() const {return current.load(std::memory_order_acquire);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Replace the object
+   *
+   * @param obj new object (which becomes owned by this object)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Update(T *obj)
+  {
+    ThreadMutexLock lock(writelock);
+    Replace(obj);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return a copy of the current object for modification
+   *
+   * @note EndUpdate() or AbandonUpdate() MUST be called afterwards, other writers are blocked until one is
+   */
+  /*--------------------------------------------------------------------------------*/
+  T *BeginUpdate()
+  {
+    writelock.Lock();
+    return new T(*current.load(std::memory_order_relaxed));
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Publish the object returned by BeginUpdate()
+   */
+  /*--------------------------------------------------------------------------------*/
+  void EndUpdate(T *obj)
+  {
+    Replace(obj);
+    writelock.Unlock();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Delete the object returned by BeginUpdate() without publishing it
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AbandonUpdate(T *obj)
+  {
+    delete obj;
+    writelock.Unlock();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Delete replaced objects that are no longer used by any reader
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Reclaim()
+  {
+    ThreadMutexLock lock(writelock);
+    ReclaimEx();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until no reader is using a replaced object and delete them all
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Synchronize()
+  {
+    ThreadMutexLock lock(writelock);
+
+    if (!retired.empty())
+    {
+      RCU::WaitForReaders(retired.back().epoch);
+      ReclaimEx();
+    }
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of replaced objects not yet deleted
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetRetiredCount() const
+  {
+    ThreadMutexLock lock(writelock);
+    return (uint_t)retired.size();
+  }
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Replace the object and retire the old one
+   *
+   * @note writelock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Replace(T *obj)
+  {
+    if (obj)
+    {
+      RETIRED item;
+
+      item.obj   = current.exchange(obj, std::memory_order_acq_rel);
+      item.epoch = RCU::Retire();
+      retired.push_back(item);
+    }
+
+    ReclaimEx();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Delete replaced objects that are no longer used by any reader
+   *
+   * @note writelock MUST be held
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ReclaimEx()
+  {
+    if (!retired.empty())
+    {
+      uint64_t oldest = RCU::GetOldestReaderEpoch();
+      uint_t   i, n = 0;
+
+      // objects are retired in epoch order
+      while ((n < retired.size()) && (retired[n].epoch < oldest)) n++;
+
+      for (i = 0; i < n; i++) delete retired[i].obj;
+      retired.erase(retired.begin(), retired.begin() + n);
+    }
+  }
+
+  typedef struct
+  {
+    T        *obj;
+    uint64_t epoch;
+  } RETIRED;
+
+protected:
+  std::atomic<T *>     current;
+  ThreadMutexObject    writelock;       ///< serialises writers and protects retired
+  std::vector<RETIRED> retired;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
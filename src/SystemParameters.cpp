@@ -6,6 +6,7 @@
 #define BBCDEBUG_LEVEL 1
 #include "SystemParameters.h"
 #include "EnhancedFile.h"
+#include "LineReader.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -15,7 +16,6 @@ const std::string SystemParameters::homedirkey    = "homedir";
 
 SystemParameters::SystemParameters()
 {
-  ThreadLock lock(tlock);
   static bool init = false;
 
   if (!init)
@@ -81,7 +81,10 @@ SystemParameters::SystemParameters()
 #endif
     }
     
-    BBCDEBUG2(("SystemParameters: {%s}", parameters.ToString().c_str()));
+    {
+      RCUReadLock lock;
+      BBCDEBUG2(("SystemParameters: {%s}", parameters.Get()->ToString().c_str()));
+    }
   }
 }
 
@@ -106,12 +109,15 @@ bool SystemParameters::ReadFromFile(const std::string& filename)
 
   if (EnhancedFile::exists(filename.c_str()) && file.fopen(filename.c_str()))
   {
-    static char buffer[1024];
-    int l;
-      
-    while ((l = file.readline(buffer, sizeof(buffer) - 1)) >= 0)
+    LineReader reader(file);
+    LineReader::iterator it;
+    // modify a single copy of the parameters and publish it once the whole file has been read
+    ParameterSet *newparameters = parameters.BeginUpdate();
+    uint_t       n = 0;
+
+    for (it = reader.begin(); it != reader.end(); ++it)
     {
-      std::string line = buffer;
+      std::string line = it->str();
       size_t p;
 
       // clear any comments
@@ -139,10 +145,14 @@ bool SystemParameters::ReadFromFile(const std::string& filename)
           p4--;
         }
           
-        Set(line.substr(p1, p2 - p1), line.substr(p3, p4 - p3));
+        newparameters->Set(line.substr(p1, p2 - p1), line.substr(p3, p4 - p3));
+        n++;
       }
     }
 
+    if (n) parameters.EndUpdate(newparameters);
+    else   parameters.AbandonUpdate(newparameters);
+
     file.fclose();
 
     success = true;
@@ -159,9 +169,9 @@ bool SystemParameters::ReadFromFile(const std::string& filename)
 /*--------------------------------------------------------------------------------*/
 bool SystemParameters::GetSubstituted(const std::string& name, std::string& val) const
 {
-  ThreadLock lock(tlock);
+  RCUReadLock lock;
   bool success = false;
-  if (parameters.Get(name, val))
+  if (parameters.Get()->Get(name, val))
   {
     val = Substitute(val);
     success = true;
@@ -175,8 +185,8 @@ bool SystemParameters::GetSubstituted(const std::string& name, std::string& val)
 /*--------------------------------------------------------------------------------*/
 bool SystemParameters::Exists(const std::string& name) const
 {
-  ThreadLock lock(tlock);
-  return parameters.Exists(name);
+  RCUReadLock lock;
+  return parameters.Get()->Exists(name);
 }
  
 /*--------------------------------------------------------------------------------*/
@@ -194,7 +204,8 @@ bool SystemParameters::Exists(const std::string& name) const
 /*--------------------------------------------------------------------------------*/
 std::string SystemParameters::Substitute(const std::string& str, bool replaceunknown) const
 {
-  ThreadLock lock(tlock);
+  RCUReadLock lock;
+  const ParameterSet& params = *parameters.Get();
   std::string res = str;
   size_t p1 = 0, p2;
 
@@ -207,9 +218,9 @@ std::string SystemParameters::Substitute(const std::string& str, bool replaceunk
 
     BBCDEBUG3(("Found var '%s' at %s", var.c_str(), StringFrom(p1).c_str()));
     
-    if (parameters.Exists(var))
+    if (params.Exists(var))
     {
-      parameters.Get(var, val);
+      params.Get(var, val);
       res = res.substr(0, p1) + val + res.substr(p2 + 1);
       // leave p1 where it is so substitution is attempted again at this position
     }
@@ -242,7 +253,7 @@ std::string SystemParameters::Substitute(const std::string& str, bool replaceunk
 /** Iterate through a list of paths, substituting and expanding paths where necessary
  */
 /*--------------------------------------------------------------------------------*/
-void SystemParameters::SubstitutePathList(std::vector<std::string>& paths) const
+void SystemParameters::SubstitutePathList(const ParameterSet& params, std::vector<std::string>& paths) const
 {
   uint_t i;
 
@@ -259,7 +270,7 @@ void SystemParameters::SubstitutePathList(std::vector<std::string>& paths) const
       std::string val, left = path.substr(0, p1), right = path.substr(p2 + 1);
 
       // if var doesn't exist, it will be replaced by blank anyway
-      parameters.Get(var, val);
+      params.Get(var, val);
 
       // split replacement
       std::vector<std::string> subpaths;
@@ -298,7 +309,7 @@ void SystemParameters::SubstitutePathList(std::vector<std::string>& paths) const
 /*--------------------------------------------------------------------------------*/
 std::string SystemParameters::SubstitutePathList(const std::string& str) const
 {
-  ThreadLock lock(tlock);
+  RCUReadLock lock;
   std::vector<std::string> paths;
   std::string res;
 
@@ -306,7 +317,7 @@ std::string SystemParameters::SubstitutePathList(const std::string& str) const
   SplitString(str, paths, ';');
 
   // perform repeated substitution and expansion
-  SubstitutePathList(paths);
+  SubstitutePathList(*parameters.Get(), paths);
 
   // reconstitute pathlist
   uint_t i;
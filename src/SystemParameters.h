@@ -2,7 +2,7 @@
 #define __SYSTEM_PARAMETERS__
 
 #include "ParameterSet.h"
-#include "ThreadLock.h"
+#include "RCUObject.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -21,6 +21,9 @@ BBC_AUDIOTOOLBOX_START
  * '{installdir}/share' and the '{installdir}' is replaced by the value of 'installdir'
  * when access via GetSubstituted() (NOTE: Get() will return the true, unsubstituted
  * value!).  This mechanism should be used for paths but *can* be used by anything.
+ *
+ * The parameters are held in an RCUObject because they are read constantly but rarely
+ * written (mostly at startup): reading never locks and each Set() publishes a new copy
  */
 /*--------------------------------------------------------------------------------*/
 class SystemParameters
@@ -51,8 +54,8 @@ public:
   template<typename T>
   bool Get(const std::string& name, T& val) const
   {
-    ThreadLock lock(tlock);
-    return parameters.Get(name, val);
+    RCUReadLock lock;
+    return parameters.Get()->Get(name, val);
   }
 
   /*--------------------------------------------------------------------------------*/
@@ -64,8 +67,9 @@ public:
   template<typename T>
   SystemParameters& Set(const std::string& name, const T& val)
   {
-    ThreadLock lock(tlock);
-    parameters.Set(name, val);
+    ParameterSet *newparameters = parameters.BeginUpdate();
+    newparameters->Set(name, val);
+    parameters.EndUpdate(newparameters);
     return *this;
   }
 
@@ -129,11 +133,10 @@ protected:
   /** Iterate through a list of paths, substituting and expanding paths where necessary
    */
   /*--------------------------------------------------------------------------------*/
-  void SubstitutePathList(std::vector<std::string>& paths) const;
+  void SubstitutePathList(const ParameterSet& params, std::vector<std::string>& paths) const;
 
 protected:
-  ThreadLockObject tlock;
-  ParameterSet     parameters;
+  RCUObject<ParameterSet> parameters;
 };
   
 BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,400 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#define BBCDEBUG_LEVEL 1
+#include "TaskPool.h"
+#include "SystemParameters.h"
+
+BBC_AUDIOTOOLBOX_START
+
+TaskPool *TaskPool::instance = NULL;
+
+// worker (of any pool) that is the current thread
+static thread_local void *currentworker = NULL;
+
+/*--------------------------------------------------------------------------------*/
+/** Constructor - starts worker threads
+ *
+ * @param nthreads number of worker threads (0 for the default, see GetDefaultThreadCount())
+ */
+/*--------------------------------------------------------------------------------*/
+TaskPool::TaskPool(uint_t nthreads) : running(false),
+                                      aborted(false),
+                                      nextworker(0)
+{
+  Start(nthreads);
+}
+
+TaskPool::~TaskPool()
+{
+  Stop();
+}
+
+ThreadLockObject& TaskPool::GetInstanceLock()
+{
+  static ThreadLockObject _lock;
+  return _lock;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return the shared pool, creating and starting it if necessary
+ */
+/*--------------------------------------------------------------------------------*/
+TaskPool& TaskPool::Get()
+{
+  ThreadLock lock(GetInstanceLock());
+
+  if (!instance) instance = new TaskPool();
+
+  return *instance;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return default number of worker threads (from SystemParameters 'taskpoolthreads'
+ * or the number of cores)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t TaskPool::GetDefaultThreadCount()
+{
+  uint_t n = 0;
+  SystemParameters::Get().Get("taskpoolthreads", n);
+  if (!n) n = (uint_t)std::thread::hardware_concurrency();
+  return std::max(n, 1U);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start worker threads (if not already running)
+ *
+ * @param nthreads number of worker threads (0 for the default, see GetDefaultThreadCount())
+ *
+ * @return true if the pool is running
+ */
+/*--------------------------------------------------------------------------------*/
+bool TaskPool::Start(uint_t nthreads)
+{
+  if (!running)
+  {
+    uint_t i, started = 0;
+
+    // finish off any previous Stop(false) or Abort(false)
+    Shutdown();
+    aborted = false;
+
+    if (!nthreads) nthreads = GetDefaultThreadCount();
+
+    // every worker must exist before any start since they steal from each other
+    for (i = 0; i < nthreads; i++)
+    {
+      WORKER *worker = new WORKER;
+
+      worker->pool     = this;
+      worker->index    = i;
+      worker->sleeping = false;
+      workers.push_back(worker);
+    }
+
+    running = true;
+
+    for (i = 0; i < nthreads; i++)
+    {
+      if (workers[i]->thread.Start(&__WorkerStart, (void *)workers[i])) started++;
+      else BBCERROR("Failed to start task pool worker %u", i);
+    }
+
+    if (started) BBCDEBUG2(("Started task pool with %u workers", started));
+    else
+    {
+      // run tasks in the calling thread instead
+      running = false;
+      Shutdown();
+    }
+  }
+
+  return running;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Request workers stop once every queued task has run and optionally wait until they have finished
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::Stop(bool wait)
+{
+  uint_t i;
+
+  running = false;
+
+  for (i = 0; i < workers.size(); i++)
+  {
+    workers[i]->thread.Stop(false);
+    workers[i]->wake.Signal();
+  }
+
+  if (wait) Shutdown();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Request workers *abort*, discarding queued tasks, and optionally wait until they have finished
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::Abort(bool wait)
+{
+  uint_t i;
+
+  running = false;
+  aborted = true;
+
+  for (i = 0; i < workers.size(); i++)
+  {
+    workers[i]->thread.Abort(false);
+    workers[i]->wake.Signal();
+  }
+
+  if (wait) Shutdown();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Wait for worker threads to finish and then run (or, if aborted, discard) any tasks left queued
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::Shutdown()
+{
+  if (!workers.empty())
+  {
+    // the threads' own abort flags are cleared when they are joined so cannot be used
+    bool   discard = aborted;
+    uint_t i;
+
+    for (i = 0; i < workers.size(); i++) workers[i]->thread.Stop();
+
+    for (i = 0; i < workers.size(); i++)
+    {
+      WORKER *worker = workers[i];
+
+      while (!worker->tasks.empty())
+      {
+        Task *task = worker->tasks.front();
+        worker->tasks.pop_front();
+
+        if (discard) delete task;
+        else         RunTask(task);
+      }
+
+      delete worker;
+    }
+
+    workers.clear();
+
+    BBCDEBUG2(("Task pool %s", discard ? "aborted" : "stopped"));
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Submit task
+ *
+ * @param task task to run (deleted by the pool once it has run or been discarded)
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::Submit(Task *task)
+{
+  if (running)
+  {
+    WORKER *worker = GetCurrentWorker();
+
+    // tasks from outside the pool are spread over the workers
+    if (!worker) worker = workers[nextworker++ % workers.size()];
+
+    {
+      ThreadLock lock(worker->lock);
+      worker->tasks.push_back(task);
+    }
+
+    WakeWorker(worker);
+  }
+  else RunTask(task);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Run a single queued task in the calling thread
+ *
+ * @return true if a task was run
+ */
+/*--------------------------------------------------------------------------------*/
+bool TaskPool::RunPendingTask()
+{
+  Task *task;
+
+  if ((task = TakeTask(GetCurrentWorker())) != NULL) RunTask(task);
+
+  return (task != NULL);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return number of indices per ParallelFor() task for n indices
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t TaskPool::GetAutomaticGrain(uint_t n) const
+{
+  // a few tasks per worker so that uneven tasks balance out without too much overhead
+  uint_t ntasks = std::max((uint_t)workers.size(), 1U) * 4;
+  return std::max((n + ntasks - 1) / ntasks, 1U);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Run tasks until every chunk of a ParallelFor() has finished
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::WaitForParallelFor(PARALLELFOR& state)
+{
+  // the last chunk always signals so always wait for the signal, otherwise
+  // state could be destroyed whilst the signal is still being set
+  while (state.remaining && RunPendingTask()) ;
+  state.done.Wait();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Mark a chunk of a ParallelFor() as finished
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::FinishParallelFor(PARALLELFOR& state, bool ran)
+{
+  if (!ran) state.discarded = true;
+  if (--state.remaining == 0) state.done.Signal();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return the worker of this pool that is the calling thread (or NULL)
+ */
+/*--------------------------------------------------------------------------------*/
+TaskPool::WORKER *TaskPool::GetCurrentWorker() const
+{
+  WORKER *worker = (WORKER *)currentworker;
+  return (worker && (worker->pool == this)) ? worker : NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Take a task, from the worker's own queue first and then by stealing from the others
+ *
+ * @param worker worker to take the task for (or NULL for a thread that is not a worker)
+ */
+/*--------------------------------------------------------------------------------*/
+TaskPool::Task *TaskPool::TakeTask(WORKER *worker)
+{
+  uint_t i, n = (uint_t)workers.size(), first;
+
+  if (worker)
+  {
+    ThreadLock lock(worker->lock);
+
+    // newest task first
+    if (!worker->tasks.empty())
+    {
+      Task *task = worker->tasks.back();
+      worker->tasks.pop_back();
+      return task;
+    }
+  }
+
+  // steal oldest task, starting at a different worker for each thief
+  first = worker ? worker->index + 1 : nextworker.load();
+  for (i = 0; i < n; i++)
+  {
+    WORKER *victim = workers[(first + i) % n];
+
+    if (victim != worker)
+    {
+      ThreadLock lock(victim->lock);
+
+      if (!victim->tasks.empty())
+      {
+        Task *task = victim->tasks.front();
+        victim->tasks.pop_front();
+        return task;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Run task and delete it
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::RunTask(Task *task)
+{
+  task->Run();
+  delete task;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Wake a sleeping worker, preferring the specified one
+ */
+/*--------------------------------------------------------------------------------*/
+void TaskPool::WakeWorker(WORKER *preferred)
+{
+  uint_t i;
+
+  // pairs with the fence in Run(): either the worker sees the new task or this sees it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (preferred->sleeping.exchange(false)) preferred->wake.Signal();
+  else
+  {
+    // the preferred worker is busy so wake another to steal the task
+    for (i = 0; i < workers.size(); i++)
+    {
+      if (workers[i]->sleeping.exchange(false))
+      {
+        workers[i]->wake.Signal();
+        break;
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Worker thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *TaskPool::Run(WORKER& worker)
+{
+  currentworker = (void *)&worker;
+
+  while (!worker.thread.AbortRequested())
+  {
+    Task *task;
+
+    if ((task = TakeTask(&worker)) != NULL)
+    {
+      RunTask(task);
+      continue;
+    }
+
+    // only stop once there is nothing left to do
+    if (worker.thread.StopRequested()) break;
+
+    // announce sleeping *before* checking for tasks a final time so that a task
+    // submitted at the same time cannot be missed
+    worker.sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if ((task = TakeTask(&worker)) != NULL)
+    {
+      worker.sleeping = false;
+      RunTask(task);
+    }
+    else if (!worker.thread.StopRequested()) worker.wake.Wait();
+
+    worker.sleeping = false;
+  }
+
+  currentworker = NULL;
+
+  return NULL;
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,346 @@
+#ifndef __TASK_POOL__
+#define __TASK_POOL__
+
+#include <vector>
+#include <deque>
+#include <future>
+#include <type_traits>
+
+#include "Thread.h"
+#include "ThreadLock.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Work-stealing pool of worker threads for running short tasks
+ *
+ * Instead of creating a Thread per job, jobs are split into tasks which are run by a
+ * fixed set of worker threads.  Each worker has its own queue of tasks: tasks submitted
+ * from a worker go onto that worker's queue (and are taken from the same end, so the
+ * most recently submitted, cache-warm task runs next) and tasks submitted from any other
+ * thread are spread evenly over the workers.  A worker whose queue is empty steals the
+ * oldest task from another worker's queue so that no core is left idle when tasks are
+ * of uneven length
+ *
+ * Tasks can be submitted as:
+ *  - a Task object (deleted by the pool once it has been run or discarded)
+ *  - any callable object using Submit(func), which returns a std::future for the result
+ *  - a range of indices using ParallelFor() which splits the range into chunks and
+ *    waits for them all to complete (the calling thread helps run them)
+ *
+ * The number of workers defaults to the SystemParameters value 'taskpoolthreads' (or,
+ * if that is not set or is 0, the number of cores)
+ *
+ * Shutdown follows Thread:
+ *  Stop():  the workers finish every task that has been queued and then exit
+ *  Abort(): the workers exit after the tasks they are currently running, any queued
+ *           tasks are discarded (the futures of discarded tasks throw std::future_error
+ *           with broken_promise)
+ *
+ * Notes:
+ *  1. whilst the pool is not running, submitted tasks are run straight away by the
+ *     calling thread
+ *  2. tasks MUST NOT be submitted whilst the pool is being stopped or aborted
+ *  3. a task that waits for another task (e.g. using std::future::get()) can deadlock
+ *     the pool if every worker is waiting: use ParallelFor() or RunPendingTask() to
+ *     wait instead
+ */
+/*--------------------------------------------------------------------------------*/
+class TaskPool
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Base class of tasks
+   */
+  /*--------------------------------------------------------------------------------*/
+  class Task
+  {
+  public:
+    virtual ~Task() {}
+
+    /*--------------------------------------------------------------------------------*/
+    /** Perform task
+     */
+    /*--------------------------------------------------------------------------------*/
+    virtual void Run() = 0;
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor - starts worker threads
+   *
+   * @param nthreads number of worker threads (0 for the default, see GetDefaultThreadCount())
+   */
+  /*--------------------------------------------------------------------------------*/
+  TaskPool(uint_t nthreads = 0);
+  virtual ~TaskPool();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return the shared pool, creating and starting it if necessary
+   */
+  /*--------------------------------------------------------------------------------*/
+  static TaskPool& Get();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return default number of worker threads (from SystemParameters 'taskpoolthreads'
+   * or the number of cores)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint_t GetDefaultThreadCount();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start worker threads (if not already running)
+   *
+   * @param nthreads number of worker threads (0 for the default, see GetDefaultThreadCount())
+   *
+   * @return true if the pool is running
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Start(uint_t nthreads = 0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the pool is running
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsRunning() const {return running;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of worker threads
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetThreadCount() const {return (uint_t)workers.size();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Request workers stop once every queued task has run and optionally wait until they have finished
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Stop(bool wait = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Request workers *abort*, discarding queued tasks, and optionally wait until they have finished
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Abort(bool wait = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Submit task
+   *
+   * @param task task to run (deleted by the pool once it has run or been discarded)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Submit(Task *task);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Submit callable object
+   *
+   * @param func function, lambda or functor taking no arguments
+   *
+   * @return future for the result of func
+   */
+  /*--------------------------------------------------------------------------------*/
+  template<typename F>
+  std::future<typename std::result_of<F()>::type> Submit(F func)
+  {
+    typedef typename std::result_of<F()>::type R;
+    FunctionTask<R> *task = new FunctionTask<R>(func);
+    std::future<R>  future = task->GetFuture();
+
+    Submit(task);
+
+    return future;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Call func(i) for every i in [start, end) using the pool and wait for all calls to complete
+   *
+   * @param start first index
+   * @param end index after the last index
+   * @param func function, lambda or functor taking a uint_t index
+   * @param grain number of indices per task (0 for automatic)
+   *
+   * @return true if func was called for every index (false if the pool was aborted)
+   *
+   * @note the calling thread runs tasks whilst waiting so this can be used from within tasks
+   */
+  /*--------------------------------------------------------------------------------*/
+  template<typename F>
+  bool ParallelFor(uint_t start, uint_t end, const F& func, uint_t grain = 0)
+  {
+    PARALLELFOR state;
+    uint_t      i, n = (end > start) ? end - start : 0;
+
+    if (!n) return true;
+    if (!grain) grain = GetAutomaticGrain(n);
+
+    state.remaining = (n + grain - 1) / grain;
+    state.discarded = false;
+
+    for (i = start; i < end; i += std::min(grain, end - i))
+    {
+      Submit(new ParallelForTask<F>(func, i, i + std::min(grain, end - i), state));
+    }
+
+    WaitForParallelFor(state);
+
+    return !state.discarded;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Run a single queued task in the calling thread
+   *
+   * @return true if a task was run
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool RunPendingTask();
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Task wrapping a callable object and providing a future for its result
+   */
+  /*--------------------------------------------------------------------------------*/
+  template<typename R>
+  class FunctionTask : public Task
+  {
+  public:
+    template<typename F>
+    FunctionTask(const F& func) : task(func) {}
+
+    std::future<R> GetFuture() {return task.get_future();}
+
+    virtual void Run() {task();}
+
+  protected:
+    std::packaged_task<R()> task;
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Shared state of a ParallelFor()
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    std::atomic<uint_t>    remaining;   ///< number of chunks not yet run or discarded
+    std::atomic<bool>      discarded;   ///< true if any chunk was discarded
+    ThreadBoolSignalObject done;        ///< signalled when the last chunk finishes
+  } PARALLELFOR;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Task calling func for a chunk of a ParallelFor()
+   */
+  /*--------------------------------------------------------------------------------*/
+  template<typename F>
+  class ParallelForTask : public Task
+  {
+  public:
+    ParallelForTask(const F& _func, uint_t _start, uint_t _end, PARALLELFOR& _state) : func(_func),
+                                                                                      start(_start),
+                                                                                      end(_end),
+                                                                                      state(_state),
+                                                                                      ran(false) {}
+    // the chunk is finished whether it was run or discarded
+    virtual ~ParallelForTask() {FinishParallelFor(state, ran);}
+
+    virtual void Run()
+    {
+      uint_t i;
+      for (i = start; i < end; i++) func(i);
+      ran = true;
+    }
+
+  protected:
+    const F&     func;
+    uint_t       start, end;
+    PARALLELFOR& state;
+    bool         ran;
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Per-worker thread and task queue
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    TaskPool               *pool;
+    uint_t                 index;
+    Thread                 thread;
+    ThreadLockObject       lock;        ///< protects tasks
+    std::deque<Task *>     tasks;       ///< owner takes from the back, thieves from the front
+    std::atomic<bool>      sleeping;    ///< true whilst the worker is (about to be) waiting for tasks
+    ThreadBoolSignalObject wake;
+  } WORKER;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of indices per ParallelFor() task for n indices
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetAutomaticGrain(uint_t n) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Run tasks until every chunk of a ParallelFor() has finished
+   */
+  /*--------------------------------------------------------------------------------*/
+  void WaitForParallelFor(PARALLELFOR& state);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Mark a chunk of a ParallelFor() as finished
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void FinishParallelFor(PARALLELFOR& state, bool ran);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return the worker of this pool that is the calling thread (or NULL)
+   */
+  /*--------------------------------------------------------------------------------*/
+  WORKER *GetCurrentWorker() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Take a task, from the worker's own queue first and then by stealing from the others
+   *
+   * @param worker worker to take the task for (or NULL for a thread that is not a worker)
+   */
+  /*--------------------------------------------------------------------------------*/
+  Task *TakeTask(WORKER *worker);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Run task and delete it
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void RunTask(Task *task);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wake a sleeping worker, preferring the specified one
+   */
+  /*--------------------------------------------------------------------------------*/
+  void WakeWorker(WORKER *preferred);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait for worker threads to finish and then run (or, if aborted, discard) any tasks left queued
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Shutdown();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Worker thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__WorkerStart(Thread& thread, void *arg)
+  {
+    UNUSED_PARAMETER(thread);
+    WORKER& worker = *(WORKER *)arg;
+    return worker.pool->Run(worker);
+  }
+  void *Run(WORKER& worker);
+
+  static ThreadLockObject& GetInstanceLock();
+
+protected:
+  std::vector<WORKER *> workers;
+  std::atomic<bool>     running;
+  std::atomic<bool>     aborted;        ///< true if queued tasks must be discarded rather than run
+  std::atomic<uint_t>   nextworker;     ///< worker to queue the next task from a non-worker thread on
+
+  static TaskPool       *instance;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
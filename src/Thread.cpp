@@ -5,6 +5,18 @@
 #include <errno.h>
 #include <assert.h>
 
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_WINDOWS
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <alloca.h>
+#endif
+
 #define BBCDEBUG_LEVEL 1
 #include "Thread.h"
 
@@ -19,7 +31,10 @@ Thread::Thread(bool start) : call(NULL),
                              stopthread(false),
                              abortthread(false),
                              threadcompleted(false),
-                             threadfinished(false)
+                             threadfinished(false),
+                             attributes(GetDefaultAttributes()),
+                             appliedattributes(0),
+                             prefaultedstack(0)
 {
 #ifdef USE_PTHREADS
   // clear thread data
@@ -38,7 +53,10 @@ Thread::Thread(THREADCALL _call, void *_arg) : call(NULL),
                                                stopthread(false),
                                                abortthread(false),
                                                threadcompleted(false),
-                                               threadfinished(false)
+                                               threadfinished(false),
+                                               attributes(GetDefaultAttributes()),
+                                               appliedattributes(0),
+                                               prefaultedstack(0)
 {
 #ifdef USE_PTHREADS
   // clear thread data
@@ -61,7 +79,11 @@ Thread::Thread(const Thread& obj) : call(NULL),
                                     arg(NULL),
                                     stopthread(false),
                                     abortthread(false),
-                                    threadcompleted(false)
+                                    threadcompleted(false),
+                                    threadfinished(false),
+                                    attributes(GetDefaultAttributes()),
+                                    appliedattributes(0),
+                                    prefaultedstack(0)
 {
 #ifdef USE_PTHREADS
   // clear thread data
@@ -82,8 +104,9 @@ Thread& Thread::operator = (const Thread& obj)
     assert(!IsRunning());
     assert(!obj.IsRunning());
     
-    call = obj.call;
-    arg  = obj.arg;
+    call       = obj.call;
+    arg        = obj.arg;
+    attributes = obj.attributes;
     stopthread = abortthread = threadcompleted = threadfinished = false;
   }
   
@@ -120,21 +143,40 @@ bool Thread::Start()
   {
     // create thread
     stopthread = abortthread = threadcompleted = threadfinished = false;
+    appliedattributes = 0;
+    prefaultedstack   = 0;
 
 #ifdef USE_PTHREADS
-    if (pthread_create(&thread, NULL, &__ThreadEntry, (void *)this) == 0)
+    pthread_attr_t attr;
+    int res;
+
+    pthread_attr_init(&attr);
+
+    // stack size can only be set on creation
+    if (attributes.stacksize)
+    {
+      if ((res = pthread_attr_setstacksize(&attr, attributes.stacksize)) == 0) appliedattributes |= ATTRIBUTE_STACKSIZE;
+      else BBCDEBUG1(("Failed to set thread stack size to %s bytes (%s), using default", StringFrom(attributes.stacksize).c_str(), strerror(res)));
+    }
+
+    if ((res = pthread_create(&thread, &attr, &__ThreadEntry, (void *)this)) == 0)
     {
       BBCDEBUG2(("Created thread"));
       started = true;
     }
     else
     {
-      BBCERROR("Failed to create thread (%s)", strerror(errno));
+      BBCERROR("Failed to create thread (%s)", strerror(res));
       memset(&thread, 0, sizeof(thread));
     }
+
+    pthread_attr_destroy(&attr);
 #else
+    if (attributes.stacksize) BBCDEBUG1(("Thread stack size cannot be set without USE_PTHREADS, using default"));
+
     thread = std::thread( [this]() {
         try {
+          ApplyAttributes();
           Run();
         }
         catch (std::exception e)
@@ -209,6 +251,214 @@ void Thread::Abort(bool wait)
   }
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Return default attributes (default scheduling, no affinity, default stack size, no name)
+ */
+/*--------------------------------------------------------------------------------*/
+Thread::ATTRIBUTES Thread::GetDefaultAttributes()
+{
+  ATTRIBUTES attr;
+
+  attr.policy        = POLICY_DEFAULT;
+  attr.priority      = 0;
+  attr.affinity      = 0;
+  attr.stacksize     = 0;
+  attr.lockmemory    = false;
+  attr.prefaultstack = 0;
+
+  return attr;
+}
+
+// stack left untouched below the prefaulted region for the rest of the thread
+#define PREFAULT_STACK_MARGIN (64 * 1024)
+
+// stack size assumed when it cannot be determined (smallest default of the supported platforms)
+#define PREFAULT_DEFAULT_STACK (512 * 1024)
+
+/*--------------------------------------------------------------------------------*/
+/** Return number of bytes of stack available below the caller (approximately)
+ *
+ * @param stacksize stack size requested for the thread (0 for default) used if the stack cannot be determined
+ */
+/*--------------------------------------------------------------------------------*/
+static size_t GetAvailableStack(size_t stacksize)
+{
+  volatile uint8_t marker = 0;
+  uintptr_t        sp     = (uintptr_t)&marker;
+  size_t           available = 0;
+
+#if defined(__APPLE__)
+  uintptr_t top = (uintptr_t)pthread_get_stackaddr_np(pthread_self());
+  size_t    size = pthread_get_stacksize_np(pthread_self());
+
+  // stack grows down from top
+  if ((sp <= top) && ((top - sp) < size)) available = size - (top - sp);
+#elif defined(TARGET_OS_UNIXBSD) && defined(__GLIBC__)
+  pthread_attr_t attr;
+
+  if (pthread_getattr_np(pthread_self(), &attr) == 0)
+  {
+    void   *addr;
+    size_t size;
+
+    // addr is the lowest address of the stack
+    if ((pthread_attr_getstack(&attr, &addr, &size) == 0) && (sp >= (uintptr_t)addr) && (sp < ((uintptr_t)addr + size))) available = sp - (uintptr_t)addr;
+    pthread_attr_destroy(&attr);
+  }
+#endif
+
+  // otherwise assume a conservative size (the requested size may not have been applied)
+  if (!available) available = stacksize ? std::min(stacksize, (size_t)PREFAULT_DEFAULT_STACK) : PREFAULT_DEFAULT_STACK;
+
+  return available;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Touch bytes of stack below the caller so that the pages are mapped before they are needed
+ *
+ * @param bytes number of bytes requested
+ * @param stacksize stack size requested for the thread (0 for default)
+ *
+ * @return number of bytes touched (limited to the stack available less a safety margin)
+ */
+/*--------------------------------------------------------------------------------*/
+static size_t PrefaultStack(size_t bytes, size_t stacksize)
+{
+  size_t available = GetAvailableStack(stacksize);
+
+  // alloca() beyond the end of the stack would crash the thread
+  available = (available > PREFAULT_STACK_MARGIN) ? available - PREFAULT_STACK_MARGIN : 0;
+  if (bytes > available)
+  {
+    BBCDEBUG1(("Limiting stack prefault from %s to %s bytes", StringFrom(bytes).c_str(), StringFrom(available).c_str()));
+    bytes = available;
+  }
+
+  if (bytes)
+  {
+#ifdef TARGET_OS_WINDOWS
+    volatile uint8_t *p = (volatile uint8_t *)_alloca(bytes);
+#else
+    volatile uint8_t *p = (volatile uint8_t *)alloca(bytes);
+#endif
+    size_t i;
+
+    for (i = 0; i < bytes; i += 4096) p[i] = 0;
+  }
+
+  return bytes;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Apply attributes (except stack size) to the calling thread
+ *
+ * @param prefaultstack optional ptr to receive the number of bytes of stack actually prefaulted
+ *
+ * @return combination of ATTRIBUTE_xxx flags for the attributes successfully applied
+ *
+ * @note this can be used for threads not created by this class (e.g. audio callbacks)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Thread::ApplyToCurrentThread(const ATTRIBUTES& attr, size_t *prefaultstack)
+{
+  uint_t applied = 0;
+
+#ifdef TARGET_OS_WINDOWS
+  if (attr.policy != POLICY_DEFAULT)
+  {
+    // there are no real-time policies so use the highest priorities
+    if (SetThreadPriority(GetCurrentThread(), (attr.policy == POLICY_FIFO) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST)) applied |= ATTRIBUTE_PRIORITY;
+    else BBCDEBUG1(("Failed to set thread priority (error %lu), using default scheduling", (ulong_t)GetLastError()));
+  }
+
+  if (attr.affinity)
+  {
+    if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)attr.affinity)) applied |= ATTRIBUTE_AFFINITY;
+    else BBCDEBUG1(("Failed to set thread CPU affinity (error %lu), using any CPU", (ulong_t)GetLastError()));
+  }
+
+  if (!attr.name.empty()) BBCDEBUG1(("Thread naming not supported on this platform"));
+  if (attr.lockmemory)    BBCDEBUG1(("Memory locking not supported on this platform"));
+#else
+  int res;
+
+  if (attr.policy != POLICY_DEFAULT)
+  {
+    struct sched_param param;
+    int policy = (attr.policy == POLICY_FIFO) ? SCHED_FIFO : SCHED_RR;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = limited::limit(attr.priority, sched_get_priority_min(policy), sched_get_priority_max(policy));
+
+    // usually fails with EPERM without CAP_SYS_NICE or an rtprio limit
+    if ((res = pthread_setschedparam(pthread_self(), policy, &param)) == 0) applied |= ATTRIBUTE_PRIORITY;
+    else BBCDEBUG1(("Failed to set real-time priority %d (%s), using default scheduling", param.sched_priority, strerror(res)));
+  }
+
+  if (attr.affinity)
+  {
+#ifdef __APPLE__
+    BBCDEBUG1(("Thread CPU affinity not supported on this platform"));
+#else
+    cpu_set_t cpus;
+    uint_t    i;
+
+    CPU_ZERO(&cpus);
+    for (i = 0; (i < 64) && (i < CPU_SETSIZE); i++)
+    {
+      if (attr.affinity & ((uint64_t)1 << i)) CPU_SET(i, &cpus);
+    }
+
+    if ((res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) == 0) applied |= ATTRIBUTE_AFFINITY;
+    else BBCDEBUG1(("Failed to set thread CPU affinity to 0x%s (%s), using any CPU", StringFrom(attr.affinity, "016x").c_str(), strerror(res)));
+#endif
+  }
+
+  if (!attr.name.empty())
+  {
+#ifdef __APPLE__
+    // can only name the calling thread
+    res = pthread_setname_np(attr.name.c_str());
+#else
+    // Linux limits names to 15 characters
+    res = pthread_setname_np(pthread_self(), attr.name.substr(0, 15).c_str());
+#endif
+    if (res == 0) applied |= ATTRIBUTE_NAME;
+    else BBCDEBUG1(("Failed to set thread name to '%s' (%s)", attr.name.c_str(), strerror(res)));
+  }
+
+  if (attr.lockmemory)
+  {
+    // usually fails with EPERM or ENOMEM without CAP_IPC_LOCK or a big enough memlock limit
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) applied |= ATTRIBUTE_LOCKMEMORY;
+    else BBCDEBUG1(("Failed to lock memory (%s), memory may be paged out", strerror(errno)));
+  }
+#endif
+
+  if (attr.prefaultstack)
+  {
+    size_t bytes = PrefaultStack(attr.prefaultstack, attr.stacksize);
+
+    if (bytes) applied |= ATTRIBUTE_PREFAULTSTACK;
+    if (prefaultstack) *prefaultstack = bytes;
+  }
+  else if (prefaultstack) *prefaultstack = 0;
+
+  return applied;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Apply attributes to the thread (called by the thread itself on start)
+ */
+/*--------------------------------------------------------------------------------*/
+void Thread::ApplyAttributes()
+{
+  size_t bytes;
+
+  appliedattributes |= ApplyToCurrentThread(attributes, &bytes);
+  prefaultedstack    = bytes;
+}
+
 /*--------------------------------------------------------------------------------*/
 /** Main thread entry point (non-overridable)
  */
@@ -217,6 +467,7 @@ void *Thread::RunEx()
 {
   void *res;
   
+  ApplyAttributes();
   res = Run();
 
   // if not aborted, mark as completed
@@ -6,9 +6,10 @@
 #else
 #include <thread>
 #include <type_traits>
-#include <atomic>
 #endif
 
+#include <atomic>
+
 // include early for section below
 #include "OSCompiler.h"
 
@@ -18,6 +19,8 @@
 #define HAVE_STRUCT_TIMESPEC
 #endif
 
+#include <string>
+
 #include "misc.h"
 
 BBC_AUDIOTOOLBOX_START
@@ -26,6 +29,12 @@ BBC_AUDIOTOOLBOX_START
 /** Simple class representing a thread
  *
  * This can either be derived from (and overriding Run()) or can use a callback mechanism
+ *
+ * Scheduling attributes (real-time priority, CPU affinity, stack size, name and memory
+ * locking) can be set using SetAttributes() before the thread is started.  They are
+ * applied by the thread itself when it starts and any that cannot be applied (for
+ * example because permission is denied) are skipped with a debug message so that the
+ * thread still runs with default scheduling (see GetAppliedAttributes())
  */
 /*--------------------------------------------------------------------------------*/
 class Thread
@@ -37,6 +46,46 @@ public:
   /*--------------------------------------------------------------------------------*/
   typedef void *(*THREADCALL)(Thread& thread, void *arg);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Scheduling policies
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef enum
+  {
+    POLICY_DEFAULT = 0,           ///< normal time-shared scheduling
+    POLICY_FIFO,                  ///< real-time first-in first-out (SCHED_FIFO)
+    POLICY_RR,                    ///< real-time round-robin (SCHED_RR)
+  } POLICY;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Thread attributes
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    POLICY      policy;           ///< scheduling policy
+    int         priority;         ///< real-time priority (clamped to the range allowed for policy)
+    uint64_t    affinity;         ///< mask of CPUs the thread may run on (0 for any)
+    size_t      stacksize;        ///< stack size in bytes (0 for default, only supported in USE_PTHREADS builds)
+    std::string name;             ///< thread name shown in debuggers and profilers (truncated to 15 characters on Linux)
+    bool        lockmemory;       ///< lock all current and future memory of the *process* into RAM (mlockall())
+    size_t      prefaultstack;    ///< number of bytes of stack to touch on start so that it does not page fault later (limited to the stack available)
+  } ATTRIBUTES;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Flags returned by GetAppliedAttributes()
+   */
+  /*--------------------------------------------------------------------------------*/
+  enum
+  {
+    ATTRIBUTE_PRIORITY      = 1,
+    ATTRIBUTE_AFFINITY      = 2,
+    ATTRIBUTE_STACKSIZE     = 4,
+    ATTRIBUTE_NAME          = 8,
+    ATTRIBUTE_LOCKMEMORY    = 16,
+    ATTRIBUTE_PREFAULTSTACK = 32,
+  };
+
   /*--------------------------------------------------------------------------------*/
   /** Default constructor - can start derived class thread
    */
@@ -129,6 +178,51 @@ public:
   /*--------------------------------------------------------------------------------*/
   bool HasFinished() const {return threadfinished;}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Return default attributes (default scheduling, no affinity, default stack size, no name)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static ATTRIBUTES GetDefaultAttributes();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set attributes to be used when the thread is next started
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetAttributes(const ATTRIBUTES& attr) {attributes = attr;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return attributes to be used when the thread is started
+   */
+  /*--------------------------------------------------------------------------------*/
+  const ATTRIBUTES& GetAttributes() const {return attributes;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return which of the non-default attributes were successfully applied when the thread started
+   *
+   * @param prefaultstack optional ptr to receive the number of bytes of stack actually prefaulted
+   * (prefaultstack limited to the stack available)
+   *
+   * @return combination of ATTRIBUTE_xxx flags
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetAppliedAttributes(size_t *prefaultstack = NULL) const
+  {
+    if (prefaultstack) *prefaultstack = prefaultedstack;
+    return appliedattributes;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Apply attributes (except stack size) to the calling thread
+   *
+   * @param prefaultstack optional ptr to receive the number of bytes of stack actually prefaulted
+   *
+   * @return combination of ATTRIBUTE_xxx flags for the attributes successfully applied
+   *
+   * @note this can be used for threads not created by this class (e.g. audio callbacks)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint_t ApplyToCurrentThread(const ATTRIBUTES& attr, size_t *prefaultstack = NULL);
+
 protected:
   static void *__ThreadEntry(void *arg)
   {
@@ -141,6 +235,12 @@ protected:
   /*--------------------------------------------------------------------------------*/
   void *RunEx();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Apply attributes to the thread (called by the thread itself on start)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ApplyAttributes();
+
   /*--------------------------------------------------------------------------------*/
   /** Overridable thread routine
    */
@@ -173,6 +273,9 @@ protected:
   bool       abortthread;
   bool       threadcompleted;
   bool       threadfinished;
+  ATTRIBUTES attributes;
+  std::atomic<uint_t> appliedattributes;
+  std::atomic<size_t> prefaultedstack;
 };
 
 BBC_AUDIOTOOLBOX_END
@@ -1,15 +1,102 @@
 
 #include <string.h>
+#include <time.h>
 
 #include <errno.h>
 
+#include <chrono>
+#include <algorithm>
+
+#include "OSCompiler.h"
+
+#if defined(COMPILER_MSVC) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
 #define BBCDEBUG_LEVEL 1
 #include "misc.h"
 #include "ThreadLock.h"
 
 BBC_AUDIOTOOLBOX_START
 
-ThreadLockObject::ThreadLockObject()
+#if ENABLE_LOCK_PROFILING
+/*--------------------------------------------------------------------------------*/
+/** Return list of every ThreadLockObject and the lock that protects it
+ *
+ * @note neither is ever destroyed so that locks can be destroyed during static destruction
+ */
+/*--------------------------------------------------------------------------------*/
+static std::vector<ThreadLockObject *>& GetLockList()
+{
+  static std::vector<ThreadLockObject *> *_list = new std::vector<ThreadLockObject *>;
+  return *_list;
+}
+
+static ThreadMutexObject& GetLockListLock()
+{
+  static ThreadMutexObject *_lock = new ThreadMutexObject;
+  return *_lock;
+}
+#endif
+
+#ifdef USE_PTHREADS
+// timed condition waits use the monotonic clock where it can be selected so that they are
+// not affected by changes to the wall clock
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__) && !defined(COMPILER_MSVC)
+#define CONDITION_CLOCK CLOCK_MONOTONIC
+#endif
+
+/*--------------------------------------------------------------------------------*/
+/** Initialise condition variable for use with GetConditionDeadline()
+ */
+/*--------------------------------------------------------------------------------*/
+static int InitCondition(pthread_cond_t *condition)
+{
+#ifdef CONDITION_CLOCK
+  pthread_condattr_t attr;
+  int res;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CONDITION_CLOCK);
+  res = pthread_cond_init(condition, &attr);
+  pthread_condattr_destroy(&attr);
+
+  return res;
+#else
+  return pthread_cond_init(condition, NULL);
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return absolute time for pthread_cond_timedwait() timeout ms from now
+ */
+/*--------------------------------------------------------------------------------*/
+static struct timespec GetConditionDeadline(uint_t timeout)
+{
+  struct timespec ts;
+
+#ifdef CONDITION_CLOCK
+  clock_gettime(CONDITION_CLOCK, &ts);
+#else
+  std::chrono::nanoseconds now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+  ts.tv_sec  = (time_t)(now.count() / 1000000000);
+  ts.tv_nsec = (long)(now.count() % 1000000000);
+#endif
+
+  ts.tv_sec  += (time_t)(timeout / 1000);
+  ts.tv_nsec += (long)(timeout % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000)
+  {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+
+  return ts;
+}
+#endif
+
+ThreadLockObject::ThreadLockObject(const char *_name)
 #ifndef USE_PTHREADS
   : lock(mutex, std::defer_lock)
 #endif
@@ -26,18 +113,94 @@ ThreadLockObject::ThreadLockObject()
     BBCERROR("Failed to initialise mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(errno));
   }
 #endif
+
+#if ENABLE_LOCK_PROFILING
+  depth     = 0;
+  holdstart = 0;
+  if (_name) name = _name;
+
+  acquisitions = contended = totalwait = maxwait = totalhold = maxhold = 0;
+
+  {
+    ThreadMutexLock lock(GetLockListLock());
+    GetLockList().push_back(this);
+  }
+#else
+  UNUSED_PARAMETER(_name);
+#endif
 }
 
 ThreadLockObject::~ThreadLockObject()
 {
+#if ENABLE_LOCK_PROFILING
+  {
+    ThreadMutexLock lock(GetLockListLock());
+    std::vector<ThreadLockObject *>& list = GetLockList();
+    std::vector<ThreadLockObject *>::iterator it;
+
+    if ((it = std::find(list.begin(), list.end(), this)) != list.end()) list.erase(it);
+  }
+#endif
+
 #ifdef USE_PTHREADS
   pthread_mutex_destroy(&mutex);
 #endif
 }
 
+#if ENABLE_LOCK_PROFILING
+/*--------------------------------------------------------------------------------*/
+/** Set name of lock for profiling
+ */
+/*--------------------------------------------------------------------------------*/
+void ThreadLockObject::SetName(const char *_name)
+{
+  // names are protected by the list lock so that reading them does not affect the statistics
+  ThreadMutexLock lock(GetLockListLock());
+  name = _name ? _name : "";
+}
+#endif
+
 bool ThreadLockObject::Lock()
 {
+#if ENABLE_LOCK_PROFILING
+  uint64_t start = 0;
+  bool     success;
+
+  // only time the wait if the lock is held by another thread
 #ifdef USE_PTHREADS
+  if (pthread_mutex_trylock(&mutex) != 0)
+  {
+    start   = GetNanosecondTicks();
+    success = (pthread_mutex_lock(&mutex) == 0);
+    if (!success) BBCERROR("Failed to lock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(errno));
+  }
+  else success = true;
+#else
+  if (!mutex.try_lock())
+  {
+    start = GetNanosecondTicks();
+    mutex.lock();
+  }
+  success = true;
+#endif
+
+  if (success && !depth++)
+  {
+    holdstart = GetNanosecondTicks();
+
+    acquisitions++;
+    if (start)
+    {
+      uint64_t wait = holdstart - start;
+
+      contended++;
+      totalwait += wait;
+      if (wait > maxwait) maxwait = wait;
+    }
+  }
+
+  return success;
+#elif defined(USE_PTHREADS)
   bool success = (pthread_mutex_lock(&mutex) == 0);
 
   if (!success) BBCERROR("Failed to lock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(errno));
@@ -51,18 +214,255 @@ bool ThreadLockObject::Lock()
 
 bool ThreadLockObject::Unlock()
 {
+#if ENABLE_LOCK_PROFILING
+  // must be measured before the lock is released
+  if (depth && !--depth)
+  {
+    uint64_t hold = GetNanosecondTicks() - holdstart;
+
+    totalhold += hold;
+    if (hold > maxhold) maxhold = hold;
+  }
+#endif
+
 #ifdef USE_PTHREADS
   bool success = (pthread_mutex_unlock(&mutex) == 0);
 
   if (!success) BBCERROR("Failed to unlock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(errno));
 
   return success;
+#elif ENABLE_LOCK_PROFILING
+  mutex.unlock();
+  return true;
 #else
   lock.unlock();
   return true;
 #endif
 }
 
+/*--------------------------------------------------------------------------------*/
+/** End the hold period before waiting on a condition using mutex (which releases it)
+ *
+ * @return state to pass to ResumeHold() once the wait has returned
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t ThreadLockObject::SuspendHold()
+{
+#if ENABLE_LOCK_PROFILING
+  uint_t state = depth;
+
+  if (depth)
+  {
+    uint64_t hold = GetNanosecondTicks() - holdstart;
+
+    totalhold += hold;
+    if (hold > maxhold) maxhold = hold;
+  }
+
+  // other threads will take the lock whilst this thread waits
+  depth = 0;
+
+  return state;
+#else
+  return 0;
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Restart the hold period (and count the re-acquisition) after waiting on a condition
+ *
+ * @param state value returned by SuspendHold()
+ */
+/*--------------------------------------------------------------------------------*/
+void ThreadLockObject::ResumeHold(uint_t state)
+{
+#if ENABLE_LOCK_PROFILING
+  if ((depth = state) > 0)
+  {
+    holdstart = GetNanosecondTicks();
+    acquisitions++;
+  }
+#else
+  UNUSED_PARAMETER(state);
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return statistics of this lock (all zero without ENABLE_LOCK_PROFILING)
+ */
+/*--------------------------------------------------------------------------------*/
+ThreadLockObject::STATS ThreadLockObject::GetStats() const
+{
+#if ENABLE_LOCK_PROFILING
+  ThreadMutexLock lock(GetLockListLock());
+  return GetStatsEx();
+#else
+  STATS stats;
+
+  stats.name         = StringFrom(this);
+  stats.acquisitions = stats.contended = stats.totalwait = stats.maxwait = stats.totalhold = stats.maxhold = 0;
+
+  return stats;
+#endif
+}
+
+#if ENABLE_LOCK_PROFILING
+/*--------------------------------------------------------------------------------*/
+/** Return statistics of this lock
+ *
+ * @note the list lock MUST be held
+ */
+/*--------------------------------------------------------------------------------*/
+ThreadLockObject::STATS ThreadLockObject::GetStatsEx() const
+{
+  STATS stats;
+
+  stats.name         = name.empty() ? StringFrom(this) : name;
+  stats.acquisitions = acquisitions;
+  stats.contended    = contended;
+  stats.totalwait    = totalwait;
+  stats.maxwait      = maxwait;
+  stats.totalhold    = totalhold;
+  stats.maxhold      = maxhold;
+
+  return stats;
+}
+#endif
+
+static bool __CompareStats(const ThreadLockObject::STATS& a, const ThreadLockObject::STATS& b)
+{
+  return (a.totalwait > b.totalwait);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return statistics of every lock that has been taken, most waited for first
+ */
+/*--------------------------------------------------------------------------------*/
+void ThreadLockObject::GetAllStats(std::vector<STATS>& list)
+{
+  list.clear();
+
+#if ENABLE_LOCK_PROFILING
+  {
+    ThreadMutexLock lock(GetLockListLock());
+    const std::vector<ThreadLockObject *>& locks = GetLockList();
+    uint_t i;
+
+    for (i = 0; i < locks.size(); i++)
+    {
+      if (locks[i]->acquisitions) list.push_back(locks[i]->GetStatsEx());
+    }
+  }
+#endif
+
+  std::stable_sort(list.begin(), list.end(), &__CompareStats);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset statistics of every lock
+ */
+/*--------------------------------------------------------------------------------*/
+void ThreadLockObject::ResetAllStats()
+{
+#if ENABLE_LOCK_PROFILING
+  ThreadMutexLock lock(GetLockListLock());
+  const std::vector<ThreadLockObject *>& locks = GetLockList();
+  uint_t i;
+
+  for (i = 0; i < locks.size(); i++)
+  {
+    ThreadLockObject& obj = *locks[i];
+    obj.acquisitions = obj.contended = obj.totalwait = obj.maxwait = obj.totalhold = obj.maxhold = 0;
+  }
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return textual lock contention report
+ */
+/*--------------------------------------------------------------------------------*/
+std::string ThreadLockObject::GetReport()
+{
+  std::vector<STATS> list;
+  std::string res;
+
+  GetAllStats(list);
+
+  if (list.size())
+  {
+    std::string fmt;
+    uint_t i, maxlen = 0;
+
+    Printf(res, "Lock contention summary:\n");
+
+    // find maximum name length
+    for (i = 0; i < list.size(); i++) maxlen = std::max(maxlen, (uint_t)list[i].name.length());
+
+    // create format string (with name length found above)
+    Printf(fmt, "%%3u: '%%-%us' taken %%10s contended %%10s (%%5.1lf%%%%) wait %%14.9lfs (max %%12.9lfs) hold %%14.9lfs (max %%12.9lfs)\n", maxlen);
+
+    for (i = 0; i < list.size(); i++)
+    {
+      const STATS& stats = list[i];
+
+      Printf(res,
+             fmt.c_str(),
+             i,
+             stats.name.c_str(),
+             StringFrom(stats.acquisitions).c_str(),
+             StringFrom(stats.contended).c_str(),
+             100.0 * (double)stats.contended / (double)stats.acquisitions,
+             (double)stats.totalwait * 1.0e-9,
+             (double)stats.maxwait * 1.0e-9,
+             (double)stats.totalhold * 1.0e-9,
+             (double)stats.maxhold * 1.0e-9);
+    }
+  }
+
+  return res;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return lock contention report as a JSON array of objects (one per lock)
+ */
+/*--------------------------------------------------------------------------------*/
+std::string ThreadLockObject::GetReportJSON()
+{
+  std::vector<STATS> list;
+  std::string res = "[";
+  uint_t i, j;
+
+  GetAllStats(list);
+
+  for (i = 0; i < list.size(); i++)
+  {
+    const STATS& stats = list[i];
+    std::string  name;
+
+    // escape name
+    for (j = 0; j < stats.name.length(); j++)
+    {
+      char c = stats.name[j];
+      if ((c == '"') || (c == '\\')) name += '\\';
+      name += c;
+    }
+
+    Printf(res, "%s{\"name\": \"%s\", \"acquisitions\": %s, \"contended\": %s, \"totalwait\": %s, \"maxwait\": %s, \"totalhold\": %s, \"maxhold\": %s}",
+           i ? ", " : "",
+           name.c_str(),
+           StringFrom(stats.acquisitions).c_str(),
+           StringFrom(stats.contended).c_str(),
+           StringFrom(stats.totalwait).c_str(),
+           StringFrom(stats.maxwait).c_str(),
+           StringFrom(stats.totalhold).c_str(),
+           StringFrom(stats.maxhold).c_str());
+  }
+
+  res += "]";
+
+  return res;
+}
+
 /*----------------------------------------------------------------------------------------------------*/
 
 /*--------------------------------------------------------------------------------*/
@@ -70,13 +470,13 @@ bool ThreadLockObject::Unlock()
  */
 /*--------------------------------------------------------------------------------*/
 ThreadLock::ThreadLock(ThreadLockObject& lockobj) :
-#ifdef USE_PTHREADS
+#if defined(USE_PTHREADS) || ENABLE_LOCK_PROFILING
   obj(lockobj)
 #else
   guard(lockobj.mutex)
 #endif
 {
-#ifdef USE_PTHREADS
+#if defined(USE_PTHREADS) || ENABLE_LOCK_PROFILING
   obj.Lock();
 #endif
 }
@@ -86,13 +486,13 @@ ThreadLock::ThreadLock(ThreadLockObject& lockobj) :
  */
 /*--------------------------------------------------------------------------------*/
 ThreadLock::ThreadLock(const ThreadLockObject& lockobj) :
-#ifdef USE_PTHREADS
+#if defined(USE_PTHREADS) || ENABLE_LOCK_PROFILING
   obj(const_cast<ThreadLockObject&>(lockobj))
 #else
   guard(const_cast<ThreadLockObject&>(lockobj).mutex)
 #endif
 {
-#ifdef USE_PTHREADS
+#if defined(USE_PTHREADS) || ENABLE_LOCK_PROFILING
   obj.Lock();
 #endif
 }
@@ -103,22 +503,196 @@ ThreadLock::ThreadLock(const ThreadLockObject& lockobj) :
 /*--------------------------------------------------------------------------------*/
 ThreadLock::~ThreadLock()
 {
-#ifdef USE_PTHREADS
+#if defined(USE_PTHREADS) || ENABLE_LOCK_PROFILING
   obj.Unlock();
 #endif
 }
 
 /*----------------------------------------------------------------------------------------------------*/
 
+ThreadMutexObject::ThreadMutexObject()
+{
+#ifdef USE_PTHREADS
+  if (pthread_mutex_init(&mutex, NULL) != 0)
+  {
+    BBCERROR("Failed to initialise mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(errno));
+  }
+#endif
+}
+
+ThreadMutexObject::~ThreadMutexObject()
+{
+#ifdef USE_PTHREADS
+  pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void ThreadMutexObject::Lock()
+{
+#ifdef USE_PTHREADS
+  int res;
+  if ((res = pthread_mutex_lock(&mutex)) != 0) BBCERROR("Failed to lock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(res));
+#else
+  mutex.lock();
+#endif
+}
+
+void ThreadMutexObject::Unlock()
+{
+#ifdef USE_PTHREADS
+  int res;
+  if ((res = pthread_mutex_unlock(&mutex)) != 0) BBCERROR("Failed to unlock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(res));
+#else
+  mutex.unlock();
+#endif
+}
+
+bool ThreadMutexObject::TryLock()
+{
+#ifdef USE_PTHREADS
+  return (pthread_mutex_trylock(&mutex) == 0);
+#else
+  return mutex.try_lock();
+#endif
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+const uint_t ThreadAdaptiveLockObject::DefaultSpins = 100;
+
+/*--------------------------------------------------------------------------------*/
+/** Tell the CPU that this is a spin-wait loop
+ */
+/*--------------------------------------------------------------------------------*/
+static inline void CPURelax()
+{
+#if defined(COMPILER_MSVC) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#elif defined(COMPILER_GCC) && (defined(__i386__) || defined(__x86_64__))
+  __builtin_ia32_pause();
+#elif defined(COMPILER_GCC) && defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+void ThreadAdaptiveLockObject::Lock()
+{
+  uint_t i;
+
+  for (i = 0; i < spins; i++)
+  {
+    if (mutex.TryLock()) return;
+    CPURelax();
+  }
+
+  // held for too long, sleep until it is released
+  mutex.Lock();
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+ThreadRWLockObject::ThreadRWLockObject()
+#ifndef USE_PTHREADS
+  : readers(0),
+    waitingwriters(0),
+    writer(false)
+#endif
+{
+#ifdef USE_PTHREADS
+  pthread_rwlockattr_t attr;
+
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  // glibc prefers readers by default which can starve writers
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+
+  if (pthread_rwlock_init(&rwlock, &attr) != 0)
+  {
+    BBCERROR("Failed to initialise rwlock<%s>: %s", StringFrom(&rwlock).c_str(), strerror(errno));
+  }
+
+  pthread_rwlockattr_destroy(&attr);
+#endif
+}
+
+ThreadRWLockObject::~ThreadRWLockObject()
+{
+#ifdef USE_PTHREADS
+  pthread_rwlock_destroy(&rwlock);
+#endif
+}
+
+void ThreadRWLockObject::ReadLock()
+{
+#ifdef USE_PTHREADS
+  int res;
+  if ((res = pthread_rwlock_rdlock(&rwlock)) != 0) BBCERROR("Failed to read lock rwlock<%s>: %s", StringFrom(&rwlock).c_str(), strerror(res));
+#else
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // waiting writers take priority over new readers
+  while (writer || waitingwriters) readcondition.wait(lock);
+  readers++;
+#endif
+}
+
+void ThreadRWLockObject::ReadUnlock()
+{
+#ifdef USE_PTHREADS
+  int res;
+  if ((res = pthread_rwlock_unlock(&rwlock)) != 0) BBCERROR("Failed to unlock rwlock<%s>: %s", StringFrom(&rwlock).c_str(), strerror(res));
+#else
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // last reader out lets a writer in
+  if (!--readers && waitingwriters) writecondition.notify_one();
+#endif
+}
+
+void ThreadRWLockObject::WriteLock()
+{
+#ifdef USE_PTHREADS
+  int res;
+  if ((res = pthread_rwlock_wrlock(&rwlock)) != 0) BBCERROR("Failed to write lock rwlock<%s>: %s", StringFrom(&rwlock).c_str(), strerror(res));
+#else
+  std::unique_lock<std::mutex> lock(mutex);
+
+  waitingwriters++;
+  while (writer || readers) writecondition.wait(lock);
+  waitingwriters--;
+  writer = true;
+#endif
+}
+
+void ThreadRWLockObject::WriteUnlock()
+{
+#ifdef USE_PTHREADS
+  int res;
+  if ((res = pthread_rwlock_unlock(&rwlock)) != 0) BBCERROR("Failed to unlock rwlock<%s>: %s", StringFrom(&rwlock).c_str(), strerror(res));
+#else
+  std::unique_lock<std::mutex> lock(mutex);
+
+  writer = false;
+
+  // hand over to the next writer if there is one, otherwise let all readers in
+  if (waitingwriters) writecondition.notify_one();
+  else                readcondition.notify_all();
+#endif
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
 ThreadSignalObject::ThreadSignalObject()
 #ifdef USE_PTHREADS
   : ThreadLockObject()
 #endif
 {
 #ifdef USE_PTHREADS
-  if (pthread_cond_init(&condition, NULL) != 0)
+  int res;
+  if ((res = InitCondition(&condition)) != 0)
   {
-    BBCERROR("Failed to initialise cond<%s>: %s", StringFrom(&condition).c_str(), strerror(errno));
+    BBCERROR("Failed to initialise cond<%s>: %s", StringFrom(&condition).c_str(), strerror(res));
   }
 #endif
 }
@@ -145,7 +719,10 @@ bool ThreadSignalObject::Wait()
     BBCDEBUG2(("[%s] ThreadSignalObject<%s>: Waiting on condition<%s> waiting", StringFrom(GetTickCount(), "010").c_str(), StringFrom(this).c_str(), StringFrom(&condition).c_str()));
 
 #ifdef USE_PTHREADS
+    // time spent waiting for the condition is not time spent holding the lock
+    uint_t state = SuspendHold();
     success = (pthread_cond_wait(&condition, &mutex) == 0);
+    ResumeHold(state);
     if (!success)
     {
       BBCERROR("Failed to wait on cond<%s>: %s", StringFrom(&condition).c_str(), strerror(errno));
@@ -165,6 +742,52 @@ bool ThreadSignalObject::Wait()
   return success;
 }
 
+bool ThreadSignalObject::TimedWait(uint_t timeout)
+{
+  BBCDEBUG2(("[%s] ThreadSignalObject<%s>: Timed wait (%ums) on condition<%s> pre-lock", StringFrom(GetTickCount(), "010").c_str(), StringFrom(this).c_str(), timeout, StringFrom(&condition).c_str()));
+
+  // calculate absolute timeout from now (using a clock that does not follow changes to the wall clock)
+#ifdef USE_PTHREADS
+  struct timespec ts = GetConditionDeadline(timeout);
+
+  ThreadLock lock(*this);
+#else
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+  std::unique_lock<std::mutex> lock(mutex);
+#endif
+  bool success = true;
+
+  while (success && !IsReady())
+  {
+#ifdef USE_PTHREADS
+    // time spent waiting for the condition is not time spent holding the lock
+    uint_t state = SuspendHold();
+    int    res   = pthread_cond_timedwait(&condition, &mutex, &ts);
+    ResumeHold(state);
+    if (res == ETIMEDOUT) success = false;
+    else if (res != 0)
+    {
+      BBCERROR("Failed to wait on cond<%s>: %s", StringFrom(&condition).c_str(), strerror(res));
+      success = false;
+    }
+#else
+    if (condition.wait_until(lock, deadline) == std::cv_status::timeout) success = false;
+#endif
+  }
+
+  // condition may have been triggered at the same time as the timeout
+  if (IsReady())
+  {
+    ClearReady();
+    success = true;
+  }
+
+  BBCDEBUG2(("[%s] ThreadSignalObject<%s>: Timed wait on condition<%s> %s", StringFrom(GetTickCount(), "010").c_str(), StringFrom(this).c_str(), StringFrom(&condition).c_str(), success ? "complete" : "timed out"));
+
+  return success;
+}
+
 bool ThreadSignalObject::Signal()
 {
   BBCDEBUG2(("[%s] ThreadSignalObject<%s>: Signal condition<%s> pre-lock", StringFrom(GetTickCount(), "010").c_str(), StringFrom(this).c_str(), StringFrom(&condition).c_str()));
@@ -230,4 +853,200 @@ ThreadBoolSignalObject::~ThreadBoolSignalObject()
 {
 }
 
+/*----------------------------------------------------------------------------------------------------*/
+
+ThreadWaitObject::ThreadWaitObject(uint_t _spins) : sleepers(0),
+                                                    spins(_spins)
+{
+#ifdef USE_PTHREADS
+  int res;
+
+  if (pthread_mutex_init(&mutex, NULL) != 0)
+  {
+    BBCERROR("Failed to initialise mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(errno));
+  }
+  if ((res = InitCondition(&condition)) != 0)
+  {
+    BBCERROR("Failed to initialise cond<%s>: %s", StringFrom(&condition).c_str(), strerror(res));
+  }
+#endif
+}
+
+ThreadWaitObject::~ThreadWaitObject()
+{
+#ifdef USE_PTHREADS
+  pthread_cond_destroy(&condition);
+  pthread_mutex_destroy(&mutex);
+#endif
+}
+
+bool ThreadWaitObject::WaitFor(uint_t token, const uint_t *timeout)
+{
+  uint_t i;
+  bool   success;
+
+  // the condition is often met very soon so spin briefly before sleeping
+  for (i = 0; i <= spins; i++)
+  {
+    if (TryContinue(token)) return true;
+    CPURelax();
+  }
+
+  if (timeout && !*timeout) return false;
+
+  // calculate absolute timeout from now (using a clock that does not follow changes to the wall clock)
+#ifdef USE_PTHREADS
+  struct timespec ts = GetConditionDeadline(timeout ? *timeout : 0);
+  int res;
+
+  if ((res = pthread_mutex_lock(&mutex)) != 0) BBCERROR("Failed to lock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(res));
+#else
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout ? *timeout : 0);
+
+  std::unique_lock<std::mutex> lock(mutex);
+#endif
+
+  // announce sleeping *before* checking the condition again so that Wake() cannot miss this thread
+  sleepers++;
+
+  while (!(success = TryContinue(token)))
+  {
+#ifdef USE_PTHREADS
+    res = timeout ? pthread_cond_timedwait(&condition, &mutex, &ts) : pthread_cond_wait(&condition, &mutex);
+    if (res == ETIMEDOUT)
+    {
+      // condition may have been met at the same time as the timeout
+      success = TryContinue(token);
+      break;
+    }
+    else if (res != 0)
+    {
+      BBCERROR("Failed to wait on cond<%s>: %s", StringFrom(&condition).c_str(), strerror(res));
+      break;
+    }
+#else
+    if (!timeout) condition.wait(lock);
+    else if (condition.wait_until(lock, deadline) == std::cv_status::timeout)
+    {
+      // condition may have been met at the same time as the timeout
+      success = TryContinue(token);
+      break;
+    }
+#endif
+  }
+
+  sleepers--;
+
+#ifdef USE_PTHREADS
+  pthread_mutex_unlock(&mutex);
+#endif
+
+  return success;
+}
+
+void ThreadWaitObject::Wake(bool all)
+{
+  // the state has already been changed so a thread that is not yet counted as
+  // sleeping will see the change when it checks the condition again
+  if (sleepers)
+  {
+#ifdef USE_PTHREADS
+    int res;
+
+    if ((res = pthread_mutex_lock(&mutex)) != 0) BBCERROR("Failed to lock mutex<%s>: %s", StringFrom(&mutex).c_str(), strerror(res));
+    if ((res = (all ? pthread_cond_broadcast(&condition) : pthread_cond_signal(&condition))) != 0)
+    {
+      BBCERROR("Failed to signal cond<%s>: %s", StringFrom(&condition).c_str(), strerror(res));
+    }
+    pthread_mutex_unlock(&mutex);
+#else
+    std::unique_lock<std::mutex> lock(mutex);
+    if (all) condition.notify_all();
+    else     condition.notify_one();
+#endif
+  }
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+const uint_t ThreadSemaphoreObject::DefaultSpins = 100;
+
+ThreadSemaphoreObject::ThreadSemaphoreObject(uint_t initial_count, uint_t _spins) : ThreadWaitObject(_spins),
+                                                                                    count(initial_count)
+{
+}
+
+ThreadSemaphoreObject::~ThreadSemaphoreObject()
+{
+}
+
+void ThreadSemaphoreObject::Post(uint_t n)
+{
+  if (n)
+  {
+    count += n;
+    Wake(n > 1);
+  }
+}
+
+bool ThreadSemaphoreObject::TryWait()
+{
+  uint_t n = count;
+
+  while (n)
+  {
+    if (count.compare_exchange_weak(n, n - 1)) return true;
+  }
+
+  return false;
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+ThreadLatchObject::ThreadLatchObject(uint_t initial_count, uint_t _spins) : ThreadWaitObject(_spins),
+                                                                            count(initial_count)
+{
+}
+
+ThreadLatchObject::~ThreadLatchObject()
+{
+}
+
+void ThreadLatchObject::CountDown(uint_t n)
+{
+  if (n && (count.fetch_sub(n) == n)) Wake(true);
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+ThreadBarrierObject::ThreadBarrierObject(uint_t _nthreads, uint_t _spins) : ThreadWaitObject(_spins),
+                                                                            nthreads(std::max(_nthreads, 1U)),
+                                                                            arrived(0),
+                                                                            phase(0)
+{
+}
+
+ThreadBarrierObject::~ThreadBarrierObject()
+{
+}
+
+bool ThreadBarrierObject::ArriveAndWait()
+{
+  // phase MUST be read before arriving otherwise the last thread could complete it first
+  uint_t token = phase;
+
+  if (++arrived == nthreads)
+  {
+    // reset for the next phase *before* releasing the other threads
+    arrived = 0;
+    phase++;
+    Wake(true);
+    return true;
+  }
+
+  WaitFor(token);
+
+  return false;
+}
+
 BBC_AUDIOTOOLBOX_END
@@ -8,6 +8,17 @@
 #include <condition_variable>
 #endif
 
+#include <string>
+#include <vector>
+
+// lock contention profiling is compiled out unless enabled (ENABLE_LOCK_PROFILING in CMake,
+// --enable-lock-profiling for configure)
+#ifndef ENABLE_LOCK_PROFILING
+#define ENABLE_LOCK_PROFILING 0
+#endif
+
+#include <atomic>
+
 BBC_AUDIOTOOLBOX_START
 
 /*--------------------------------------------------------------------------------*/
@@ -17,14 +28,80 @@ BBC_AUDIOTOOLBOX_START
  * within the class use a ThreadLock object.  On construction of the ThreadLock object the
  * ThreadLockObject will be locked and on destruction if the ThreadLock object the
  * ThreadLockObject will be unlocked
+ *
+ * When built with ENABLE_LOCK_PROFILING, every ThreadLockObject records how often it is
+ * taken, how often it had to be waited for and for how long and how long it is held for
+ * (recursive locking is counted once).  Naming locks makes the report (see GetReport())
+ * readable.  Without ENABLE_LOCK_PROFILING, names are ignored and there is no overhead
  */
 /*--------------------------------------------------------------------------------*/
 class ThreadLockObject
 {
 public:
-  ThreadLockObject();
+  ThreadLockObject(const char *_name = NULL);
   virtual ~ThreadLockObject();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Set name of lock for profiling
+   */
+  /*--------------------------------------------------------------------------------*/
+#if ENABLE_LOCK_PROFILING
+  void SetName(const char *_name);
+#else
+  void SetName(const char *_name) {UNUSED_PARAMETER(_name);}
+#endif
+
+  /*--------------------------------------------------------------------------------*/
+  /** Lock profiling statistics (all times in ns)
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef struct
+  {
+    std::string name;           ///< name of lock (or its address if it has not been named)
+    uint64_t    acquisitions;   ///< number of times the lock has been taken
+    uint64_t    contended;      ///< number of times the lock was held by another thread when it was taken
+    uint64_t    totalwait;      ///< total time spent waiting for the lock
+    uint64_t    maxwait;        ///< longest wait for the lock
+    uint64_t    totalhold;      ///< total time the lock was held
+    uint64_t    maxhold;        ///< longest time the lock was held
+  } STATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether lock profiling has been compiled in
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool IsProfilingEnabled() {return (ENABLE_LOCK_PROFILING != 0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return statistics of this lock (all zero without ENABLE_LOCK_PROFILING)
+   */
+  /*--------------------------------------------------------------------------------*/
+  STATS GetStats() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return statistics of every lock that has been taken, most waited for first
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void GetAllStats(std::vector<STATS>& list);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reset statistics of every lock
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void ResetAllStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return textual lock contention report
+   */
+  /*--------------------------------------------------------------------------------*/
+  static std::string GetReport();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return lock contention report as a JSON array of objects (one per lock)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static std::string GetReportJSON();
+
   /*--------------------------------------------------------------------------------*/
   /** Explicit lock of mutex (AVOID: use a ThreadLock object)
    */
@@ -41,6 +118,25 @@ public:
 protected:
   friend class ThreadLock;
 #endif
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** End the hold period before waiting on a condition using mutex (which releases it)
+   *
+   * @return state to pass to ResumeHold() once the wait has returned
+   *
+   * @note does nothing without ENABLE_LOCK_PROFILING
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t SuspendHold();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Restart the hold period (and count the re-acquisition) after waiting on a condition
+   *
+   * @param state value returned by SuspendHold()
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ResumeHold(uint_t state);
   
 protected:
 #ifdef USE_PTHREADS
@@ -49,6 +145,24 @@ protected:
   std::recursive_mutex mutex;
   std::unique_lock<std::recursive_mutex> lock;
 #endif
+#if ENABLE_LOCK_PROFILING
+  /*--------------------------------------------------------------------------------*/
+  /** Return statistics of this lock (the list of locks MUST be locked)
+   */
+  /*--------------------------------------------------------------------------------*/
+  STATS GetStatsEx() const;
+
+  std::string           name;
+  uint_t                depth;          ///< recursion depth (only changed by the thread holding the lock)
+  uint64_t              holdstart;      ///< time the lock was taken
+  // only changed whilst holding the lock but can be read at any time
+  std::atomic<uint64_t> acquisitions;
+  std::atomic<uint64_t> contended;
+  std::atomic<uint64_t> totalwait;
+  std::atomic<uint64_t> maxwait;
+  std::atomic<uint64_t> totalhold;
+  std::atomic<uint64_t> maxhold;
+#endif
 };
 
 /*--------------------------------------------------------------------------------*/
@@ -75,16 +189,205 @@ public:
   ~ThreadLock();
 
 protected:
-#ifdef USE_PTHREADS
+#if defined(USE_PTHREADS) || ENABLE_LOCK_PROFILING
   ThreadLockObject& obj;
 #else
   std::lock_guard<std::recursive_mutex> guard;
 #endif
 };
 
+/*--------------------------------------------------------------------------------*/
+/** Non-recursive mutex - cheaper than ThreadLockObject but a thread MUST NOT lock it
+ * again whilst holding it (use ThreadMutexLock to lock it)
+ *
+ * Lock family (fastest first for short, uncontended critical sections):
+ *  ThreadAdaptiveLockObject: spins briefly before sleeping, for very short critical sections
+ *  ThreadMutexObject:        plain non-recursive mutex
+ *  ThreadRWLockObject:       shared (read) / exclusive (write) lock for read-mostly data
+ *  ThreadLockObject:         recursive mutex, for code that may re-enter the lock
+ *
+ * Run 'tests [benchmark]' to compare them under contention
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadMutexObject
+{
+public:
+  ThreadMutexObject();
+  ~ThreadMutexObject();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Explicit lock/unlock of mutex (AVOID: use a ThreadMutexLock object)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Lock();
+  void Unlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Lock mutex only if it is not already locked
+   *
+   * @return true if mutex has been locked
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool TryLock();
+
+protected:
+#ifdef USE_PTHREADS
+  pthread_mutex_t mutex;
+#else
+  std::mutex      mutex;
+#endif
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Locking object for ThreadMutexObject
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadMutexLock
+{
+public:
+  ThreadMutexLock(ThreadMutexObject& lockobj) : obj(lockobj) {obj.Lock();}
+  ThreadMutexLock(const ThreadMutexObject& lockobj) : obj(const_cast<ThreadMutexObject&>(lockobj)) {obj.Lock();}
+  ~ThreadMutexLock() {obj.Unlock();}
+
+protected:
+  ThreadMutexObject& obj;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Non-recursive lock which spins (a bounded number of times) waiting for the lock to
+ * be released before sleeping on it, avoiding the cost of sleeping and waking for very
+ * short critical sections (use ThreadAdaptiveLock to lock it)
+ *
+ * @note spinning wastes CPU time if the lock is held for long or there are more threads
+ * than cores so the spin count should be kept small
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadAdaptiveLockObject
+{
+public:
+  ThreadAdaptiveLockObject(uint_t _spins = DefaultSpins) : spins(_spins) {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Explicit lock/unlock (AVOID: use a ThreadAdaptiveLock object)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Lock();
+  void Unlock() {mutex.Unlock();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Lock only if it is not already locked
+   *
+   * @return true if lock has been locked
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool TryLock() {return mutex.TryLock();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set/return number of times to try the lock before sleeping
+   */
+  /*--------------------------------------------------------------------------------*/
+  void   SetSpins(uint_t n) {spins = n;}
+  uint_t GetSpins() const {return spins;}
+
+  static const uint_t DefaultSpins;
+
+protected:
+  ThreadMutexObject mutex;
+  uint_t            spins;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Locking object for ThreadAdaptiveLockObject
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadAdaptiveLock
+{
+public:
+  ThreadAdaptiveLock(ThreadAdaptiveLockObject& lockobj) : obj(lockobj) {obj.Lock();}
+  ThreadAdaptiveLock(const ThreadAdaptiveLockObject& lockobj) : obj(const_cast<ThreadAdaptiveLockObject&>(lockobj)) {obj.Lock();}
+  ~ThreadAdaptiveLock() {obj.Unlock();}
+
+protected:
+  ThreadAdaptiveLockObject& obj;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Reader-writer lock allowing any number of readers OR a single writer (use
+ * ThreadReadLock and ThreadWriteLock to lock it)
+ *
+ * Notes:
+ *  1. waiting writers block new readers so that writers cannot be starved
+ *  2. the lock is not recursive: a thread holding a read lock MUST NOT take another
+ *     read lock (it would deadlock if a writer is waiting) or a write lock
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadRWLockObject
+{
+public:
+  ThreadRWLockObject();
+  ~ThreadRWLockObject();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Explicit shared lock/unlock (AVOID: use a ThreadReadLock object)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ReadLock();
+  void ReadUnlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Explicit exclusive lock/unlock (AVOID: use a ThreadWriteLock object)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void WriteLock();
+  void WriteUnlock();
+
+protected:
+#ifdef USE_PTHREADS
+  pthread_rwlock_t        rwlock;
+#else
+  std::mutex              mutex;
+  std::condition_variable readcondition;
+  std::condition_variable writecondition;
+  uint_t                  readers;          ///< number of threads holding read locks
+  uint_t                  waitingwriters;   ///< number of threads waiting for write locks
+  bool                    writer;           ///< true whilst a thread holds the write lock
+#endif
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Shared locking object for ThreadRWLockObject
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadReadLock
+{
+public:
+  ThreadReadLock(ThreadRWLockObject& lockobj) : obj(lockobj) {obj.ReadLock();}
+  ThreadReadLock(const ThreadRWLockObject& lockobj) : obj(const_cast<ThreadRWLockObject&>(lockobj)) {obj.ReadLock();}
+  ~ThreadReadLock() {obj.ReadUnlock();}
+
+protected:
+  ThreadRWLockObject& obj;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Exclusive locking object for ThreadRWLockObject
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadWriteLock
+{
+public:
+  ThreadWriteLock(ThreadRWLockObject& lockobj) : obj(lockobj) {obj.WriteLock();}
+  ThreadWriteLock(const ThreadRWLockObject& lockobj) : obj(const_cast<ThreadRWLockObject&>(lockobj)) {obj.WriteLock();}
+  ~ThreadWriteLock() {obj.WriteUnlock();}
+
+protected:
+  ThreadRWLockObject& obj;
+};
+
 /*--------------------------------------------------------------------------------*/
 /** Thread signalling base class - AVOID using as it doesn't handle initial conditions
  * Use ThreadBoolSignalObject for boolean conditions instead
+ * (and ThreadSemaphoreObject, ThreadLatchObject or ThreadBarrierObject for counts)
  */
 /*--------------------------------------------------------------------------------*/
 class ThreadSignalObject
@@ -104,6 +407,16 @@ public:
   /*--------------------------------------------------------------------------------*/
   virtual bool Wait();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Wait for condition to be triggered or a timeout to expire
+   *
+   * @param timeout maximum time to wait in ms
+   *
+   * @return true if condition was triggered, false if timeout expired (or an error occurred)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool TimedWait(uint_t timeout);
+
   /*--------------------------------------------------------------------------------*/
   /** Signal first waiting thread
    */
@@ -177,6 +490,228 @@ protected:
   volatile bool ready;
 };
 
+/*--------------------------------------------------------------------------------*/
+/** Base class of the counting synchronisation objects (ThreadSemaphoreObject,
+ * ThreadLatchObject and ThreadBarrierObject)
+ *
+ * A waiting thread first spins (a bounded number of times) checking whether it can
+ * continue, because the condition is often met within a few hundred cycles when work
+ * is split over a number of cores, and only then sleeps.  Threads changing the state
+ * only take the internal lock when there are sleeping threads to wake
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadWaitObject
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Set/return number of times to check the condition before sleeping
+   */
+  /*--------------------------------------------------------------------------------*/
+  void   SetSpins(uint_t n) {spins = n;}
+  uint_t GetSpins() const {return spins;}
+
+protected:
+  ThreadWaitObject(uint_t _spins);
+  virtual ~ThreadWaitObject();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the waiting thread can continue, consuming the condition if necessary
+   *
+   * @param token value passed to WaitFor() by the waiting thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool TryContinue(uint_t token) = 0;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until TryContinue() returns true or a timeout expires
+   *
+   * @param token value to pass to TryContinue()
+   * @param timeout maximum time to wait in ms or NULL to wait forever
+   *
+   * @return true if TryContinue() returned true, false if timeout expired
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool WaitFor(uint_t token, const uint_t *timeout = NULL);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wake sleeping threads after the state has been changed
+   *
+   * @param all true to wake all sleeping threads, false to wake one
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Wake(bool all);
+
+protected:
+#ifdef USE_PTHREADS
+  pthread_mutex_t         mutex;
+  pthread_cond_t          condition;
+#else
+  std::mutex              mutex;
+  std::condition_variable condition;
+#endif
+  std::atomic<uint_t>     sleepers;         ///< number of threads sleeping (or about to sleep)
+  uint_t                  spins;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Counting semaphore: Wait() takes a unit, waiting until one is available, Post() adds units
+ *
+ * Useful for handing out a number of blocks of work to a set of worker threads
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadSemaphoreObject : public ThreadWaitObject
+{
+public:
+  ThreadSemaphoreObject(uint_t initial_count = 0, uint_t _spins = DefaultSpins);
+  virtual ~ThreadSemaphoreObject();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add units, waking as many waiting threads
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Post(uint_t n = 1);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Take a unit, waiting until one is available
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Wait() {WaitFor(0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Take a unit, waiting until one is available or a timeout expires
+   *
+   * @param timeout maximum time to wait in ms
+   *
+   * @return true if a unit was taken, false if timeout expired
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool TimedWait(uint_t timeout) {return WaitFor(0, &timeout);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Take a unit only if one is available
+   *
+   * @return true if a unit was taken
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool TryWait();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of units available (may be out of date as soon as it returns!)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetCount() const {return count;}
+
+  static const uint_t DefaultSpins;
+
+protected:
+  virtual bool TryContinue(uint_t token) {UNUSED_PARAMETER(token); return TryWait();}
+
+protected:
+  std::atomic<uint_t> count;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** One-shot latch: threads wait until the count, set on construction, has been
+ * counted down to zero
+ *
+ * Useful for waiting for a fixed number of tasks or threads to complete
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadLatchObject : public ThreadWaitObject
+{
+public:
+  ThreadLatchObject(uint_t initial_count, uint_t _spins = ThreadSemaphoreObject::DefaultSpins);
+  virtual ~ThreadLatchObject();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Decrement count, releasing all waiting threads when it reaches zero
+   *
+   * @note the count MUST NOT be decremented beyond zero
+   */
+  /*--------------------------------------------------------------------------------*/
+  void CountDown(uint_t n = 1);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until the count reaches zero
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Wait() {WaitFor(0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until the count reaches zero or a timeout expires
+   *
+   * @param timeout maximum time to wait in ms
+   *
+   * @return true if the count reached zero, false if timeout expired
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool TimedWait(uint_t timeout) {return WaitFor(0, &timeout);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the count has reached zero
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsReleased() const {return (count == 0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return current count
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetCount() const {return count;}
+
+protected:
+  virtual bool TryContinue(uint_t token) {UNUSED_PARAMETER(token); return IsReleased();}
+
+protected:
+  std::atomic<uint_t> count;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Reusable (cyclic) barrier: each of a fixed number of threads calls ArriveAndWait()
+ * which returns once every thread has arrived, after which the barrier is ready for
+ * the next phase
+ *
+ * Useful for stepping a set of worker threads through the blocks of a render in lock-step
+ *
+ * @note there is no timed wait since a thread leaving early would break the phase for
+ * every other thread
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadBarrierObject : public ThreadWaitObject
+{
+public:
+  ThreadBarrierObject(uint_t _nthreads, uint_t _spins = ThreadSemaphoreObject::DefaultSpins);
+  virtual ~ThreadBarrierObject();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Arrive at the barrier and wait for every other thread to arrive
+   *
+   * @return true for exactly one thread (the last to arrive) in each phase
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ArriveAndWait();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of threads that must arrive in each phase
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetThreadCount() const {return nthreads;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of phases completed
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetPhase() const {return phase;}
+
+protected:
+  virtual bool TryContinue(uint_t token) {return (phase != token);}
+
+protected:
+  uint_t              nthreads;
+  std::atomic<uint_t> arrived;
+  std::atomic<uint_t> phase;
+};
+
 BBC_AUDIOTOOLBOX_END
 
 #endif
@@ -0,0 +1,213 @@
+#ifndef __WAITABLE_LOCK_FREE_BUFFER__
+#define __WAITABLE_LOCK_FREE_BUFFER__
+
+#include "LockFreeBuffer.h"
+#include "ThreadLock.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Lock-free circular buffer which allows the reader and writer to wait (without polling)
+ * for buffers to become available
+ *
+ * Use exactly as LockFreeBuffer but, instead of polling GetReadBuffer()/GetWriteBuffer()
+ * and sleeping, call WaitForRead()/WaitForWrite() which block until the other side
+ * commits/releases buffers or the timeout expires
+ *
+ * Notes:
+ *  1. the reader or writer only registers itself as waiting when it has found the buffer
+ *     empty (or full) so the other side only signals on the empty->non-empty (or
+ *     full->non-full) transition that the waiter is waiting for
+ *  2. when nobody is waiting, IncrementWrite()/IncrementRead() do not lock anything and
+ *     do not make any system calls
+ *  3. a wait can be abandoned early by another thread using InterruptWaitForRead() or
+ *     InterruptWaitForWrite() (for example, to ask a reader thread to quit)
+ *  4. IncrementWrite(), IncrementRead(), Write(), Read(), Reset() and Resize() are *not*
+ *     virtual so they must be called through this class, not through a LockFreeBuffer
+ *     pointer or reference
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename T>
+class WaitableLockFreeBuffer : public LockFreeBuffer<T>
+{
+public:
+  WaitableLockFreeBuffer(uint_t l = 0, bool pow2 = false) : LockFreeBuffer<T>(l, pow2),
+                                                            readsignal(false),
+                                                            writesignal(false),
+                                                            readwaiting(false),
+                                                            writewaiting(false),
+                                                            readinterrupt(false),
+                                                            writeinterrupt(false) {}
+  virtual ~WaitableLockFreeBuffer() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Increment the write pointer, waking the reader if it is waiting
+   *
+   * @param n number of buffers to commit
+   *
+   * @return true if pointer increments, false if it is not possible
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IncrementWrite(uint_t n = 1)
+  {
+    bool success = LockFreeBuffer<T>::IncrementWrite(n);
+    if (success) Wake(readwaiting, readsignal);
+    return success;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Increment the read pointer, waking the writer if it is waiting
+   *
+   * @param n number of slots to increment read pointer by
+   *
+   * @return true if pointer increments, false if it is not possible
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IncrementRead(uint_t n = 1)
+  {
+    bool success = LockFreeBuffer<T>::IncrementRead(n);
+    if (success) Wake(writewaiting, writesignal);
+    return success;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy a block of items into the buffer and commit them, waking the reader if it is waiting
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Write(const T *data, uint_t n)
+  {
+    if ((n = LockFreeBuffer<T>::Write(data, n)) > 0) Wake(readwaiting, readsignal);
+    return n;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy a block of items out of the buffer, waking the writer if it is waiting
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Read(T *data, uint_t n)
+  {
+    if ((n = LockFreeBuffer<T>::Read(data, n)) > 0) Wake(writewaiting, writesignal);
+    return n;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reset the buffer (losing all data), waking the writer if it is waiting
+   *
+   * @note this must be called by the reader
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Reset()
+  {
+    LockFreeBuffer<T>::Reset();
+    Wake(writewaiting, writesignal);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Resize the buffer and reset the pointers, waking the reader and writer if they are waiting
+   *
+   * @note NOT thread safe: neither reader nor writer must be accessing the buffer (although
+   * either may be waiting, in which case the wait re-checks the resized buffer)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Resize(uint_t l)
+  {
+    LockFreeBuffer<T>::Resize(l);
+    Wake(readwaiting, readsignal);
+    Wake(writewaiting, writesignal);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait for at least one read buffer to become available (reader only)
+   *
+   * @param timeout maximum time to wait in ms
+   *
+   * @return true if a buffer is available to read
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool WaitForRead(uint_t timeout) {return WaitFor(&LockFreeBuffer<T>::ReadBuffersAvailable, readwaiting, readinterrupt, readsignal, timeout);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait for at least one write buffer to become available (writer only)
+   *
+   * @param timeout maximum time to wait in ms
+   *
+   * @return true if a buffer is available to write
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool WaitForWrite(uint_t timeout) {return WaitFor(&LockFreeBuffer<T>::WriteBuffersAvailable, writewaiting, writeinterrupt, writesignal, timeout);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Make the current (or next) WaitForRead() return immediately
+   *
+   * @note can be called from any thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  void InterruptWaitForRead() {readinterrupt.store(true); readsignal.Signal();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Make the current (or next) WaitForWrite() return immediately
+   *
+   * @note can be called from any thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  void InterruptWaitForWrite() {writeinterrupt.store(true); writesignal.Signal();}
+
+protected:
+  typedef uint_t (LockFreeBuffer<T>::*AVAILABLEFN)() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wake the other side if it is waiting
+   *
+   * @note the fence orders the (release) position update before the read of the waiting
+   * flag, pairing with the fence in WaitFor() so that either the waiter sees the new
+   * position or this side sees the waiting flag
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Wake(std::atomic<bool>& waiting, ThreadBoolSignalObject& signal)
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false)) signal.Signal();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait for fn() to return non-zero
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool WaitFor(AVAILABLEFN fn, std::atomic<bool>& waiting, std::atomic<bool>& interrupt, ThreadBoolSignalObject& signal, uint_t timeout)
+  {
+    ulong_t start = GetTickCount();
+    bool    available;
+
+    while (!(available = ((this->*fn)() > 0)))
+    {
+      ulong_t elapsed;
+
+      // abandon wait if interrupted
+      if (interrupt.exchange(false)) break;
+
+      // register as waiting then re-check in case the other side has just updated its position
+      waiting.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if ((available = ((this->*fn)() > 0)) == true) break;
+
+      if (((elapsed = GetTickCount() - start) >= timeout) || !signal.TimedWait((uint_t)(timeout - elapsed))) break;
+    }
+
+    waiting.store(false);
+
+    // buffers may have become available at the same time as the timeout
+    return (available || ((this->*fn)() > 0));
+  }
+
+protected:
+  ThreadBoolSignalObject readsignal;
+  ThreadBoolSignalObject writesignal;
+  std::atomic<bool>      readwaiting;
+  std::atomic<bool>      writewaiting;
+  std::atomic<bool>      readinterrupt;
+  std::atomic<bool>      writeinterrupt;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
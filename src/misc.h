@@ -61,6 +61,11 @@ typedef unsigned long long ullong_t;
 #define MEMALIGNED(x, decl)  __declspec(align(x)) decl
 #endif
 
+// size of a CPU cache line, used to keep data written by different threads apart
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
 BBC_AUDIOTOOLBOX_START
 
 #ifdef __BYTE_ORDER__
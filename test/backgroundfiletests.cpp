@@ -0,0 +1,677 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <unistd.h>
+#endif
+
+#ifdef TARGET_OS_WINDOWS
+#include "Windows_uSleep.h"
+#endif
+
+#include <catch/catch.hpp>
+
+#include "BackgroundFile.h"
+#include "SystemParameters.h"
+#include "testfiles.h"
+
+BBC_AUDIOTOOLBOX_START
+
+TEST_CASE("backgroundfile")
+{
+  std::string filename = GetTestFilename("backgroundfile.dat");
+  std::vector<uint8_t> expected;
+  uint_t i, errors = 0;
+
+  SECTION("small pool, waiting")
+  {
+    BackgroundFile file;
+
+    // tiny pool so that writes span blocks and the pool is exhausted
+    file.SetBlockPool(100, 2, BackgroundFile::POOL_WAIT);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+
+    for (i = 0; i < 2000; i++)
+    {
+      uint8_t data[37];
+      uint_t  j, n = 1 + (i % NUMBEROF(data));
+
+      for (j = 0; j < n; j++) data[j] = (uint8_t)(i + j);
+      if (file.fwrite(data, 1, n) != n) errors++;
+      expected.insert(expected.end(), data, data + n);
+    }
+
+    file.fclose();
+    CHECK(errors == 0);
+    CHECK(CompareFile(filename, expected));
+  }
+
+  SECTION("growing pool")
+  {
+    BackgroundFile file;
+
+    file.SetBlockPool(64, 1, BackgroundFile::POOL_GROW, 8);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+
+    for (i = 0; i < 1000; i++)
+    {
+      uint32_t val = i * 0x01010101;
+      if (file.fwrite(&val, sizeof(val), 1) != 1) errors++;
+      expected.insert(expected.end(), (const uint8_t *)&val, (const uint8_t *)(&val + 1));
+    }
+
+    file.fclose();
+    CHECK(errors == 0);
+    CHECK(CompareFile(filename, expected));
+  }
+
+  SECTION("positioned writes")
+  {
+    BackgroundFile file;
+    uint32_t size = 0;
+    off_t    pos;
+
+    file.SetBlockPool(64, 4);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+
+    // header with a size field which is patched afterwards (as WAV file writers do)
+    if (file.fwrite("HDR:", 1, 4) != 4) errors++;
+    if (file.fwrite(&size, sizeof(size), 1) != 1) errors++;
+    CHECK(file.ftell() == 8);
+
+    for (i = 0; i < 100; i++)
+    {
+      if (file.fprintf("%u,", i) <= 0) errors++;
+    }
+
+    pos  = file.ftell();
+    size = (uint32_t)(pos - 8);
+    CHECK(file.fseek(4, SEEK_SET) == 0);
+    CHECK(file.ftell() == 4);
+    if (file.fwrite(&size, sizeof(size), 1) != 1) errors++;
+    CHECK(file.fseek(pos - 8, SEEK_CUR) == 0);
+    CHECK(file.ftell() == pos);
+    if (file.fwrite("END", 1, 3) != 3) errors++;
+
+    file.fclose();
+
+    expected.insert(expected.end(), (const uint8_t *)"HDR:", (const uint8_t *)"HDR:" + 4);
+    expected.insert(expected.end(), (const uint8_t *)&size, (const uint8_t *)(&size + 1));
+    for (i = 0; i < 100; i++)
+    {
+      std::string str = StringFrom(i) + ",";
+      expected.insert(expected.end(), str.begin(), str.end());
+    }
+    expected.insert(expected.end(), (const uint8_t *)"END", (const uint8_t *)"END" + 3);
+
+    CHECK(errors == 0);
+    CHECK(CompareFile(filename, expected));
+  }
+
+  SECTION("dedicated thread")
+  {
+    BackgroundFile file;
+    uint32_t size;
+
+    file.SetBlockPool(100, 2, BackgroundFile::POOL_WAIT);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+    file.EnableAsyncIO(false);
+
+    for (i = 0; i < 1000; i++)
+    {
+      uint8_t data[23];
+      uint_t  j, n = 1 + (i % NUMBEROF(data));
+
+      for (j = 0; j < n; j++) data[j] = (uint8_t)(i - j);
+      if (file.fwrite(data, 1, n) != n) errors++;
+      expected.insert(expected.end(), data, data + n);
+    }
+
+    // patch start of file
+    size = (uint32_t)expected.size();
+    CHECK(file.fseek(0, SEEK_SET) == 0);
+    if (file.fwrite(&size, sizeof(size), 1) != 1) errors++;
+    memcpy(&expected[0], &size, sizeof(size));
+
+    file.fclose();
+    CHECK(errors == 0);
+    CHECK(CompareFile(filename, expected));
+  }
+
+  SECTION("direct I/O")
+  {
+    uint_t k;
+
+    // through the shared service and with a dedicated thread
+    for (k = 0; k < 2; k++)
+    {
+      BackgroundFile file;
+      uint32_t size = 0;
+
+      expected.clear();
+
+      // block size is rounded up to the alignment
+      file.SetBlockPool(5000, 4, BackgroundFile::POOL_WAIT);
+      REQUIRE(file.fopen(filename.c_str(), "wb"));
+      file.EnableBackground();
+      file.EnableAsyncIO(k == 0);
+      file.EnableDirectIO();
+
+      if (file.fwrite("HDR:", 1, 4) != 4) errors++;
+      if (file.fwrite(&size, sizeof(size), 1) != 1) errors++;
+
+      for (i = 0; i < 400; i++)
+      {
+        uint8_t data[1001];
+        uint_t  j, n = 1 + ((i * 17) % NUMBEROF(data));
+
+        for (j = 0; j < n; j++) data[j] = (uint8_t)(i * 3 + j);
+        if (file.fwrite(data, 1, n) != n) errors++;
+        expected.insert(expected.end(), data, data + n);
+      }
+
+      // patch header (unaligned) then write an unaligned tail
+      size = (uint32_t)expected.size();
+      CHECK(file.fseek(4, SEEK_SET) == 0);
+      if (file.fwrite(&size, sizeof(size), 1) != 1) errors++;
+      CHECK(file.fseek(8 + size, SEEK_SET) == 0);
+      if (file.fwrite("END", 1, 3) != 3) errors++;
+
+      file.fclose();
+
+      expected.insert(expected.begin(), (const uint8_t *)&size, (const uint8_t *)(&size + 1));
+      expected.insert(expected.begin(), (const uint8_t *)"HDR:", (const uint8_t *)"HDR:" + 4);
+      expected.insert(expected.end(), (const uint8_t *)"END", (const uint8_t *)"END" + 3);
+
+      CHECK(errors == 0);
+      CHECK(CompareFile(filename, expected));
+    }
+  }
+
+  SECTION("preallocation")
+  {
+    uint_t k;
+
+    // grown by fwrite() with the shared service and by the writing thread otherwise
+    for (k = 0; k < 2; k++)
+    {
+      BackgroundFile file;
+      bool reserved;
+
+      expected.clear();
+
+      file.SetBlockPool(4096, 4, BackgroundFile::POOL_WAIT);
+      file.SetPreallocation(65536, 262144);
+      REQUIRE(file.fopen(filename.c_str(), "wb"));
+      file.EnableBackground();
+      file.EnableAsyncIO(k == 0);
+
+      for (i = 0; i < 1000; i++)
+      {
+        uint8_t data[1000];
+        uint_t  j;
+
+        for (j = 0; j < NUMBEROF(data); j++) data[j] = (uint8_t)(i + j * 3);
+        if (file.fwrite(data, 1, sizeof(data)) != sizeof(data)) errors++;
+        expected.insert(expected.end(), data, data + sizeof(data));
+      }
+
+      // reservation must have kept ahead of the data (where reserving is supported)
+      file.fflush();
+      if ((reserved = (file.getreserved() > 0)) == true)
+      {
+        CHECK(file.getreserved() >= (off_t)(expected.size() + 131072));
+        CHECK(GetFileAllocation(filename) >= file.getreserved());
+      }
+
+      file.fclose();
+      CHECK(errors == 0);
+      CHECK(CompareFile(filename, expected));
+      if (reserved) CHECK(GetFileAllocation(filename) < (sint64_t)(expected.size() + 131072));
+    }
+  }
+
+  SECTION("gathered writes")
+  {
+    BackgroundFile file;
+
+    file.SetBlockPool(50, 4);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+
+    for (i = 0; i < 200; i++)
+    {
+      uint32_t hdr = i;
+      uint8_t  data[13];
+      uint_t   j;
+
+      for (j = 0; j < NUMBEROF(data); j++) data[j] = (uint8_t)(i + j);
+
+      EnhancedFile::IOVEC iov[] = {{&hdr, sizeof(hdr)}, {data, sizeof(data)}};
+      if (file.writev(iov, NUMBEROF(iov)) != (sizeof(hdr) + sizeof(data))) errors++;
+      expected.insert(expected.end(), (const uint8_t *)&hdr, (const uint8_t *)(&hdr + 1));
+      expected.insert(expected.end(), data, data + sizeof(data));
+    }
+
+    file.fclose();
+    CHECK(errors == 0);
+    CHECK(CompareFile(filename, expected));
+  }
+
+  SECTION("maximum write latency")
+  {
+    BackgroundFile file;
+    const char data[] = "partial block";
+    ulong_t start;
+
+    // data must reach the file without the block filling up or the file being closed
+    file.SetMaxWriteLatency(20);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+
+    CHECK(file.fwrite(data, 1, sizeof(data)) == sizeof(data));
+    expected.insert(expected.end(), data, data + sizeof(data));
+
+    start = GetTickCount();
+    while (!CompareFile(filename, expected) && ((GetTickCount() - start) < 2000)) usleep(5000);
+    CHECK(CompareFile(filename, expected));
+
+    file.fclose();
+  }
+
+  remove(filename.c_str());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write many files at once through the shared asynchronous file service
+ */
+/*--------------------------------------------------------------------------------*/
+static void TestAsyncFiles(AsyncFileIO::BACKEND backend)
+{
+  static const uint_t nfiles = 64;
+  std::vector<BackgroundFile *>       files;
+  std::vector<std::string>            filenames;
+  std::vector<std::vector<uint8_t> >  expected(nfiles);
+  uint_t i, j, errors = 0;
+
+  REQUIRE(AsyncFileIO::SetBackend(backend));
+  CHECK(AsyncFileIO::Get().GetType() == backend);
+
+  for (i = 0; i < nfiles; i++)
+  {
+    BackgroundFile *file = new BackgroundFile;
+    uint32_t       hdr = 0;
+
+    filenames.push_back(GetTestFilename("backgroundfile-async-" + StringFrom(i) + ".dat"));
+
+    // small pool so that blocks are re-used whilst other files are being written
+    file->SetBlockPool(128, 4, BackgroundFile::POOL_WAIT);
+    REQUIRE(file->fopen(filenames[i].c_str(), "wb"));
+    file->EnableBackground();
+    file->EnableAsyncIO();
+
+    // placeholder header, patched at the end
+    if (file->fwrite(&hdr, sizeof(hdr), 1) != 1) errors++;
+    files.push_back(file);
+  }
+
+  // interleave writes of different sizes to all files
+  for (i = 0; i < 200; i++)
+  {
+    for (j = 0; j < nfiles; j++)
+    {
+      uint8_t data[61];
+      uint_t  k, n = 1 + ((i * 7 + j) % NUMBEROF(data));
+
+      for (k = 0; k < n; k++) data[k] = (uint8_t)(i + j + k);
+      if (files[j]->fwrite(data, 1, n) != n) errors++;
+      expected[j].insert(expected[j].end(), data, data + n);
+    }
+  }
+
+  for (i = 0; i < nfiles; i++)
+  {
+    uint32_t size = (uint32_t)expected[i].size();
+    off_t    pos  = files[i]->ftell();
+
+    // patch header then carry on at the end
+    CHECK(files[i]->fseek(0, SEEK_SET) == 0);
+    if (files[i]->fwrite(&size, sizeof(size), 1) != 1) errors++;
+    CHECK(files[i]->fseek(pos, SEEK_SET) == 0);
+    if (files[i]->fwrite("END", 1, 3) != 3) errors++;
+
+    files[i]->fclose();
+    delete files[i];
+
+    expected[i].insert(expected[i].begin(), (const uint8_t *)&size, (const uint8_t *)(&size + 1));
+    expected[i].insert(expected[i].end(), (const uint8_t *)"END", (const uint8_t *)"END" + 3);
+
+    CHECK(CompareFile(filenames[i], expected[i]));
+    remove(filenames[i].c_str());
+  }
+
+  CHECK(errors == 0);
+
+  // a file opened for append must still be written correctly (without the service)
+  {
+    std::string          filename = GetTestFilename("backgroundfile-async.dat");
+    std::vector<uint8_t> data;
+    BackgroundFile       file;
+
+    remove(filename.c_str());
+    for (i = 0; i < 2; i++)
+    {
+      REQUIRE(file.fopen(filename.c_str(), "ab"));
+      file.SetBlockPool(32, 2, BackgroundFile::POOL_WAIT);
+      file.EnableBackground();
+      file.EnableAsyncIO();
+      for (j = 0; j < 100; j++)
+      {
+        uint8_t val = (uint8_t)(i * 100 + j);
+        CHECK(file.fwrite(&val, 1, 1) == 1);
+        data.push_back(val);
+      }
+      file.fclose();
+    }
+
+    CHECK(CompareFile(filename, data));
+    remove(filename.c_str());
+  }
+
+  // release service so that the backend can be changed
+  AsyncFileIO::SetBackend(AsyncFileIO::BACKEND_AUTO);
+}
+
+TEST_CASE("backgroundfile-readahead")
+{
+  std::string          filename = GetTestFilename("backgroundfile-readahead.dat");
+  std::vector<uint8_t> data(100000), buf(data.size());
+  uint_t               i;
+
+  for (i = 0; i < data.size(); i++) data[i] = (uint8_t)((i * 7) ^ (i >> 8));
+
+  {
+    EnhancedFile file;
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    REQUIRE(file.fwrite(&data[0], 1, data.size()) == data.size());
+  }
+
+  SECTION("sequential reads and seeks")
+  {
+    BackgroundFile file;
+    size_t pos = 0;
+    uint_t nreads = 0;
+
+    file.SetReadAhead(4, 4096);
+    file.EnableReadAhead();
+    REQUIRE(file.fopen(filename.c_str(), "rb"));
+
+    // reads of varying sizes, smaller and larger than a block
+    for (i = 0; pos < data.size(); i++)
+    {
+      size_t n = std::min((size_t)(1 + ((i * 1237) % 9000)), data.size() - pos);
+
+      REQUIRE(file.fread(&buf[pos], 1, n) == n);
+      pos += n;
+      nreads++;
+      CHECK(file.ftell() == (off_t)pos);
+    }
+    CHECK(memcmp(&buf[0], &data[0], data.size()) == 0);
+
+    // end of file
+    CHECK(file.fread(&buf[0], 1, 10) == 0);
+    nreads++;
+
+    // seek restarts read ahead at the new position
+    CHECK(file.fseek(12345, SEEK_SET) == 0);
+    CHECK(file.ftell() == 12345);
+    REQUIRE(file.fread(&buf[0], 1, 1000) == 1000);
+    CHECK(memcmp(&buf[0], &data[12345], 1000) == 0);
+    CHECK(file.fseek(-500, SEEK_CUR) == 0);
+    REQUIRE(file.fread(&buf[0], 1, 500) == 500);
+    CHECK(memcmp(&buf[0], &data[12845], 500) == 0);
+    nreads += 2;
+
+    // partial item at the end of the file
+    CHECK(file.fseek(-10, SEEK_END) == 0);
+    CHECK(file.fread(&buf[0], 4, 3) == 2);
+    CHECK(memcmp(&buf[0], &data[data.size() - 10], 10) == 0);
+    nreads++;
+
+    const BackgroundFile::READAHEAD_STATS& stats = file.GetReadAheadStats();
+    CHECK(stats.restarts == 4);
+    CHECK((stats.hits + stats.misses) == nreads);
+    CHECK(stats.bytes == (data.size() + 1000 + 500 + 10));
+
+    file.ResetReadAheadStats();
+    CHECK(file.GetReadAheadStats().restarts == 0);
+  }
+
+  SECTION("reads and writes")
+  {
+    BackgroundFile file;
+    const uint8_t patch[] = {1, 2, 3, 4, 5};
+
+    file.SetReadAhead(2, 1000);
+    file.EnableReadAhead();
+    file.EnableBackground();
+    REQUIRE(file.fopen(filename.c_str(), "r+b"));
+
+    // write must go at the logical position, not where the read ahead has got to
+    REQUIRE(file.fread(&buf[0], 1, 100) == 100);
+    REQUIRE(file.fwrite(patch, 1, sizeof(patch)) == sizeof(patch));
+    CHECK(file.ftell() == (off_t)(100 + sizeof(patch)));
+    REQUIRE(file.fread(&buf[0], 1, 100) == 100);
+    CHECK(memcmp(&buf[0], &data[100 + sizeof(patch)], 100) == 0);
+
+    memcpy(&data[100], patch, sizeof(patch));
+
+    EnhancedFile::IOVEC iov[] = {{&buf[0], 50000}, {&buf[50000], 50000}};
+    file.rewind();
+    CHECK(file.readv(iov, NUMBEROF(iov)) == data.size());
+    CHECK(memcmp(&buf[0], &data[0], data.size()) == 0);
+  }
+
+  remove(filename.c_str());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Sustained write benchmark: buffered vs direct I/O
+ *
+ * Run using 'tests [benchmark]'; the amount of data written (in MB) can be set using the
+ * environment variable BBCAT_BENCHMARK_MB (default 1024)
+ */
+/*--------------------------------------------------------------------------------*/
+TEST_CASE("backgroundfile-benchmark", "[.][benchmark]")
+{
+  std::string          filename = GetTestFilename("backgroundfile-benchmark.dat");
+  std::vector<uint8_t> data(65536);
+  const char           *str;
+  uint64_t             total;
+  uint_t               i, k, mb = 1024, errors = 0;
+
+  if ((str = getenv("BBCAT_BENCHMARK_MB")) != NULL) Evaluate(str, mb);
+  total = (uint64_t)mb << 20;
+
+  for (i = 0; i < data.size(); i++) data[i] = (uint8_t)i;
+
+  for (k = 0; k < 2; k++)
+  {
+    BackgroundFile file;
+    uint64_t       written;
+    uint64_t       t0, t1, t2;
+
+    file.SetBlockPool(1048576, 16, BackgroundFile::POOL_WAIT);
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    file.EnableBackground();
+    file.EnableDirectIO(k == 1);
+
+    t0 = GetNanosecondTicks();
+    for (written = 0; written < total; written += data.size())
+    {
+      if (file.fwrite(&data[0], 1, data.size()) != data.size()) errors++;
+    }
+    t1 = GetNanosecondTicks();
+    file.fclose();
+    t2 = GetNanosecondTicks();
+
+    BBCDEBUG("%-8s: %u MB in %0.1lfms (%0.1lf MB/s), close took %0.1lfms",
+             k ? "direct" : "buffered", mb,
+             (double)(t2 - t0) * 1.0e-6,
+             (double)mb * 1.0e9 / (double)(t2 - t0),
+             (double)(t2 - t1) * 1.0e-6);
+
+    remove(filename.c_str());
+  }
+
+  CHECK(errors == 0);
+}
+
+typedef struct
+{
+  std::atomic<uint_t> rising;
+  std::atomic<uint_t> falling;
+  std::atomic<uint_t> otherthread;      ///< calls not made by the thread writing the file
+  std::thread::id     writer;
+} HIGHWATER_COUNTS;
+
+static void HighWaterHandler(BackgroundFile& file, bool above, uint64_t queuedbytes, void *context)
+{
+  HIGHWATER_COUNTS& counts = *(HIGHWATER_COUNTS *)context;
+
+  UNUSED_PARAMETER(file);
+  UNUSED_PARAMETER(queuedbytes);
+
+  if (above) counts.rising++;
+  else       counts.falling++;
+  if (std::this_thread::get_id() != counts.writer) counts.otherthread++;
+}
+
+TEST_CASE("backgroundfile-stats")
+{
+  std::string      filename = GetTestFilename("backgroundfile-stats.dat");
+  std::vector<uint8_t> expected;
+  HIGHWATER_COUNTS counts;
+  BackgroundFile   file;
+  uint_t i, errors = 0;
+
+  counts.rising      = 0;
+  counts.falling     = 0;
+  counts.otherthread = 0;
+  counts.writer      = std::this_thread::get_id();
+
+  file.SetBlockPool(256, 4, BackgroundFile::POOL_GROW, 64);
+  REQUIRE(file.fopen(filename.c_str(), "wb"));
+  file.EnableBackground();
+
+  // any queued block is above the threshold
+  file.SetHighWaterHandler(1, &HighWaterHandler, &counts);
+
+  for (i = 0; i < 4000; i++)
+  {
+    uint8_t data = (uint8_t)i;
+    if (file.fwrite(&data, 1, 1) != 1) errors++;
+    expected.push_back(data);
+  }
+
+  file.fclose();
+  CHECK(errors == 0);
+  CHECK(CompareFile(filename, expected));
+
+  BackgroundFile::WRITE_STATS stats = file.GetWriteStats();
+  CHECK(stats.queuedbytes == 0);
+  CHECK(stats.queuedblocks == 0);
+  CHECK(stats.byteswritten == expected.size());
+  CHECK(stats.writes > 0);
+  CHECK(stats.maxwritetime <= stats.writetime);
+  CHECK(stats.highwaterbytes >= 256);
+  CHECK(stats.highwaterblocks >= 1);
+  CHECK(stats.highwaterevents >= 1);
+  CHECK(stats.flushes >= 1);
+  CHECK(stats.maxflushtime <= stats.flushtime);
+
+  // every rise above the threshold is followed by a fall once the queue has drained
+  CHECK(counts.rising == stats.highwaterevents);
+  CHECK(counts.falling == counts.rising);
+
+  // the handler is only called by the thread writing the file
+  CHECK(counts.otherthread == 0);
+
+  file.ResetWriteStats();
+  stats = file.GetWriteStats();
+  CHECK(stats.byteswritten == 0);
+  CHECK(stats.highwaterbytes == 0);
+  CHECK(stats.flushes == 0);
+
+  remove(filename.c_str());
+}
+
+TEST_CASE("backgroundfile-async")
+{
+  SECTION("thread count")
+  {
+    SystemParameters::Get().Set("asyncfilethreads", 5);
+    CHECK(AsyncFileIO::GetThreadCount() == 5);
+    SystemParameters::Get().Set("asyncfilethreads", 0);
+    CHECK(AsyncFileIO::GetThreadCount() == 1);
+    SystemParameters::Get().Set("asyncfilethreads", AsyncFileIO::DefaultThreads);
+  }
+
+  SECTION("short write remainder")
+  {
+    AsyncFileIO::REQUEST req, remainder;
+    uint8_t data[30];
+
+    req.client = NULL;
+    req.fd     = 3;
+    req.offset = 100;
+    req.iov[0].data = data;      req.iov[0].size = 10;
+    req.iov[1].data = data + 10; req.iov[1].size = 20;
+    req.n      = 2;
+
+    // part way through the first buffer
+    CHECK(AsyncFileIO::GetRemainder(&req, 4, remainder));
+    CHECK(remainder.fd == 3);
+    CHECK(remainder.offset == 104);
+    REQUIRE(remainder.n == 2);
+    CHECK(remainder.iov[0].data == (void *)(data + 4));
+    CHECK(remainder.iov[0].size == 6);
+    CHECK(remainder.iov[1].size == 20);
+
+    // on a buffer boundary and part way through the last buffer
+    CHECK(AsyncFileIO::GetRemainder(&req, 10, remainder));
+    REQUIRE(remainder.n == 1);
+    CHECK(remainder.iov[0].data == (void *)(data + 10));
+    CHECK(AsyncFileIO::GetRemainder(&req, 25, remainder));
+    REQUIRE(remainder.n == 1);
+    CHECK(remainder.offset == 125);
+    CHECK(remainder.iov[0].size == 5);
+
+    // nothing left
+    CHECK(!AsyncFileIO::GetRemainder(&req, 30, remainder));
+  }
+
+  if (AsyncFileIO::IsAvailable())
+  {
+    SECTION("threads")
+    {
+      TestAsyncFiles(AsyncFileIO::BACKEND_THREADS);
+    }
+
+    SECTION("io_uring")
+    {
+      if (AsyncFileIO::IsIOUringAvailable()) TestAsyncFiles(AsyncFileIO::BACKEND_IOURING);
+    }
+  }
+}
+
+BBC_AUDIOTOOLBOX_END
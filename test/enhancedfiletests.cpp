@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include <catch/catch.hpp>
+
+#include "EnhancedFile.h"
+#include "testfiles.h"
+
+BBC_AUDIOTOOLBOX_START
+
+TEST_CASE("enhancedfile-mapped")
+{
+  std::string filename = GetTestFilename("enhancedfile.txt");
+  static const char text[] = "first line\r\nsecond line\n\nlast line without linefeed";
+  char line[64];
+
+  {
+    EnhancedFile file;
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    CHECK(file.fwrite(text, 1, sizeof(text) - 1) == (sizeof(text) - 1));
+    file.fclose();
+  }
+
+  SECTION("read, seek and tell")
+  {
+    EnhancedFile file;
+    char buf[16];
+
+    REQUIRE(file.fopen(filename.c_str(), "rbm"));
+#ifdef TARGET_OS_UNIXBSD
+    CHECK(file.ismapped());
+#endif
+    CHECK(file.fread(buf, 1, 5) == 5);
+    CHECK(memcmp(buf, text, 5) == 0);
+    CHECK(file.ftell() == 5);
+    CHECK(file.fseek(-4, SEEK_END) == 0);
+    CHECK(file.fread(buf, 1, sizeof(buf)) == 4);
+    CHECK(memcmp(buf, "feed", 4) == 0);
+    // whole items only
+    CHECK(file.fseek(-3, SEEK_CUR) == 0);
+    CHECK(file.fread(buf, 2, 2) == 1);
+    CHECK(file.fseek(-1, SEEK_SET) != 0);
+    file.rewind();
+    CHECK(file.ftell() == 0);
+    CHECK(file.fwrite(buf, 1, 1) == 0);
+  }
+
+  SECTION("readline")
+  {
+    EnhancedFile file;
+
+    REQUIRE(file.fopen(filename.c_str(), "rbm"));
+    CHECK(file.readline(line, sizeof(line)) == 10);
+    CHECK(strcmp(line, "first line") == 0);
+    CHECK(file.readline(line, 7) == 6);
+    CHECK(strcmp(line, "second") == 0);
+    CHECK(file.readline(line, sizeof(line)) == 0);
+    CHECK(file.readline(line, sizeof(line)) == 26);
+    CHECK(strcmp(line, "last line without linefeed") == 0);
+    CHECK(file.readline(line, sizeof(line)) == EOF);
+  }
+
+  SECTION("zero-copy and duplication")
+  {
+    EnhancedFile file;
+
+    REQUIRE(file.fopen(filename.c_str(), "rbm"));
+#ifdef TARGET_OS_UNIXBSD
+    const uint8_t *p;
+
+    REQUIRE((p = file.GetMappedRegion(12, 6)) != NULL);
+    CHECK(memcmp(p, "second", 6) == 0);
+    CHECK(file.GetMappedRegion(0, sizeof(text) - 1) != NULL);
+    CHECK(file.GetMappedRegion(0, sizeof(text)) == NULL);
+
+    file.fseek(12, SEEK_SET);
+    {
+      EnhancedFile *file2 = file.dup();
+
+      // duplicate shares the mapping and its position is copied
+      CHECK(file2->GetMappedRegion(12, 6) == p);
+      CHECK(file2->ftell() == 12);
+      CHECK(file2->readline(line, sizeof(line)) == 11);
+      delete file2;
+    }
+
+    // mapping is still valid after duplicate has been closed
+    CHECK(file.readline(line, sizeof(line)) == 11);
+    CHECK(memcmp(p, "second", 6) == 0);
+#endif
+  }
+
+  SECTION("mapping is read-only")
+  {
+    EnhancedFile file;
+    CHECK(!file.fopen(filename.c_str(), "wbm"));
+  }
+
+  remove(filename.c_str());
+}
+
+TEST_CASE("enhancedfile-scatter-gather")
+{
+  std::string filename = GetTestFilename("enhancedfile.dat");
+  std::vector<EnhancedFile::IOVEC> iov;
+  std::vector<uint8_t> expected, data;
+  uint8_t header[] = {'H', 'D', 'R', 0};
+  uint_t  i;
+
+  // more buffers than can be passed to a single writev() call
+  data.resize(3000);
+  for (i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 7);
+  for (i = 0; i < data.size(); i += 2)
+  {
+    EnhancedFile::IOVEC v = {&header[0], sizeof(header)};
+    iov.push_back(v);
+    expected.insert(expected.end(), header, header + sizeof(header));
+
+    v.data = &data[i];
+    v.size = 2;
+    iov.push_back(v);
+    expected.insert(expected.end(), data.begin() + i, data.begin() + i + 2);
+  }
+
+  {
+    EnhancedFile file;
+
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    // mix buffered writes with gathered writes
+    CHECK(file.fwrite(header, 1, 1) == 1);
+    CHECK(file.writev(&iov[0], (uint_t)iov.size()) == (expected.size()));
+    CHECK(file.ftell() == (off_t)(expected.size() + 1));
+    CHECK(file.fwrite(header, 1, 1) == 1);
+    file.fclose();
+  }
+
+  expected.insert(expected.begin(), header[0]);
+  expected.push_back(header[0]);
+  CHECK(CompareFile(filename, expected));
+
+  SECTION("readv")
+  {
+    EnhancedFile file;
+    uint8_t first[3], second[1000];
+    std::vector<uint8_t> rest(expected.size());
+    EnhancedFile::IOVEC riov[] = {{first, sizeof(first)}, {second, sizeof(second)}, {&rest[0], rest.size()}};
+
+    REQUIRE(file.fopen(filename.c_str(), "rb"));
+    // buffered read before scattered read
+    CHECK(file.fread(first, 1, 1) == 1);
+    CHECK(file.readv(riov, NUMBEROF(riov)) == (expected.size() - 1));
+    CHECK(std::equal(first, first + sizeof(first), expected.begin() + 1));
+    CHECK(std::equal(second, second + sizeof(second), expected.begin() + 1 + sizeof(first)));
+    CHECK(std::equal(rest.begin(), rest.begin() + (expected.size() - 1 - sizeof(first) - sizeof(second)), expected.begin() + 1 + sizeof(first) + sizeof(second)));
+    CHECK(file.fread(first, 1, 1) == 0);
+  }
+
+  remove(filename.c_str());
+}
+
+TEST_CASE("enhancedfile-reserve")
+{
+  std::string filename = GetTestFilename("enhancedfile-reserve.dat");
+  EnhancedFile file;
+
+  REQUIRE(file.fopen(filename.c_str(), "wb"));
+  CHECK(file.fwrite("data", 1, 4) == 4);
+
+  // reserving is not supported everywhere
+  if (file.reserve(1 << 20))
+  {
+    CHECK(file.getreserved() == (1 << 20));
+    CHECK(file.reserve(4096));
+    CHECK(file.getreserved() == (1 << 20));
+    CHECK(file.ftell() == 4);
+
+    file.fflush();
+    CHECK(GetFileAllocation(filename) >= (1 << 20));
+
+    // reserved space is released on close, leaving the data
+    file.fclose();
+    CHECK(GetFileAllocation(filename) < (1 << 20));
+    CHECK(CompareFile(filename, std::vector<uint8_t>((const uint8_t *)"data", (const uint8_t *)"data" + 4)));
+  }
+
+  file.fclose();
+  remove(filename.c_str());
+}
+
+BBC_AUDIOTOOLBOX_END
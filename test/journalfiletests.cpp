@@ -0,0 +1,312 @@
+#include <string.h>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <unistd.h>
+#endif
+
+#ifdef TARGET_OS_WINDOWS
+#include "Windows_uSleep.h"
+#endif
+
+#include <catch/catch.hpp>
+
+#include "JournalFile.h"
+#include "CRC32C.h"
+#include "testfiles.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Bit-at-a-time CRC-32C for comparison
+ */
+/*--------------------------------------------------------------------------------*/
+static uint32_t ReferenceCRC32C(const uint8_t *data, size_t bytes)
+{
+  uint32_t crc = ~0u;
+  size_t   i;
+  uint_t   j;
+
+  for (i = 0; i < bytes; i++)
+  {
+    crc ^= data[i];
+    for (j = 0; j < 8; j++) crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+  }
+
+  return ~crc;
+}
+
+TEST_CASE("crc32c")
+{
+  INFO("hardware CRC " << (CRC32CIsHardwareAccelerated() ? "available" : "not available"));
+
+  SECTION("known values")
+  {
+    static const uint8_t zeros[32] = {0};
+
+    CHECK(CRC32C("", 0) == 0);
+    CHECK(CRC32C("123456789", 9) == 0xe3069283);
+    CHECK(CRC32C(zeros, sizeof(zeros)) == 0x8a9136aa);
+  }
+
+  SECTION("all lengths and alignments")
+  {
+    uint8_t data[200];
+    uint_t  i, j;
+
+    for (i = 0; i < NUMBEROF(data); i++) data[i] = (uint8_t)(i * 151 + 7);
+
+    for (i = 0; i < 8; i++)
+    {
+      for (j = 0; j < (NUMBEROF(data) - i); j++)
+      {
+        INFO("offset " << i << " length " << j);
+        uint32_t crc = ReferenceCRC32C(data + i, j);
+
+        if (CRC32C(data + i, j) != crc) FAIL("CRC mismatch");
+        // CRC of two pieces continues to the same result
+        if (CRC32C(data + i + j / 3, j - j / 3, CRC32C(data + i, j / 3)) != crc) FAIL("continued CRC mismatch");
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create test record of length n
+ */
+/*--------------------------------------------------------------------------------*/
+static std::string MakeRecord(uint_t n)
+{
+  std::string str;
+  uint_t i;
+
+  for (i = 0; i < n; i++) str += (char)('a' + ((i + n) % 26));
+
+  return str;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Collect records from JournalFile::Read()
+ */
+/*--------------------------------------------------------------------------------*/
+static bool __CollectRecord(const uint8_t *data, size_t bytes, void *context)
+{
+  std::vector<std::string>& records = *(std::vector<std::string> *)context;
+  records.push_back(std::string((const char *)data, bytes));
+  return true;
+}
+
+static std::vector<std::string> ReadJournal(const std::string& filename, JournalFile::SCAN_RESULT& result)
+{
+  std::vector<std::string> records;
+  CHECK(JournalFile::Read(filename.c_str(), &__CollectRecord, &records, &result));
+  return records;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Append records from a thread
+ */
+/*--------------------------------------------------------------------------------*/
+static void *__Appender(Thread& thread, void *arg)
+{
+  JournalFile& journal = *(JournalFile *)arg;
+  uint_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < 250; i++)
+  {
+    std::string record = MakeRecord(i % 100);
+    journal.Append(record.c_str(), record.size());
+  }
+
+  return NULL;
+}
+
+TEST_CASE("journalfile")
+{
+  std::string              filename = GetTestFilename("journalfile.jnl");
+  std::vector<std::string> expected;
+  uint_t                   i;
+
+  remove(filename.c_str());
+
+  // initial journal for each section
+  {
+    JournalFile journal;
+
+    REQUIRE(journal.Open(filename.c_str()));
+    CHECK(journal.GetRecovery().records == 0);
+    CHECK(journal.GetRecovery().discardedbytes == 0);
+
+    for (i = 0; i < 20; i++)
+    {
+      expected.push_back(MakeRecord(i * 7));
+      CHECK(journal.Append(expected.back().c_str(), expected.back().size()) == (i + 1));
+    }
+
+    CHECK(journal.Sync());
+    CHECK(journal.GetDurableSequence() == 20);
+  }
+
+  SECTION("read and reopen")
+  {
+    JournalFile::SCAN_RESULT result;
+
+    CHECK(ReadJournal(filename, result) == expected);
+    CHECK(result.records == 20);
+    CHECK(result.discardedbytes == 0);
+
+    JournalFile journal;
+    REQUIRE(journal.Open(filename.c_str()));
+    CHECK(journal.GetRecovery().records == 20);
+    CHECK(journal.GetRecovery().discardedbytes == 0);
+
+    expected.push_back("after reopening");
+    CHECK(journal.Append(expected.back().c_str(), expected.back().size()) == 1);
+    journal.Close();
+
+    CHECK(ReadJournal(filename, result) == expected);
+  }
+
+  SECTION("torn record")
+  {
+    JournalFile::SCAN_RESULT result;
+    off_t length;
+
+    // remove the end of the last record (as a crash might)
+    {
+      EnhancedFile file;
+      REQUIRE(file.fopen(filename.c_str(), "rb+"));
+      REQUIRE(file.fseek(0, SEEK_END) == 0);
+      length = file.ftell();
+      REQUIRE(file.truncate(length - 5));
+    }
+    expected.pop_back();
+
+    CHECK(ReadJournal(filename, result) == expected);
+    CHECK(result.discardedbytes == (off_t)(8 + 19 * 7 - 5));
+
+    JournalFile journal;
+    REQUIRE(journal.Open(filename.c_str()));
+    CHECK(journal.GetRecovery().records == 19);
+    CHECK(journal.GetRecovery().validbytes == (length - 8 - 19 * 7));
+    CHECK(journal.GetRecovery().discardedbytes == (off_t)(8 + 19 * 7 - 5));
+
+    // new records follow the last valid record
+    expected.push_back("after recovery");
+    CHECK(journal.Append(expected.back().c_str(), expected.back().size()) == 1);
+    journal.Close();
+
+    CHECK(ReadJournal(filename, result) == expected);
+    CHECK(result.discardedbytes == 0);
+  }
+
+  SECTION("corrupt record")
+  {
+    JournalFile::SCAN_RESULT result;
+    off_t offset = sizeof(JournalFile::Signature);
+
+    // corrupt a byte of the data of record 10
+    for (i = 0; i < 10; i++) offset += 8 + expected[i].size();
+    {
+      EnhancedFile file;
+      REQUIRE(file.fopen(filename.c_str(), "rb+"));
+      REQUIRE(file.fseek(offset + 8 + 3, SEEK_SET) == 0);
+      CHECK(file.fwrite("?", 1, 1) == 1);
+    }
+    expected.resize(10);
+
+    CHECK(ReadJournal(filename, result) == expected);
+    CHECK(result.validbytes == offset);
+
+    JournalFile journal;
+    REQUIRE(journal.Open(filename.c_str()));
+    CHECK(journal.GetRecovery().records == 10);
+  }
+
+  SECTION("garbage length")
+  {
+    JournalFile::SCAN_RESULT result;
+    static const uint8_t garbage[] = {0xff, 0xff, 0xff, 0x00, 0x12, 0x34, 0x56, 0x78, 0x00};
+
+    {
+      EnhancedFile file;
+      REQUIRE(file.fopen(filename.c_str(), "ab"));
+      CHECK(file.fwrite(garbage, 1, sizeof(garbage)) == sizeof(garbage));
+    }
+
+    CHECK(ReadJournal(filename, result) == expected);
+    CHECK(result.discardedbytes == (off_t)sizeof(garbage));
+  }
+
+  SECTION("group commit")
+  {
+    JournalFile journal;
+    Thread      *threads[4];
+    uint64_t    seq;
+
+    REQUIRE(journal.Open(filename.c_str()));
+    journal.SetCommitLatency(20);
+
+    for (i = 0; i < NUMBEROF(threads); i++) threads[i] = new Thread(&__Appender, &journal);
+    for (i = 0; i < NUMBEROF(threads); i++)
+    {
+      threads[i]->Stop();
+      delete threads[i];
+    }
+
+    CHECK(journal.GetAppendedSequence() == 1000);
+    CHECK(journal.Sync());
+    CHECK(journal.GetDurableSequence() == 1000);
+    // records are committed in groups rather than individually
+    CHECK(journal.GetCommitCount() < 100);
+
+    // commit thread makes a record durable without waiting for it
+    seq = journal.Append("latency", 7);
+    ulong_t start = GetTickCount();
+    while ((journal.GetDurableSequence() < seq) && ((GetTickCount() - start) < 2000)) usleep(1000);
+    CHECK(journal.GetDurableSequence() == seq);
+    journal.Close();
+
+    JournalFile::SCAN_RESULT result;
+    CHECK(ReadJournal(filename, result).size() == 1021);
+    CHECK(result.discardedbytes == 0);
+  }
+
+  SECTION("synchronous commits")
+  {
+    JournalFile journal;
+
+    REQUIRE(journal.Open(filename.c_str()));
+    journal.SetCommitLatency(0);
+
+    for (i = 0; i < 5; i++)
+    {
+      CHECK(journal.Append("sync", 4) == (i + 1));
+      CHECK(journal.GetDurableSequence() == (i + 1));
+    }
+    CHECK(journal.GetCommitCount() == 5);
+  }
+
+  SECTION("not a journal")
+  {
+    std::vector<uint8_t> data(100, 'x');
+    {
+      EnhancedFile file;
+      REQUIRE(file.fopen(filename.c_str(), "wb"));
+      CHECK(file.fwrite(&data[0], 1, data.size()) == data.size());
+    }
+
+    JournalFile journal;
+    CHECK(!journal.Open(filename.c_str()));
+    CHECK(!JournalFile::Read(filename.c_str(), NULL));
+    // file must not have been changed
+    CHECK(CompareFile(filename, data));
+  }
+
+  remove(filename.c_str());
+}
+
+BBC_AUDIOTOOLBOX_END
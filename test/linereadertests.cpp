@@ -0,0 +1,224 @@
+#include <string.h>
+
+#include <catch/catch.hpp>
+
+#include "LineReader.h"
+#include "SystemParameters.h"
+#include "testfiles.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Write text to file
+ */
+/*--------------------------------------------------------------------------------*/
+static void WriteTextFile(const std::string& filename, const std::string& text)
+{
+  EnhancedFile file;
+  REQUIRE(file.fopen(filename.c_str(), "wb"));
+  REQUIRE(file.fwrite(text.c_str(), 1, text.size()) == text.size());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read lines using EnhancedFile::readline()
+ */
+/*--------------------------------------------------------------------------------*/
+static std::vector<std::string> ReadLines(const std::string& filename, uint_t maxlen)
+{
+  std::vector<std::string> lines;
+  std::vector<char>        buffer(maxlen + 1);
+  EnhancedFile             file;
+  int                      l;
+
+  REQUIRE(file.fopen(filename.c_str(), "rb"));
+  while ((l = file.readline(&buffer[0], maxlen + 1)) >= 0) lines.push_back(std::string(&buffer[0], l));
+
+  return lines;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read lines using LineReader
+ */
+/*--------------------------------------------------------------------------------*/
+static std::vector<std::string> ReadLines(const std::string& filename, uint_t maxlen, size_t buffersize)
+{
+  std::vector<std::string> lines;
+  EnhancedFile             file;
+  LineReader::Line         line;
+
+  REQUIRE(file.fopen(filename.c_str(), "rb"));
+
+  LineReader reader(file, maxlen, buffersize);
+  while (reader.ReadLine(line)) lines.push_back(line.str());
+  CHECK(reader.GetLineNumber() == lines.size());
+
+  return lines;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Allow a parameter file to be read explicitly
+ */
+/*--------------------------------------------------------------------------------*/
+class TestSystemParameters : public SystemParameters
+{
+public:
+  TestSystemParameters() : SystemParameters() {}
+
+  using SystemParameters::ReadFromFile;
+};
+
+TEST_CASE("linereader")
+{
+  std::string filename = GetTestFilename("linereader.txt");
+
+  SECTION("same lines as readline()")
+  {
+    static const char *texts[] =
+    {
+      "",
+      "\n",
+      "one line",
+      "one line\n",
+      "first\r\nsecond\r\n\r\nfourth\nfifth",
+      "mid\rline carriage\r returns\n\n\n",
+      "a line which is much longer than the maximum line length\nshort\nanother line which is too long",
+      "exactly12chr\nexactly13chrs\n12345678901\n",
+      "\r\r\r",
+    };
+    static const size_t buffersizes[] = {1, 13, 16, 17, 64, 65536};
+    uint_t i, j;
+
+    for (i = 0; i < NUMBEROF(texts); i++)
+    {
+      WriteTextFile(filename, texts[i]);
+
+      std::vector<std::string> expected = ReadLines(filename, 12);
+
+      // small buffers force lines to be split across reads
+      for (j = 0; j < NUMBEROF(buffersizes); j++)
+      {
+        INFO("text " << i << " buffer size " << buffersizes[j]);
+        CHECK(ReadLines(filename, 12, buffersizes[j]) == expected);
+      }
+    }
+  }
+
+  SECTION("iterator")
+  {
+    std::vector<std::string> lines;
+    EnhancedFile file;
+
+    WriteTextFile(filename, "a\nbb\r\n\nccc");
+    REQUIRE(file.fopen(filename.c_str(), "rb"));
+
+    LineReader reader(file);
+    LineReader::iterator it;
+    for (it = reader.begin(); it != reader.end(); ++it)
+    {
+      CHECK(it->length == (*it).str().size());
+      lines.push_back(it->str());
+    }
+
+    REQUIRE(lines.size() == 4);
+    CHECK(lines[0] == "a");
+    CHECK(lines[1] == "bb");
+    CHECK(lines[2] == "");
+    CHECK(lines[3] == "ccc");
+  }
+
+  SECTION("system parameters")
+  {
+    TestSystemParameters parameters;
+    std::string val;
+
+    WriteTextFile(filename, "; comment\r\nlinereadertest1 = value one ; comment\r\n  linereadertest2='quoted value'\nlinereadertest3=\"last\"");
+    REQUIRE(parameters.ReadFromFile(filename));
+
+    CHECK(parameters.Get("linereadertest1", val));
+    CHECK(val == "value one");
+    CHECK(parameters.Get("linereadertest2", val));
+    CHECK(val == "quoted value");
+    CHECK(parameters.Get("linereadertest3", val));
+    CHECK(val == "last");
+  }
+
+  remove(filename.c_str());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Original character-by-character readline() for comparison
+ */
+/*--------------------------------------------------------------------------------*/
+static int ReadLineFGetC(FILE *fp, char *line, uint_t maxlen)
+{
+  uint_t i;
+  int    c;
+
+  maxlen--;
+  for (i = 0; ((c = fgetc(fp)) != EOF) && (c != '\n');)
+  {
+    if ((i < maxlen) && (c != '\r')) line[i++] = c;
+  }
+  line[i] = 0;
+
+  return (i || (c != EOF)) ? i : EOF;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Line reading benchmark: fgetc() vs readline() vs LineReader
+ *
+ * Run using 'tests [benchmark]'
+ */
+/*--------------------------------------------------------------------------------*/
+TEST_CASE("linereader-benchmark", "[.][benchmark]")
+{
+  std::string filename = GetTestFilename("linereader-benchmark.txt");
+  char        line[1024];
+  uint64_t    t0, t1, t2, t3;
+  size_t      n1 = 0, n2 = 0, n3 = 0;
+  uint_t      i;
+
+  {
+    EnhancedFile file;
+    REQUIRE(file.fopen(filename.c_str(), "wb"));
+    for (i = 0; i < 500000; i++) file.fprintf("parameter%u = some value for parameter %u ; with a comment\r\n", i, i);
+  }
+
+  {
+    FILE *fp;
+    REQUIRE((fp = fopen(filename.c_str(), "rb")) != NULL);
+    t0 = GetNanosecondTicks();
+    while (ReadLineFGetC(fp, line, sizeof(line)) >= 0) n1++;
+    t1 = GetNanosecondTicks();
+    fclose(fp);
+  }
+
+  {
+    EnhancedFile file;
+    REQUIRE(file.fopen(filename.c_str(), "rb"));
+    while (file.readline(line, sizeof(line)) >= 0) n2++;
+    t2 = GetNanosecondTicks();
+  }
+
+  {
+    EnhancedFile file;
+    REQUIRE(file.fopen(filename.c_str(), "rb"));
+
+    LineReader reader(file);
+    LineReader::Line l;
+    while (reader.ReadLine(l)) n3++;
+    t3 = GetNanosecondTicks();
+  }
+
+  CHECK(n1 == 500000);
+  CHECK(n2 == n1);
+  CHECK(n3 == n1);
+
+  BBCDEBUG("fgetc():      %0.1lfms", (double)(t1 - t0) * 1.0e-6);
+  BBCDEBUG("readline():   %0.1lfms (x%0.2lf)", (double)(t2 - t1) * 1.0e-6, (double)(t1 - t0) / (double)(t2 - t1));
+  BBCDEBUG("LineReader:   %0.1lfms (x%0.2lf)", (double)(t3 - t2) * 1.0e-6, (double)(t1 - t0) / (double)(t3 - t2));
+
+  remove(filename.c_str());
+}
+
+BBC_AUDIOTOOLBOX_END
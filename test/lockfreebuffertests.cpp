@@ -0,0 +1,663 @@
+#include <string.h>
+
+#include <thread>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <unistd.h>
+#endif
+
+#include <catch/catch.hpp>
+
+#include "LockFreeBuffer.h"
+#include "WaitableLockFreeBuffer.h"
+#include "LockFreeMPMCBuffer.h"
+#include "LockFreeTripleBuffer.h"
+#include "Thread.h"
+
+BBC_AUDIOTOOLBOX_START
+
+TEST_CASE("lockfreebuffer")
+{
+  LockFreeBuffer<uint_t> buffer(4);
+  uint_t i;
+
+  CHECK(buffer.ReadBuffersAvailable() == 0);
+  CHECK(buffer.WriteBuffersAvailable() == 4);
+  CHECK(buffer.GetReadBuffer() == NULL);
+
+  // fill buffer using write-ahead
+  for (i = 0; i < 4; i++)
+  {
+    uint_t *p = buffer.GetWriteBuffer(i);
+    REQUIRE(p != NULL);
+    *p = i;
+  }
+  CHECK(buffer.GetWriteBuffer(4) == NULL);
+
+  // nothing is readable until it is committed
+  CHECK(buffer.ReadBuffersAvailable() == 0);
+  CHECK(buffer.IncrementWrite(4) == true);
+  CHECK(buffer.ReadBuffersAvailable() == 4);
+  CHECK(buffer.WriteBuffersAvailable() == 0);
+  CHECK(buffer.GetWriteBuffer() == NULL);
+  CHECK(buffer.IncrementWrite() == false);
+
+  // read-ahead
+  for (i = 0; i < 4; i++)
+  {
+    const uint_t *p = buffer.GetReadBuffer(i);
+    REQUIRE(p != NULL);
+    CHECK(*p == i);
+  }
+  CHECK(buffer.GetReadBuffer(4) == NULL);
+
+  // consume and wrap around
+  CHECK(buffer.IncrementRead(3) == true);
+  CHECK(buffer.ReadBuffersAvailable() == 1);
+  CHECK(buffer.WriteBuffersAvailable() == 3);
+  for (i = 0; i < 3; i++)
+  {
+    uint_t *p = buffer.GetWriteBuffer();
+    REQUIRE(p != NULL);
+    *p = 10 + i;
+    CHECK(buffer.IncrementWrite() == true);
+  }
+  CHECK(*buffer.GetReadBuffer()  == 3);
+  CHECK(*buffer.GetReadBuffer(1) == 10);
+  CHECK(*buffer.GetReadBuffer(3) == 12);
+
+  buffer.Reset();
+  CHECK(buffer.ReadBuffersAvailable() == 0);
+  CHECK(buffer.WriteBuffersAvailable() == 4);
+  CHECK(buffer.IncrementRead() == false);
+}
+
+typedef struct
+{
+  LockFreeBuffer<uint64_t> *buffer;
+  uint64_t                 count;
+} STRESSPARAMS;
+
+static void *__StressWriter(Thread& thread, void *arg)
+{
+  const STRESSPARAMS& params = *(const STRESSPARAMS *)arg;
+  uint64_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.count;)
+  {
+    uint64_t *p;
+
+    if ((p = params.buffer->GetWriteBuffer()) != NULL)
+    {
+      *p = i++;
+      params.buffer->IncrementWrite();
+    }
+    else std::this_thread::yield();
+  }
+
+  return NULL;
+}
+
+static void StressTest(LockFreeBuffer<uint64_t>& buffer)
+{
+  STRESSPARAMS params = {&buffer, 1000000};
+  Thread   writer(&__StressWriter, &params);
+  uint64_t i, errors = 0;
+
+  // read sequence from writer thread, checking that nothing is lost, duplicated or re-ordered
+  for (i = 0; i < params.count;)
+  {
+    const uint64_t *p;
+
+    if ((p = buffer.GetReadBuffer()) != NULL)
+    {
+      if (*p != i) errors++;
+      i++;
+      buffer.IncrementRead();
+    }
+    else std::this_thread::yield();
+  }
+
+  writer.Stop();
+
+  CHECK(errors == 0);
+  CHECK(buffer.ReadBuffersAvailable() == 0);
+}
+
+TEST_CASE("lockfreebuffer-stress")
+{
+  SECTION("modulo")
+  {
+    LockFreeBuffer<uint64_t> buffer(16);
+    StressTest(buffer);
+  }
+
+  SECTION("power-of-two")
+  {
+    LockFreeBuffer<uint64_t> buffer(16, true);
+    StressTest(buffer);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Derivation to allow free-running counters to be placed near wrap-around
+ */
+/*--------------------------------------------------------------------------------*/
+class TestLockFreeBuffer : public LockFreeBuffer<uint_t>
+{
+public:
+  TestLockFreeBuffer(uint_t l) : LockFreeBuffer<uint_t>(l, true) {}
+
+  void SetPositions(uint_t pos) {rd = wr = pos;}
+};
+
+TEST_CASE("lockfreebuffer-power-of-two")
+{
+  LockFreeBuffer<uint_t> buffer(5, true);
+
+  CHECK(buffer.IsPowerOfTwo() == true);
+  CHECK(buffer.Capacity() == 8);
+  CHECK(LockFreeBuffer<uint_t>(8, true).Capacity() == 8);
+  CHECK(LockFreeBuffer<uint_t>(0, true).Capacity() == 1);
+  CHECK(LockFreeBuffer<uint_t>(5).Capacity() == 5);
+
+  // all slots are usable
+  CHECK(buffer.WriteBuffersAvailable() == 8);
+  CHECK(buffer.IncrementWrite(8) == true);
+  CHECK(buffer.ReadBuffersAvailable() == 8);
+  CHECK(buffer.WriteBuffersAvailable() == 0);
+  CHECK(buffer.GetWriteBuffer() == NULL);
+
+  // mode is retained on resize
+  buffer.Resize(20);
+  CHECK(buffer.Capacity() == 32);
+  CHECK(buffer.ReadBuffersAvailable() == 0);
+
+  // counters wrapping around the top of their range
+  TestLockFreeBuffer wrapbuffer(4);
+  uint_t i, errors = 0;
+
+  wrapbuffer.SetPositions(0xfffffffe);
+  for (i = 0; i < 16; i++)
+  {
+    uint_t *p = wrapbuffer.GetWriteBuffer();
+    REQUIRE(p != NULL);
+    *p = i;
+    wrapbuffer.IncrementWrite();
+    if (wrapbuffer.ReadBuffersAvailable() != 1) errors++;
+    if (wrapbuffer.WriteBuffersAvailable() != 3) errors++;
+    if (*wrapbuffer.GetReadBuffer() != i) errors++;
+    wrapbuffer.IncrementRead();
+  }
+  CHECK(errors == 0);
+}
+
+static void SpanTest(LockFreeBuffer<uint_t>& buffer)
+{
+  LockFreeBuffer<uint_t>::SPAN spans[2];
+  uint_t data[8], i, errors = 0;
+
+  REQUIRE(buffer.Capacity() == 8);
+
+  // move positions so that writes wrap
+  CHECK(buffer.IncrementWrite(6) == true);
+  CHECK(buffer.IncrementRead(6) == true);
+
+  CHECK(buffer.GetWriteSpans(spans, 5) == 5);
+  CHECK(spans[0].count == (buffer.IsPowerOfTwo() ? 2 : 3));
+  CHECK(spans[1].count == (buffer.IsPowerOfTwo() ? 3 : 2));
+
+  for (i = 0; i < NUMBEROF(data); i++) data[i] = 100 + i;
+  CHECK(buffer.Write(data, 5) == 5);
+  CHECK(buffer.ReadBuffersAvailable() == 5);
+  // only the remaining space is written
+  CHECK(buffer.Write(data + 5, 5) == 3);
+  CHECK(buffer.Write(data, 1) == 0);
+
+  CHECK(buffer.GetReadSpans(spans) == 8);
+  CHECK((spans[0].count + spans[1].count) == 8);
+  CHECK(spans[0].data[0] == 100);
+
+  memset(data, 0, sizeof(data));
+  CHECK(buffer.Read(data, 3) == 3);
+  CHECK(buffer.Read(data + 3, 10) == 5);
+  CHECK(buffer.Read(data, 1) == 0);
+  for (i = 0; i < NUMBEROF(data); i++)
+  {
+    if (data[i] != (100 + i)) errors++;
+  }
+  CHECK(errors == 0);
+}
+
+TEST_CASE("lockfreebuffer-spans")
+{
+  SECTION("modulo")
+  {
+    LockFreeBuffer<uint_t> buffer(8);
+    SpanTest(buffer);
+  }
+
+  SECTION("power-of-two")
+  {
+    LockFreeBuffer<uint_t> buffer(8, true);
+    SpanTest(buffer);
+  }
+}
+
+static void *__DelayedWriter(Thread& thread, void *arg)
+{
+  WaitableLockFreeBuffer<uint_t>& buffer = *(WaitableLockFreeBuffer<uint_t> *)arg;
+  uint_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < 100; i++)
+  {
+    // wait for space without polling
+    if (buffer.WaitForWrite(1000))
+    {
+      *buffer.GetWriteBuffer() = i;
+      buffer.IncrementWrite();
+    }
+    // delay the first item so that the reader has to wait
+    if (i == 0) usleep(20000);
+  }
+
+  return NULL;
+}
+
+typedef struct
+{
+  WaitableLockFreeBuffer<uint_t> *buffer;
+  bool                           available;
+} WAITPARAMS;
+
+static void *__WaitForWrite(Thread& thread, void *arg)
+{
+  WAITPARAMS& params = *(WAITPARAMS *)arg;
+
+  UNUSED_PARAMETER(thread);
+
+  params.available = params.buffer->WaitForWrite(5000);
+
+  return NULL;
+}
+
+TEST_CASE("lockfreebuffer-waitable")
+{
+  WaitableLockFreeBuffer<uint_t> buffer(4, true);
+  ulong_t t;
+
+  // empty buffer: wait should time out
+  t = GetTickCount();
+  CHECK(buffer.WaitForRead(50) == false);
+  CHECK((GetTickCount() - t) >= 40);
+  CHECK(buffer.WaitForWrite(0) == true);
+
+  // full buffer: wait should time out
+  CHECK(buffer.IncrementWrite(4) == true);
+  CHECK(buffer.WaitForWrite(10) == false);
+  CHECK(buffer.WaitForRead(0) == true);
+  buffer.Reset();
+
+  // reader woken by writer thread
+  Thread   writer(&__DelayedWriter, &buffer);
+  uint_t   i, errors = 0;
+
+  for (i = 0; i < 100; i++)
+  {
+    if (buffer.WaitForRead(1000))
+    {
+      if (*buffer.GetReadBuffer() != i) errors++;
+      buffer.IncrementRead();
+    }
+    else errors++;
+  }
+
+  writer.Stop();
+
+  CHECK(errors == 0);
+
+  // writer waiting on a full buffer woken by Reset()
+  CHECK(buffer.IncrementWrite(4) == true);
+  WAITPARAMS params = {&buffer, false};
+  t = GetTickCount();
+  Thread waiter(&__WaitForWrite, &params);
+  usleep(20000);
+  buffer.Reset();
+  waiter.Stop();
+  CHECK(params.available);
+  CHECK((GetTickCount() - t) < 1000);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Single-threaded microbenchmark of buffer index arithmetic
+ *
+ * Run using 'tests [benchmark]'
+ */
+/*--------------------------------------------------------------------------------*/
+static double BenchmarkLockFreeBuffer(LockFreeBuffer<uint_t>& buffer, uint_t count)
+{
+  uint64_t t0 = GetNanosecondTicks();
+  uint_t   i, sum = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    uint_t *p;
+
+    // fill buffer half way then empty it again
+    while ((buffer.ReadBuffersAvailable() < 8) && ((p = buffer.GetWriteBuffer()) != NULL))
+    {
+      *p = i;
+      buffer.IncrementWrite();
+    }
+    while ((p = buffer.GetReadBuffer()) != NULL)
+    {
+      sum += *p;
+      buffer.IncrementRead();
+    }
+  }
+
+  uint64_t t1 = GetNanosecondTicks();
+
+  // prevent loop being optimised away
+  if (sum == 1) BBCDEBUG("Sum %u", sum);
+
+  // each iteration writes and reads 8 items
+  return (double)count * 8.0 * 1.0e9 / (double)(t1 - t0);
+}
+
+TEST_CASE("lockfreebuffer-benchmark", "[.][benchmark]")
+{
+  LockFreeBuffer<uint_t> modbuffer(15), pow2buffer(16, true);
+  const uint_t count = 2000000;
+
+  double modops  = BenchmarkLockFreeBuffer(modbuffer, count);
+  double pow2ops = BenchmarkLockFreeBuffer(pow2buffer, count);
+
+  BBCDEBUG("LockFreeBuffer modulo:       %0.1lfM ops/s", modops  * 1.0e-6);
+  BBCDEBUG("LockFreeBuffer power-of-two: %0.1lfM ops/s (x%0.2lf)", pow2ops * 1.0e-6, pow2ops / modops);
+}
+
+typedef struct
+{
+  LockFreeMPMCBuffer<uint64_t> *buffer;
+  uint_t                       id;
+  uint64_t                     count;
+  uint64_t                     sum;
+} MPMCPARAMS;
+
+static void *__MPMCWriter(Thread& thread, void *arg)
+{
+  MPMCPARAMS& params = *(MPMCPARAMS *)arg;
+  uint64_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.count;)
+  {
+    uint64_t val = ((uint64_t)params.id << 32) + i, *p;
+
+    if ((p = params.buffer->GetWriteBuffer()) != NULL)
+    {
+      *p = val;
+      params.buffer->IncrementWrite(p);
+      params.sum += val;
+      i++;
+    }
+    else std::this_thread::yield();
+  }
+
+  return NULL;
+}
+
+static void *__MPMCReader(Thread& thread, void *arg)
+{
+  MPMCPARAMS& params = *(MPMCPARAMS *)arg;
+  uint64_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.count;)
+  {
+    uint64_t val;
+
+    if (params.buffer->Read(val))
+    {
+      params.sum += val;
+      i++;
+    }
+    else std::this_thread::yield();
+  }
+
+  return NULL;
+}
+
+TEST_CASE("lockfreempmcbuffer")
+{
+  LockFreeMPMCBuffer<uint_t> buffer(5);
+  uint_t *p1, *p2, val;
+
+  CHECK(buffer.Capacity() == 8);
+
+  // claim two slots and commit them out of order
+  REQUIRE((p1 = buffer.GetWriteBuffer()) != NULL);
+  REQUIRE((p2 = buffer.GetWriteBuffer()) != NULL);
+  *p1 = 1;
+  *p2 = 2;
+  buffer.IncrementWrite(p2);
+  // first slot is not yet committed so nothing can be read
+  CHECK(buffer.GetReadBuffer() == NULL);
+  buffer.IncrementWrite(p1);
+  CHECK(buffer.Read(val) == true);
+  CHECK(val == 1);
+  CHECK(buffer.Read(val) == true);
+  CHECK(val == 2);
+  CHECK(buffer.Read(val) == false);
+
+  // fill and empty repeatedly
+  uint_t i, j, errors = 0;
+  for (j = 0; j < 4; j++)
+  {
+    for (i = 0; i < 8; i++) if (!buffer.Write(i)) errors++;
+    if (buffer.Write(i)) errors++;
+    for (i = 0; i < 8; i++) if (!buffer.Read(val) || (val != i)) errors++;
+    if (buffer.Read(val)) errors++;
+  }
+  CHECK(errors == 0);
+}
+
+TEST_CASE("lockfreempmcbuffer-stress")
+{
+  const uint_t nthreads = 4;
+  LockFreeMPMCBuffer<uint64_t> buffer(64);
+  MPMCPARAMS writerparams[nthreads], readerparams[nthreads];
+  std::vector<Thread *> threads;
+  uint64_t writesum = 0, readsum = 0;
+  uint_t i;
+
+  for (i = 0; i < nthreads; i++)
+  {
+    MPMCPARAMS params = {&buffer, i, 100000, 0};
+    writerparams[i] = readerparams[i] = params;
+    threads.push_back(new Thread(&__MPMCWriter, &writerparams[i]));
+    threads.push_back(new Thread(&__MPMCReader, &readerparams[i]));
+  }
+
+  for (i = 0; i < threads.size(); i++)
+  {
+    threads[i]->Stop();
+    delete threads[i];
+  }
+
+  for (i = 0; i < nthreads; i++)
+  {
+    writesum += writerparams[i].sum;
+    readsum  += readerparams[i].sum;
+  }
+
+  // every item written has been read exactly once
+  CHECK(readsum == writesum);
+  CHECK(buffer.ReadBuffersAvailable() == 0);
+}
+
+typedef struct
+{
+  LockFreeMPMCBuffer<uint_t> *buffer;
+  uint_t                     count;
+} MPMCBENCHMARKPARAMS;
+
+static void *__MPMCBenchmark(Thread& thread, void *arg)
+{
+  const MPMCBENCHMARKPARAMS& params = *(const MPMCBENCHMARKPARAMS *)arg;
+  uint_t i, val;
+
+  UNUSED_PARAMETER(thread);
+
+  // each thread writes one item and then reads one item
+  for (i = 0; i < params.count; i++)
+  {
+    while (!params.buffer->Write(i))  std::this_thread::yield();
+    while (!params.buffer->Read(val)) std::this_thread::yield();
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Contention benchmark for multiple writer/reader threads
+ *
+ * Run using 'tests [benchmark]'
+ */
+/*--------------------------------------------------------------------------------*/
+TEST_CASE("lockfreempmcbuffer-benchmark", "[.][benchmark]")
+{
+  static const uint_t nthreads[] = {1, 2, 4, 8, 16};
+  const uint_t count = 1000000;
+  uint_t i, j;
+
+  for (i = 0; i < NUMBEROF(nthreads); i++)
+  {
+    LockFreeMPMCBuffer<uint_t> buffer(1024);
+    MPMCBENCHMARKPARAMS params = {&buffer, count / nthreads[i]};
+    std::vector<Thread *> threads;
+    uint64_t t0 = GetNanosecondTicks();
+
+    for (j = 0; j < nthreads[i]; j++) threads.push_back(new Thread(&__MPMCBenchmark, &params));
+    for (j = 0; j < nthreads[i]; j++)
+    {
+      threads[j]->Stop();
+      delete threads[j];
+    }
+
+    uint64_t t1 = GetNanosecondTicks();
+
+    // each iteration is one write and one read
+    BBCDEBUG("LockFreeMPMCBuffer %2u threads: %0.1lfM ops/s", nthreads[i], (double)params.count * (double)nthreads[i] * 2.0e3 / (double)(t1 - t0));
+  }
+}
+
+TEST_CASE("lockfreetriplebuffer")
+{
+  LockFreeTripleBuffer<uint_t> buffer(1);
+  bool updated = true;
+
+  CHECK(*buffer.GetReadBuffer() == 1);
+  CHECK(!buffer.IsUpdated());
+  CHECK(!buffer.Update());
+  CHECK(buffer.Read(&updated) == 1);
+  CHECK(!updated);
+
+  buffer.Write(2);
+  CHECK(buffer.IsUpdated());
+  CHECK(*buffer.GetReadBuffer() == 1);
+  CHECK(buffer.Read(&updated) == 2);
+  CHECK(updated);
+  CHECK(!buffer.IsUpdated());
+
+  // only the most recent copy is kept
+  buffer.Write(3);
+  *buffer.GetWriteBuffer() = 4;
+  buffer.Publish();
+  CHECK(buffer.Update());
+  CHECK(*buffer.GetReadBuffer() == 4);
+  CHECK(!buffer.Update());
+  CHECK(*buffer.GetReadBuffer() == 4);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Object large enough that torn reads would be detected
+ */
+/*--------------------------------------------------------------------------------*/
+typedef struct
+{
+  uint64_t values[16];
+} TRIPLEBUFFERSTATE;
+
+typedef struct
+{
+  LockFreeTripleBuffer<TRIPLEBUFFERSTATE> *buffer;
+  uint64_t                                count;
+} TRIPLEBUFFERPARAMS;
+
+static void *__TripleBufferWriter(Thread& thread, void *arg)
+{
+  const TRIPLEBUFFERPARAMS& params = *(const TRIPLEBUFFERPARAMS *)arg;
+  uint64_t i;
+  uint_t   j;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 1; i <= params.count; i++)
+  {
+    TRIPLEBUFFERSTATE *state = params.buffer->GetWriteBuffer();
+
+    for (j = 0; j < NUMBEROF(state->values); j++) state->values[j] = i;
+    params.buffer->Publish();
+  }
+
+  return NULL;
+}
+
+TEST_CASE("lockfreetriplebuffer-stress")
+{
+  TRIPLEBUFFERSTATE initial;
+  memset(&initial, 0, sizeof(initial));
+
+  LockFreeTripleBuffer<TRIPLEBUFFERSTATE> buffer(initial);
+  TRIPLEBUFFERPARAMS params = {&buffer, 1000000};
+  Thread   writer(&__TripleBufferWriter, &params);
+  uint64_t last = 0, errors = 0, updates = 0;
+  uint_t   j;
+
+  // every copy read must be complete and newer than the last
+  while (last < params.count)
+  {
+    bool updated;
+    const TRIPLEBUFFERSTATE& state = buffer.Read(&updated);
+
+    if (updated)
+    {
+      if (state.values[0] <= last) errors++;
+      for (j = 1; j < NUMBEROF(state.values); j++)
+      {
+        if (state.values[j] != state.values[0]) errors++;
+      }
+      last = state.values[0];
+      updates++;
+    }
+    else std::this_thread::yield();
+  }
+
+  writer.Stop();
+
+  CHECK(errors == 0);
+  CHECK(updates > 0);
+  CHECK(!buffer.Update());
+}
+
+BBC_AUDIOTOOLBOX_END
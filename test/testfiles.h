@@ -0,0 +1,73 @@
+#ifndef __TEST_FILES__
+#define __TEST_FILES__
+
+#include <stdlib.h>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <sys/stat.h>
+#endif
+
+#include "EnhancedFile.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Return filename in temporary directory for test files
+ */
+/*--------------------------------------------------------------------------------*/
+inline std::string GetTestFilename(const std::string& name)
+{
+  const char *dir;
+
+  if ((dir = getenv("TMPDIR")) == NULL)
+  {
+#ifdef TARGET_OS_WINDOWS
+    dir = ".";
+#else
+    dir = "/tmp";
+#endif
+  }
+
+  return EnhancedFile::catpath(dir, "bbcat-base-test-" + name);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read file back and compare it with the expected pattern
+ */
+/*--------------------------------------------------------------------------------*/
+inline bool CompareFile(const std::string& filename, const std::vector<uint8_t>& expected)
+{
+  std::vector<uint8_t> data(expected.size() + 1);
+  EnhancedFile file;
+  bool same = false;
+
+  if (file.fopen(filename.c_str(), "rb"))
+  {
+    size_t n = file.fread(&data[0], 1, data.size());
+    same = ((n == expected.size()) && std::equal(expected.begin(), expected.end(), data.begin()));
+    file.fclose();
+  }
+
+  return same;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return disk space allocated to a file (-1 if not known)
+ */
+/*--------------------------------------------------------------------------------*/
+inline sint64_t GetFileAllocation(const std::string& filename)
+{
+#ifdef TARGET_OS_UNIXBSD
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) return (sint64_t)st.st_blocks * 512;
+#else
+  UNUSED_PARAMETER(filename);
+#endif
+  return -1;
+}
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,838 @@
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+
+#include "OSCompiler.h"
+
+#ifdef TARGET_OS_UNIXBSD
+#include <unistd.h>
+#endif
+
+#ifdef TARGET_OS_WINDOWS
+#include "Windows_uSleep.h"
+#endif
+
+#include <catch/catch.hpp>
+
+#include "Thread.h"
+#include "ThreadLock.h"
+#include "TaskPool.h"
+#include "RCUObject.h"
+#include "SystemParameters.h"
+
+BBC_AUDIOTOOLBOX_START
+
+static void *AttributesThread(Thread& thread, void *arg)
+{
+  std::string& name = *(std::string *)arg;
+
+  UNUSED_PARAMETER(thread);
+
+#if defined(TARGET_OS_UNIXBSD) && !defined(__APPLE__)
+  char buf[32];
+  if (pthread_getname_np(pthread_self(), buf, sizeof(buf)) == 0) name = buf;
+#else
+  UNUSED_PARAMETER(name);
+#endif
+
+  return NULL;
+}
+
+TEST_CASE("thread-attributes")
+{
+  Thread::ATTRIBUTES attr = Thread::GetDefaultAttributes();
+  Thread      thread;
+  std::string name;
+
+  CHECK(attr.policy == Thread::POLICY_DEFAULT);
+  CHECK(attr.affinity == 0);
+  CHECK(attr.stacksize == 0);
+  CHECK(!attr.lockmemory);
+
+  // real-time priority is likely to be refused without privileges but the thread must
+  // still run (memory locking is not tested since it affects the whole process)
+  attr.policy        = Thread::POLICY_FIFO;
+  attr.priority      = 1000;
+  attr.affinity      = 1;
+  attr.stacksize     = 1 << 20;
+  attr.name          = "bbcat-attributes-test";
+  attr.prefaultstack = 65536;
+
+  thread.SetAttributes(attr);
+  CHECK(thread.GetAttributes().name == attr.name);
+  REQUIRE(thread.Start(&AttributesThread, (void *)&name));
+  thread.Stop();
+
+#ifdef USE_PTHREADS
+  CHECK((thread.GetAppliedAttributes() & Thread::ATTRIBUTE_STACKSIZE) != 0);
+#endif
+
+#if defined(TARGET_OS_UNIXBSD) && !defined(__APPLE__)
+  CHECK((thread.GetAppliedAttributes() & Thread::ATTRIBUTE_NAME) != 0);
+  CHECK(name == "bbcat-attribute");
+#endif
+
+  // prefaulting is limited to the stack available
+  size_t prefaulted = ~(size_t)0;
+  attr.prefaultstack = 1 << 30;
+  thread.SetAttributes(attr);
+  REQUIRE(thread.Start(&AttributesThread, (void *)&name));
+  thread.Stop();
+  CHECK((thread.GetAppliedAttributes(&prefaulted) & Thread::ATTRIBUTE_PREFAULTSTACK) != 0);
+  CHECK(prefaulted > 0);
+#ifdef USE_PTHREADS
+  CHECK(prefaulted < attr.stacksize);
+#else
+  CHECK(prefaulted < attr.prefaultstack);
+#endif
+  attr.prefaultstack = 65536;
+
+  // attributes are kept for the next start
+  name = "";
+  attr.policy = Thread::POLICY_DEFAULT;
+  thread.SetAttributes(attr);
+  REQUIRE(thread.Start(&AttributesThread, (void *)&name));
+  thread.Stop();
+  CHECK((thread.GetAppliedAttributes() & Thread::ATTRIBUTE_PRIORITY) == 0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Lock test/benchmark parameters
+ */
+/*--------------------------------------------------------------------------------*/
+typedef struct
+{
+  void                *lock;
+  uint_t              iterations;
+  uint_t              readpercent;      ///< percentage of accesses that only read (reader-writer lock only)
+  uint64_t            counter;          ///< protected by lock
+  std::atomic<uint_t> readers;          ///< number of threads currently reading
+  std::atomic<uint_t> errors;
+} LOCKTESTPARAMS;
+
+template<typename OBJ, typename GUARD>
+static void *__LockTest(Thread& thread, void *arg)
+{
+  LOCKTESTPARAMS& params = *(LOCKTESTPARAMS *)arg;
+  OBJ&   lock = *(OBJ *)params.lock;
+  uint_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.iterations; i++)
+  {
+    GUARD guard(lock);
+    params.counter++;
+  }
+
+  return NULL;
+}
+
+static void *__RWLockTest(Thread& thread, void *arg)
+{
+  LOCKTESTPARAMS&     params = *(LOCKTESTPARAMS *)arg;
+  ThreadRWLockObject& lock = *(ThreadRWLockObject *)params.lock;
+  uint_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.iterations; i++)
+  {
+    if ((i % 100) < params.readpercent)
+    {
+      ThreadReadLock guard(lock);
+      params.readers++;
+      if (params.counter == (uint64_t)-1) params.errors++;
+      params.readers--;
+    }
+    else
+    {
+      ThreadWriteLock guard(lock);
+      // no reader can be active whilst writing
+      if (params.readers) params.errors++;
+      params.counter++;
+    }
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Run threads of call sharing params
+ *
+ * @return time taken in ns
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t RunLockTest(Thread::THREADCALL call, LOCKTESTPARAMS& params, uint_t nthreads)
+{
+  std::vector<Thread *> threads;
+  uint64_t t0 = GetNanosecondTicks();
+  uint_t   i;
+
+  params.counter = 0;
+  params.readers = 0;
+  params.errors  = 0;
+
+  for (i = 0; i < nthreads; i++) threads.push_back(new Thread(call, &params));
+  for (i = 0; i < nthreads; i++)
+  {
+    threads[i]->Stop();
+    delete threads[i];
+  }
+
+  return GetNanosecondTicks() - t0;
+}
+
+TEST_CASE("threadlock")
+{
+  LOCKTESTPARAMS params;
+
+  params.iterations  = 20000;
+  params.readpercent = 90;
+
+  SECTION("mutex")
+  {
+    ThreadMutexObject lock;
+    params.lock = &lock;
+    RunLockTest(&__LockTest<ThreadMutexObject, ThreadMutexLock>, params, 4);
+    CHECK(params.counter == (4 * params.iterations));
+
+    CHECK(lock.TryLock());
+    CHECK(!lock.TryLock());
+    lock.Unlock();
+  }
+
+  SECTION("adaptive")
+  {
+    ThreadAdaptiveLockObject lock(10);
+    params.lock = &lock;
+    CHECK(lock.GetSpins() == 10);
+    RunLockTest(&__LockTest<ThreadAdaptiveLockObject, ThreadAdaptiveLock>, params, 4);
+    CHECK(params.counter == (4 * params.iterations));
+
+    // no spinning
+    lock.SetSpins(0);
+    RunLockTest(&__LockTest<ThreadAdaptiveLockObject, ThreadAdaptiveLock>, params, 4);
+    CHECK(params.counter == (4 * params.iterations));
+  }
+
+  SECTION("reader-writer")
+  {
+    ThreadRWLockObject lock;
+    params.lock = &lock;
+    RunLockTest(&__RWLockTest, params, 4);
+    CHECK(params.errors == 0);
+    CHECK(params.counter == (4 * params.iterations / 10));
+
+    // multiple readers at once
+    {
+      ThreadReadLock lock1(lock);
+      ThreadReadLock lock2((const ThreadRWLockObject&)lock);
+    }
+    {
+      ThreadWriteLock lock3(lock);
+    }
+  }
+}
+
+TEST_CASE("threadlock-profiling")
+{
+  ThreadLockObject lock("test lock");
+  LOCKTESTPARAMS   params;
+
+  ThreadLockObject::ResetAllStats();
+
+  params.iterations = 20000;
+  params.lock       = &lock;
+  RunLockTest(&__LockTest<ThreadLockObject, ThreadLock>, params, 4);
+  CHECK(params.counter == (4 * params.iterations));
+
+  // recursive locking is only counted once
+  {
+    ThreadLock lock1(lock);
+    ThreadLock lock2(lock);
+  }
+
+  ThreadLockObject::STATS stats = lock.GetStats();
+  std::vector<ThreadLockObject::STATS> list;
+  std::string report, json;
+
+  ThreadLockObject::GetAllStats(list);
+  report = ThreadLockObject::GetReport();
+  json   = ThreadLockObject::GetReportJSON();
+
+  if (ThreadLockObject::IsProfilingEnabled())
+  {
+    uint_t i;
+    bool   found = false;
+
+    CHECK(stats.name == "test lock");
+    CHECK(stats.acquisitions == (4 * params.iterations + 1));
+    CHECK(stats.contended <= stats.acquisitions);
+    CHECK(stats.maxwait <= stats.totalwait);
+    CHECK(stats.maxhold <= stats.totalhold);
+
+    for (i = 0; i < list.size(); i++)
+    {
+      if (i) CHECK(list[i - 1].totalwait >= list[i].totalwait);
+      found |= (list[i].name == "test lock");
+    }
+    CHECK(found);
+    CHECK(report.find("'test lock") != std::string::npos);
+    CHECK(json.find("\"name\": \"test lock\", \"acquisitions\": 80001") != std::string::npos);
+
+    ThreadLockObject::ResetAllStats();
+    CHECK(lock.GetStats().acquisitions == 0);
+
+#ifdef USE_PTHREADS
+    // time spent waiting on a condition is not counted as holding the lock
+    ThreadBoolSignalObject signal;
+    CHECK(!signal.TimedWait(50));
+    stats = signal.GetStats();
+    CHECK(stats.acquisitions == 2);
+    CHECK(stats.maxhold < 25000000);
+#endif
+  }
+  else
+  {
+    CHECK(stats.acquisitions == 0);
+    CHECK(list.empty());
+    CHECK(report.empty());
+    CHECK(json == "[]");
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Semaphore/latch/barrier test parameters
+ */
+/*--------------------------------------------------------------------------------*/
+typedef struct
+{
+  ThreadSemaphoreObject *semaphore;
+  ThreadLatchObject     *latch;
+  ThreadBarrierObject   *barrier;
+  uint_t                iterations;
+  std::atomic<uint_t>   counter;
+  std::atomic<uint_t>   serial;         ///< number of times ArriveAndWait() returned true
+  std::atomic<uint_t>   errors;
+  std::atomic<uint_t>   arrivals[16];   ///< threads arrived in each phase (modulo 16)
+} SYNCTESTPARAMS;
+
+static void *__SemaphoreTest(Thread& thread, void *arg)
+{
+  SYNCTESTPARAMS& params = *(SYNCTESTPARAMS *)arg;
+  uint_t i;
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.iterations; i++)
+  {
+    params.semaphore->Wait();
+    params.counter++;
+  }
+
+  return NULL;
+}
+
+static void *__LatchTest(Thread& thread, void *arg)
+{
+  SYNCTESTPARAMS& params = *(SYNCTESTPARAMS *)arg;
+
+  UNUSED_PARAMETER(thread);
+
+  params.counter++;
+  params.latch->CountDown();
+
+  return NULL;
+}
+
+static void *__BarrierTest(Thread& thread, void *arg)
+{
+  SYNCTESTPARAMS& params = *(SYNCTESTPARAMS *)arg;
+  uint_t i, n = params.barrier->GetThreadCount();
+
+  UNUSED_PARAMETER(thread);
+
+  for (i = 0; i < params.iterations; i++)
+  {
+    // no thread can start the next phase until every thread has arrived
+    params.arrivals[(i + 1) % 16] = 0;
+    params.arrivals[i % 16]++;
+    if (params.barrier->ArriveAndWait()) params.serial++;
+    if (params.arrivals[i % 16] != n) params.errors++;
+
+    // second barrier so that the next phase cannot clear this phase's count whilst it is being checked
+    params.barrier->ArriveAndWait();
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Run threads of call sharing params, optionally calling func from this thread whilst they run
+ */
+/*--------------------------------------------------------------------------------*/
+static void RunSyncTest(Thread::THREADCALL call, SYNCTESTPARAMS& params, uint_t nthreads, void (*func)(SYNCTESTPARAMS& params) = NULL)
+{
+  std::vector<Thread *> threads;
+  uint_t i;
+
+  params.counter = 0;
+  params.serial  = 0;
+  params.errors  = 0;
+  for (i = 0; i < NUMBEROF(params.arrivals); i++) params.arrivals[i] = 0;
+
+  for (i = 0; i < nthreads; i++) threads.push_back(new Thread(call, &params));
+  if (func) (*func)(params);
+  for (i = 0; i < nthreads; i++)
+  {
+    threads[i]->Stop();
+    delete threads[i];
+  }
+}
+
+static void PostSemaphore(SYNCTESTPARAMS& params)
+{
+  uint_t i;
+
+  // mix of single and multiple posts
+  for (i = 0; i < (4 * params.iterations); i += 4)
+  {
+    params.semaphore->Post();
+    params.semaphore->Post(3);
+  }
+}
+
+static void WaitForLatch(SYNCTESTPARAMS& params)
+{
+  params.latch->Wait();
+  if (params.counter != 4) params.errors++;
+}
+
+TEST_CASE("threadsync")
+{
+  SYNCTESTPARAMS params;
+
+  params.iterations = 10000;
+
+  SECTION("semaphore")
+  {
+    ThreadSemaphoreObject semaphore(2, 10);
+
+    CHECK(semaphore.GetCount() == 2);
+    CHECK(semaphore.GetSpins() == 10);
+    CHECK(semaphore.TryWait());
+    CHECK(semaphore.TimedWait(10));
+    CHECK(!semaphore.TryWait());
+    CHECK(!semaphore.TimedWait(10));
+
+    params.semaphore = &semaphore;
+    RunSyncTest(&__SemaphoreTest, params, 4, &PostSemaphore);
+    CHECK(params.counter == (4 * params.iterations));
+    CHECK(semaphore.GetCount() == 0);
+
+    // no spinning
+    semaphore.SetSpins(0);
+    RunSyncTest(&__SemaphoreTest, params, 4, &PostSemaphore);
+    CHECK(params.counter == (4 * params.iterations));
+  }
+
+  SECTION("latch")
+  {
+    ThreadLatchObject latch(4);
+
+    CHECK(!latch.IsReleased());
+    CHECK(!latch.TimedWait(10));
+
+    params.latch = &latch;
+    RunSyncTest(&__LatchTest, params, 4, &WaitForLatch);
+    CHECK(params.errors == 0);
+    CHECK(latch.IsReleased());
+    CHECK(latch.GetCount() == 0);
+
+    // stays released
+    CHECK(latch.TimedWait(0));
+    latch.Wait();
+  }
+
+  SECTION("barrier")
+  {
+    ThreadBarrierObject barrier(4);
+
+    params.iterations = 1000;
+    params.barrier    = &barrier;
+    RunSyncTest(&__BarrierTest, params, 4);
+    CHECK(params.errors == 0);
+    CHECK(params.serial == params.iterations);
+    CHECK(barrier.GetPhase() == (2 * params.iterations));
+
+    // no spinning
+    barrier.SetSpins(0);
+    RunSyncTest(&__BarrierTest, params, 4);
+    CHECK(params.errors == 0);
+    CHECK(params.serial == params.iterations);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Object which counts live instances and detects use after deletion
+ */
+/*--------------------------------------------------------------------------------*/
+class RCUTestObject
+{
+public:
+  RCUTestObject(uint_t v = 0) : value(v), check(~v) {count++;}
+  RCUTestObject(const RCUTestObject& obj) : value(obj.value), check(obj.check) {count++;}
+  ~RCUTestObject() {value = check = 0; count--;}
+
+  bool IsValid() const {return (check == ~value);}
+
+  uint_t value;
+  uint_t check;
+
+  static std::atomic<int> count;
+};
+
+std::atomic<int> RCUTestObject::count(0);
+
+typedef struct
+{
+  RCUObject<RCUTestObject> *obj;
+  uint_t                   iterations;
+  std::atomic<bool>        stop;
+  std::atomic<uint_t>      errors;
+} RCUTESTPARAMS;
+
+static void *__RCUReader(Thread& thread, void *arg)
+{
+  RCUTESTPARAMS& params = *(RCUTESTPARAMS *)arg;
+  uint_t last = 0;
+
+  UNUSED_PARAMETER(thread);
+
+  while (!params.stop)
+  {
+    RCUReadLock lock;
+    const RCUTestObject *obj = params.obj->Get();
+
+    // objects are published in order and must not change or be deleted whilst being read
+    if (!obj->IsValid() || (obj->value < last)) params.errors++;
+    last = obj->value;
+    std::this_thread::yield();
+    if (!obj->IsValid() || (obj->value != last)) params.errors++;
+  }
+
+  return NULL;
+}
+
+TEST_CASE("rcuobject")
+{
+  SECTION("basic")
+  {
+    RCUObject<RCUTestObject> obj(new RCUTestObject(1));
+
+    {
+      RCUReadLock lock;
+      const RCUTestObject *p = obj.Get();
+
+      CHECK(p->value == 1);
+
+      // replaced object must be kept whilst a reader could be using it
+      obj.Update(new RCUTestObject(2));
+      {
+        RCUReadLock lock2;
+        CHECK(obj.Get()->value == 2);
+      }
+      obj.Reclaim();
+      CHECK(obj.GetRetiredCount() == 1);
+      CHECK(p->IsValid());
+      CHECK(p->value == 1);
+    }
+
+    obj.Reclaim();
+    CHECK(obj.GetRetiredCount() == 0);
+    CHECK(RCUTestObject::count == 1);
+
+    RCUTestObject *p = obj.BeginUpdate();
+    p->value = 3;
+    p->check = ~3;
+    obj.EndUpdate(p);
+
+    // abandoned update
+    p = obj.BeginUpdate();
+    p->value = 4;
+    p->check = ~4;
+    obj.AbandonUpdate(p);
+
+    obj.Synchronize();
+    CHECK(obj.GetRetiredCount() == 0);
+    {
+      RCUReadLock lock;
+      CHECK(obj.Get()->value == 3);
+    }
+  }
+  CHECK(RCUTestObject::count == 0);
+
+  SECTION("stress")
+  {
+    RCUObject<RCUTestObject> obj;
+    RCUTESTPARAMS params;
+    std::vector<Thread *> threads;
+    uint_t i;
+
+    params.obj        = &obj;
+    params.iterations = 10000;
+    params.stop       = false;
+    params.errors     = 0;
+
+    for (i = 0; i < 4; i++) threads.push_back(new Thread(&__RCUReader, &params));
+
+    for (i = 1; i <= params.iterations; i++)
+    {
+      RCUTestObject *p = obj.BeginUpdate();
+      p->value = i;
+      p->check = ~i;
+      obj.EndUpdate(p);
+    }
+
+    params.stop = true;
+    for (i = 0; i < threads.size(); i++)
+    {
+      threads[i]->Stop();
+      delete threads[i];
+    }
+
+    CHECK(params.errors == 0);
+
+    // every reader has exited
+    obj.Reclaim();
+    CHECK(obj.GetRetiredCount() == 0);
+    CHECK(RCUTestObject::count == 1);
+  }
+  CHECK(RCUTestObject::count == 0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Contention benchmark for the lock family
+ *
+ * Run using 'tests [benchmark]'
+ */
+/*--------------------------------------------------------------------------------*/
+TEST_CASE("threadlock-benchmark", "[.][benchmark]")
+{
+  static const uint_t nthreads[] = {1, 2, 4, 8, 16};
+  const uint_t count = 2000000;
+  uint_t i;
+
+  for (i = 0; i < NUMBEROF(nthreads); i++)
+  {
+    ThreadLockObject         recursive;
+    ThreadMutexObject        mutex;
+    ThreadAdaptiveLockObject adaptive;
+    ThreadRWLockObject       rwlock;
+    LOCKTESTPARAMS           params;
+    uint64_t                 t[5];
+
+    params.iterations  = count / nthreads[i];
+    params.readpercent = 90;
+
+    params.lock = &recursive;
+    t[0] = RunLockTest(&__LockTest<ThreadLockObject, ThreadLock>, params, nthreads[i]);
+    params.lock = &mutex;
+    t[1] = RunLockTest(&__LockTest<ThreadMutexObject, ThreadMutexLock>, params, nthreads[i]);
+    params.lock = &adaptive;
+    t[2] = RunLockTest(&__LockTest<ThreadAdaptiveLockObject, ThreadAdaptiveLock>, params, nthreads[i]);
+    params.lock = &rwlock;
+    t[3] = RunLockTest(&__RWLockTest, params, nthreads[i]);
+    params.readpercent = 100;
+    t[4] = RunLockTest(&__RWLockTest, params, nthreads[i]);
+
+    BBCDEBUG("Locks %2u threads: recursive %0.1lfM/s, mutex %0.1lfM/s, adaptive %0.1lfM/s, rw (90%% read) %0.1lfM/s, rw (100%% read) %0.1lfM/s",
+             nthreads[i],
+             (double)count * 1.0e3 / (double)t[0],
+             (double)count * 1.0e3 / (double)t[1],
+             (double)count * 1.0e3 / (double)t[2],
+             (double)count * 1.0e3 / (double)t[3],
+             (double)count * 1.0e3 / (double)t[4]);
+  }
+}
+
+class CountingTask : public TaskPool::Task
+{
+public:
+  CountingTask(std::atomic<uint_t>& _count) : count(_count) {}
+
+  virtual void Run() {count++;}
+
+protected:
+  std::atomic<uint_t>& count;
+};
+
+#ifdef USE_PTHREADS
+/*--------------------------------------------------------------------------------*/
+/** Derivation to allow waiting for the workers to exit
+ *
+ * @note HasFinished() is only maintained by the pthreads implementation of Thread
+ */
+/*--------------------------------------------------------------------------------*/
+class TestTaskPool : public TaskPool
+{
+public:
+  TestTaskPool(uint_t nthreads) : TaskPool(nthreads) {}
+
+  void WaitForWorkersToFinish()
+  {
+    uint_t i;
+    for (i = 0; i < workers.size(); i++) while (!workers[i]->thread.HasFinished()) usleep(1000);
+  }
+};
+#endif
+
+TEST_CASE("taskpool")
+{
+  SECTION("thread count")
+  {
+    SystemParameters::Get().Set("taskpoolthreads", 3);
+    CHECK(TaskPool::GetDefaultThreadCount() == 3);
+    SystemParameters::Get().Set("taskpoolthreads", 0);
+    CHECK(TaskPool::GetDefaultThreadCount() >= 1);
+
+    TaskPool pool(2);
+    CHECK(pool.IsRunning());
+    CHECK(pool.GetThreadCount() == 2);
+  }
+
+  SECTION("futures")
+  {
+    TaskPool pool(4);
+    std::vector<std::future<uint_t> > results;
+    uint_t i;
+
+    for (i = 0; i < 100; i++) results.push_back(pool.Submit([i]() {return i * i;}));
+    for (i = 0; i < results.size(); i++) CHECK(results[i].get() == (i * i));
+  }
+
+  SECTION("parallel for")
+  {
+    TaskPool pool(4);
+    std::vector<uint_t> values(10000, 0);
+    uint_t i, errors = 0;
+
+    CHECK(pool.ParallelFor(0, (uint_t)values.size(), [&values](uint_t index) {values[index] += index + 1;}));
+    for (i = 0; i < values.size(); i++) if (values[i] != (i + 1)) errors++;
+    CHECK(errors == 0);
+
+    // empty range and explicit grain
+    CHECK(pool.ParallelFor(5, 5, [&values](uint_t index) {values[index] = 0;}));
+    CHECK(pool.ParallelFor(10, 20, [&values](uint_t index) {values[index] = 0;}, 3));
+    for (i = 10; i < 20; i++) if (values[i] != 0) errors++;
+    CHECK(values[20] == 21);
+    CHECK(errors == 0);
+  }
+
+  SECTION("nested parallel for")
+  {
+    // the inner loops run on the workers whilst they wait for them
+    TaskPool pool(2);
+    std::atomic<uint_t> count(0);
+
+    CHECK(pool.ParallelFor(0, 16, [&pool, &count](uint_t) {
+          pool.ParallelFor(0, 100, [&count](uint_t) {count++;});
+        }, 1));
+    CHECK(count == 1600);
+  }
+
+  SECTION("not running")
+  {
+    TaskPool pool(1);
+    std::atomic<uint_t> count(0);
+
+    pool.Stop();
+    CHECK(!pool.IsRunning());
+
+    // tasks run in the calling thread
+    pool.Submit(new CountingTask(count));
+    CHECK(count == 1);
+    CHECK(pool.ParallelFor(0, 10, [&count](uint_t) {count++;}));
+    CHECK(count == 11);
+
+    CHECK(pool.Start(2));
+    CHECK(pool.GetThreadCount() == 2);
+  }
+
+  SECTION("stop runs queued tasks")
+  {
+    TaskPool pool(2);
+    std::atomic<uint_t> count(0);
+    uint_t i;
+
+    for (i = 0; i < 1000; i++) pool.Submit(new CountingTask(count));
+    pool.Stop();
+    CHECK(count == 1000);
+  }
+
+  SECTION("abort discards queued tasks")
+  {
+    TaskPool pool(1);
+    std::atomic<bool> started(false), release(false);
+    std::vector<std::future<void> > results;
+    uint_t i, broken = 0;
+
+    // block the only worker so that the rest stay queued
+    std::future<void> blocker = pool.Submit([&started, &release]() {started = true; while (!release) usleep(1000);});
+    while (!started) usleep(1000);
+    for (i = 0; i < 10; i++) results.push_back(pool.Submit([]() {}));
+
+    pool.Abort(false);
+    release = true;
+    pool.Abort();
+
+    blocker.get();
+    for (i = 0; i < results.size(); i++)
+    {
+      try
+      {
+        results[i].get();
+      }
+      catch (const std::future_error& e)
+      {
+        if (e.code() == std::future_errc::broken_promise) broken++;
+      }
+    }
+
+    CHECK(broken == results.size());
+  }
+
+#ifdef USE_PTHREADS
+  SECTION("abort discards queued tasks after workers have exited")
+  {
+    TestTaskPool pool(1);
+    std::atomic<bool> started(false), release(false);
+    std::atomic<uint_t> count(0);
+    uint_t i;
+
+    std::future<void> blocker = pool.Submit([&started, &release]() {started = true; while (!release) usleep(1000);});
+    while (!started) usleep(1000);
+    for (i = 0; i < 10; i++) pool.Submit(new CountingTask(count));
+
+    pool.Abort(false);
+    release = true;
+
+    // joining finished workers must not lose the abort
+    pool.WaitForWorkersToFinish();
+    pool.Abort();
+
+    blocker.get();
+    CHECK(count == 0);
+
+    // a restarted pool runs tasks again
+    CHECK(pool.Start(1));
+    pool.Submit(new CountingTask(count));
+    pool.Stop();
+    CHECK(count == 1);
+  }
+#endif
+}
+
+BBC_AUDIOTOOLBOX_END